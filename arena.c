@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <sys/types.h>
+#include <err.h>
+
+#include "arena.h"
+
+#define ACHUNK_MIN	4096
+#define AALIGN(n)	(((n) + 15) & ~(size_t)15)
+
+struct achunk {
+	struct achunk	*ac_next;
+	size_t		ac_size;
+	size_t		ac_used;
+	u_char		ac_data[];
+};
+
+void *
+aalloc(struct arena *a, size_t n)
+{
+	struct achunk *c = a->a_head;
+	size_t sz;
+	void *p;
+
+	n = AALIGN(n);
+	if (c == 0 || c->ac_size - c->ac_used < n) {
+		sz = c ? c->ac_size * 2 : ACHUNK_MIN;
+		while (sz < n)
+			sz *= 2;
+		c = malloc(sizeof *c + sz);
+		if (c == 0)
+			err(1, "malloc");
+		c->ac_next = a->a_head;
+		c->ac_size = sz;
+		c->ac_used = 0;
+		a->a_head = c;
+	}
+	p = c->ac_data + c->ac_used;
+	c->ac_used += n;
+	a->a_last = n;
+	return p;
+}
+
+/*
+ * Give back the unused tail of the most recent allocation, for
+ * buffers sized by a guess before the real length was known.
+ */
+void
+atrim(struct arena *a, void *p, size_t n)
+{
+	struct achunk *c = a->a_head;
+
+	n = AALIGN(n);
+	if (c == 0 || (u_char *)p != c->ac_data + c->ac_used - a->a_last ||
+	    n > a->a_last)
+		return;
+	c->ac_used -= a->a_last - n;
+	a->a_last = n;
+}
+
+void
+afree(struct arena *a)
+{
+	struct achunk *c, *n;
+
+	for (c = a->a_head; c; c = n) {
+		n = c->ac_next;
+		free(c);
+	}
+	a->a_head = 0;
+	a->a_last = 0;
+}
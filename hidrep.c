@@ -0,0 +1,369 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <err.h>
+
+#include "hidrep.h"
+
+/*
+ * Total length of the item starting with the have bytes at b, or, if
+ * that cannot be told yet, how many bytes are needed to tell.  Long
+ * items are 0xfe, bDataSize, bLongItemTag and the data.
+ */
+static int
+hid_itemlen(const u_char *b, int have)
+{
+	int s;
+
+	if (have < 1)
+		return 1;
+	if (b[0] == 0xfe)
+		return have < 2 ? 2 : 3 + b[1];
+	s = b[0] & 3;
+	return 1 + (s == 3 ? 4 : s);
+}
+
+/*
+ * Get the next item from the bytes between *pp and end, advancing
+ * *pp.  An item split across chunks is collected in hs, so the
+ * descriptor can be fed in whatever pieces it arrives in.  Returns 0
+ * with an item, or -1 once the chunk is used up.
+ */
+int
+hid_feed(struct hidstream *hs, const u_char **pp, const u_char *end,
+    struct hiditem *it)
+{
+	const u_char *p = *pp, *ib;
+	int need, n, i;
+
+	if (hs->hs_have == 0) {
+		/* Usually the whole item is there; use it in place. */
+		if (p == end)
+			return -1;
+		need = hid_itemlen(p, end - p);
+		if (end - p >= need) {
+			ib = p;
+			p += need;
+			goto decode;
+		}
+	}
+	for (;;) {
+		need = hid_itemlen(hs->hs_buf, hs->hs_have);
+		if (hs->hs_have >= need)
+			break;
+		if (p == end) {
+			*pp = p;
+			return -1;
+		}
+		n = need - hs->hs_have;
+		if (n > end - p)
+			n = end - p;
+		memcpy(hs->hs_buf + hs->hs_have, p, n);
+		hs->hs_have += n;
+		p += n;
+	}
+	ib = hs->hs_buf;
+	hs->hs_have = 0;
+
+ decode:
+	if (ib[0] == 0xfe) {
+		it->hi_type = HID_LONG;
+		it->hi_size = ib[1];
+		it->hi_tag = ib[2];
+		it->hi_data = ib + 3;
+	} else {
+		it->hi_tag = ib[0] >> 4;
+		it->hi_type = (ib[0] >> 2) & 3;
+		it->hi_size = ib[0] & 3;
+		if (it->hi_size == 3)
+			it->hi_size = 4;
+		it->hi_data = ib + 1;
+	}
+	it->hi_uval = 0;
+	if (it->hi_size <= 4) {
+		for (i = 0; i < it->hi_size; i++)
+			it->hi_uval |= (u_int32_t)it->hi_data[i] << (8 * i);
+	}
+	switch (it->hi_size) {
+	case 1:
+		it->hi_sval = (int8_t)it->hi_uval;
+		break;
+	case 2:
+		it->hi_sval = (int16_t)it->hi_uval;
+		break;
+	default:
+		it->hi_sval = (int32_t)it->hi_uval;
+		break;
+	}
+	*pp = p;
+	return 0;
+}
+
+/*
+ * Get the item at *pp from a complete descriptor.  Returns -1 at the
+ * end or if the last item is cut off.
+ */
+int
+hid_item(const u_char **pp, const u_char *end, struct hiditem *it)
+{
+	struct hidstream hs;
+
+	hs.hs_have = 0;
+	return hid_feed(&hs, pp, end, it);
+}
+
+struct hidglobal {
+	u_int32_t	page;
+	int32_t		lmin;
+	int32_t		lmax;
+	u_int32_t	size;
+	u_int32_t	count;
+	u_int32_t	id;
+};
+
+static void
+hid_addfield(struct hidplan *hp, int *nalloc, const struct hidfield *hf)
+{
+	if (hp->hp_nfields == *nalloc) {
+		*nalloc = *nalloc ? *nalloc * 2 : 64;
+		hp->hp_fields = realloc(hp->hp_fields,
+		    *nalloc * sizeof *hp->hp_fields);
+		if (hp->hp_fields == NULL)
+			err(1, "realloc");
+	}
+	hp->hp_fields[hp->hp_nfields++] = *hf;
+}
+
+/*
+ * Work out where every field of every report lives.  Constant
+ * (padding) fields take up space but are not listed.  Returns -1 if
+ * the descriptor is cut off, the global stack over- or underflows, or
+ * a report would be longer than HID_MAXBITS.
+ */
+int
+hid_compile(struct hidplan *hp, const u_char *d, int len)
+{
+	struct hidglobal g, stack[HID_MAXSTACK];
+	u_int32_t usages[HID_MAXUSAGES], umin = 0, u;
+	struct hidfield hf;
+	struct hiditem it;
+	const u_char *p, *end = d + len;
+	int sp = 0, nusage = 0, haveumin = 0, nalloc = 0, kind;
+	u_int32_t i;
+
+	memset(hp, 0, sizeof *hp);
+	memset(&g, 0, sizeof g);
+	for (p = d; p < end; ) {
+		if (hid_item(&p, end, &it) < 0)
+			goto bad;
+		switch (it.hi_type) {
+		case HID_MAIN:
+			switch (it.hi_tag) {
+			case 8:
+				kind = HID_INPUT;
+				break;
+			case 9:
+				kind = HID_OUTPUT;
+				break;
+			case 11:
+				kind = HID_FEATURE;
+				break;
+			default:	/* Collection, End Collection */
+				kind = -1;
+				break;
+			}
+			if (kind >= 0) {
+				hf.hf_kind = kind;
+				hf.hf_id = g.id;
+				hf.hf_size = g.size;
+				hf.hf_flags = it.hi_uval;
+				hf.hf_lmin = g.lmin;
+				hf.hf_lmax = g.lmax;
+				if (g.count > HID_MAXBITS ||
+				    (u_int64_t)g.count * g.size +
+				    hp->hp_bits[kind][g.id] > HID_MAXBITS)
+					goto bad;
+				for (i = 0; i < g.count; i++) {
+					if (!(it.hi_uval & 2))	/* Array */
+						u = nusage ? usages[0] : umin;
+					else if (i < (u_int32_t)nusage)
+						u = usages[i];
+					else
+						u = nusage ? usages[nusage-1] : umin;
+					hf.hf_usage = u;
+					hf.hf_pos = hp->hp_bits[kind][g.id];
+					hp->hp_bits[kind][g.id] += g.size;
+					if (!(it.hi_uval & 1) && g.size >= 1 &&
+					    g.size <= 32)
+						hid_addfield(hp, &nalloc, &hf);
+				}
+			}
+			nusage = 0;
+			haveumin = 0;
+			umin = 0;
+			break;
+		case HID_GLOBAL:
+			switch (it.hi_tag) {
+			case 0:
+				g.page = it.hi_uval;
+				break;
+			case 1:
+				g.lmin = it.hi_sval;
+				break;
+			case 2:
+				/* Logical Max is only negative if Min is. */
+				g.lmax = g.lmin < 0 ? it.hi_sval :
+				    (int32_t)it.hi_uval;
+				break;
+			case 7:
+				g.size = it.hi_uval;
+				break;
+			case 8:
+				g.id = it.hi_uval & 0xff;
+				hp->hp_hasid = 1;
+				break;
+			case 9:
+				g.count = it.hi_uval;
+				break;
+			case 10:
+				if (sp == HID_MAXSTACK)
+					goto bad;
+				stack[sp++] = g;
+				break;
+			case 11:
+				if (sp == 0)
+					goto bad;
+				g = stack[--sp];
+				break;
+			}
+			break;
+		case HID_LOCAL:
+			u = it.hi_size == 4 ? it.hi_uval :
+			    (g.page << 16) | it.hi_uval;
+			switch (it.hi_tag) {
+			case 0:
+				if (nusage < HID_MAXUSAGES)
+					usages[nusage++] = u;
+				break;
+			case 1:
+				umin = u;
+				haveumin = 1;
+				break;
+			case 2:
+				if (!haveumin)
+					break;
+				for (; umin <= u && nusage < HID_MAXUSAGES; umin++)
+					usages[nusage++] = umin;
+				haveumin = 0;
+				break;
+			}
+			break;
+		}
+	}
+	return 0;
+
+ bad:
+	hid_freeplan(hp);
+	return -1;
+}
+
+void
+hid_freeplan(struct hidplan *hp)
+{
+	free(hp->hp_fields);
+	hp->hp_fields = 0;
+	hp->hp_nfields = 0;
+}
+
+/* Length in bytes of report id of the given kind, including the ID. */
+int
+hid_reportlen(const struct hidplan *hp, int kind, int id)
+{
+	return (hp->hp_bits[kind][id] + 7) / 8 + (hp->hp_hasid ? 1 : 0);
+}
+
+int
+hid_nfields(const struct hidplan *hp, int kind, int id)
+{
+	int i, n;
+
+	for (n = i = 0; i < hp->hp_nfields; i++)
+		if (hp->hp_fields[i].hf_kind == kind &&
+		    hp->hp_fields[i].hf_id == id)
+			n++;
+	return n;
+}
+
+/*
+ * Decode n reports, stride bytes apart, into out.  The fields of the
+ * given kind and report ID go column by column: field j of report r
+ * ends up in out[j * n + r].  Reports carrying another ID decode as
+ * zero.  The loop over reports is kept free of branches so the
+ * compiler can unroll or vectorize it.  Returns the number of
+ * columns written.
+ */
+int
+hid_decode(const struct hidplan *hp, int kind, int id, const u_char *buf,
+    size_t stride, int n, int32_t *out)
+{
+	const struct hidfield *hf;
+	const u_char *p;
+	u_int64_t v;
+	u_int32_t mask, sign, pos, keep;
+	int32_t *col;
+	int i, j, k, r, nb, sh, byte;
+
+	for (j = i = 0; i < hp->hp_nfields; i++) {
+		hf = &hp->hp_fields[i];
+		if (hf->hf_kind != kind || hf->hf_id != id)
+			continue;
+		col = out + (size_t)j++ * n;
+		pos = hf->hf_pos + (hp->hp_hasid ? 8 : 0);
+		byte = pos >> 3;
+		sh = pos & 7;
+		nb = (sh + hf->hf_size + 7) / 8;
+		if ((size_t)(byte + nb) > stride) {
+			memset(col, 0, n * sizeof *col);
+			continue;
+		}
+		mask = hf->hf_size == 32 ? 0xffffffff :
+		    (1U << hf->hf_size) - 1;
+		sign = hf->hf_lmin < 0 ? 1U << (hf->hf_size - 1) : 0;
+		for (r = 0; r < n; r++) {
+			p = buf + r * stride;
+			v = 0;
+			for (k = 0; k < nb; k++)
+				v |= (u_int64_t)p[byte + k] << (8 * k);
+			v = (v >> sh) & mask;
+			keep = hp->hp_hasid ? -(u_int32_t)(p[0] == id) : ~0U;
+			col[r] = (int32_t)(((u_int32_t)v ^ sign) - sign) & keep;
+		}
+	}
+	return j;
+}
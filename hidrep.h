@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * HID report descriptors.  hid_feed() splits a descriptor into items
+ * as it arrives, in chunks of any size; hid_item() does the same for
+ * a descriptor that is all there.  hid_compile() turns the items into
+ * a plan giving the bit position, size, usage and logical range of
+ * every field, and hid_decode() applies a plan to a batch of raw
+ * reports.
+ */
+#define HID_MAIN	0
+#define HID_GLOBAL	1
+#define HID_LOCAL	2
+#define HID_LONG	3
+
+#define HID_INPUT	0
+#define HID_OUTPUT	1
+#define HID_FEATURE	2
+#define HID_NKINDS	3
+
+#define HID_MAXSTACK	8
+#define HID_MAXUSAGES	256
+#define HID_MAXBITS	(65536 * 8)	/* in one report */
+
+#define HID_ITEMMAX	(3 + 255)	/* long item with the most data */
+
+/* Parser state kept between chunks. */
+struct hidstream {
+	int		hs_have;
+	u_char		hs_buf[HID_ITEMMAX];
+};
+
+struct hiditem {
+	int		hi_type;
+	int		hi_tag;
+	int		hi_size;
+	u_int32_t	hi_uval;	/* data, zero extended */
+	int32_t		hi_sval;	/* data, sign extended */
+	const u_char	*hi_data;	/* valid until the next call */
+};
+
+struct hidfield {
+	u_int32_t	hf_pos;		/* bit position after any report ID */
+	u_int8_t	hf_size;	/* bits, at most 32 */
+	u_int8_t	hf_kind;	/* HID_INPUT, ... */
+	u_int8_t	hf_id;		/* report ID */
+	u_int8_t	hf_flags;	/* low bits of the main item */
+	int32_t		hf_lmin;
+	int32_t		hf_lmax;
+	u_int32_t	hf_usage;	/* page << 16 | usage */
+};
+
+struct hidplan {
+	struct hidfield	*hp_fields;
+	int		hp_nfields;
+	int		hp_hasid;
+	u_int32_t	hp_bits[HID_NKINDS][256];	/* report sizes */
+};
+
+int hid_feed(struct hidstream *, const u_char **, const u_char *,
+    struct hiditem *);
+int hid_item(const u_char **, const u_char *, struct hiditem *);
+int hid_compile(struct hidplan *, const u_char *, int);
+void hid_freeplan(struct hidplan *);
+int hid_reportlen(const struct hidplan *, int, int);
+int hid_nfields(const struct hidplan *, int, int);
+int hid_decode(const struct hidplan *, int, int, const u_char *, size_t,
+    int, int32_t *);
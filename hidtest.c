@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Check the incremental HID item parser against the one-shot one.
+ * Random report descriptors of 4 to 16 KB, long items included, are
+ * fed to hid_feed in random chunks, a byte at a time and whole, and
+ * must give the same items as hid_item.  Each is also cut off in the
+ * middle of an item, where both must stop after the last whole one
+ * and hid_feed must be left holding the rest.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <err.h>
+
+#include "hidrep.h"
+
+#define MINLEN	4096
+#define MAXLEN	16384
+
+struct titem {
+	int		ti_off;		/* where it starts */
+	int		ti_len;
+	struct hiditem	ti_it;
+};
+
+int fails;
+
+void
+usage(void)
+{
+	extern char *__progname;
+
+	fprintf(stderr, "Usage: %s [-n count] [-s seed]\n", __progname);
+	exit(1);
+}
+
+/* A random descriptor of about len bytes; returns its real length. */
+int
+gendesc(u_char *d, int len)
+{
+	int n = 0, s, i;
+
+	while (n < len) {
+		if (random() % 50 == 0) {
+			s = random() % 256;
+			d[n++] = 0xfe;
+			d[n++] = s;
+			d[n++] = random() % 256;
+		} else {
+			/* Type 3 is only used by long items. */
+			s = random() % 4;
+			d[n++] = (random() % 16) << 4 | (random() % 3) << 2 | s;
+			if (s == 3)
+				s = 4;
+		}
+		for (i = 0; i < s; i++)
+			d[n++] = random() % 256;
+	}
+	return n;
+}
+
+/* The items hid_item finds in the first len bytes. */
+int
+oneshot(const u_char *d, int len, struct titem *ti)
+{
+	const u_char *p = d, *q;
+	int n = 0;
+
+	for (q = p; hid_item(&p, d + len, &ti[n].ti_it) == 0; q = p) {
+		ti[n].ti_off = q - d;
+		ti[n].ti_len = p - q;
+		n++;
+	}
+	return n;
+}
+
+int
+sameitem(const struct hiditem *a, const struct hiditem *b)
+{
+	return a->hi_type == b->hi_type && a->hi_tag == b->hi_tag &&
+	    a->hi_size == b->hi_size && a->hi_uval == b->hi_uval &&
+	    a->hi_sval == b->hi_sval &&
+	    memcmp(a->hi_data, b->hi_data, a->hi_size) == 0;
+}
+
+/*
+ * Feed the first len bytes in chunks of at most chunk bytes (random
+ * sizes if chunk is 0) and compare with the n items in ti.  want is
+ * what hid_feed should be holding at the end.
+ */
+void
+feed(const char *what, const u_char *d, int len, int chunk,
+    const struct titem *ti, int n, int want)
+{
+	struct hidstream hs;
+	struct hiditem it;
+	const u_char *p = d, *end;
+	int k = 0, c;
+
+	hs.hs_have = 0;
+	while (p < d + len) {
+		c = chunk ? chunk : 1 + random() % 600;
+		end = p + c < d + len ? p + c : d + len;
+		while (hid_feed(&hs, &p, end, &it) == 0) {
+			if (k == n || !sameitem(&it, &ti[k].ti_it)) {
+				warnx("%s: item %d at %d differs", what, k,
+				    k < n ? ti[k].ti_off : -1);
+				fails++;
+				return;
+			}
+			k++;
+		}
+		if (p != end) {
+			warnx("%s: chunk not used up", what);
+			fails++;
+			return;
+		}
+	}
+	if (k != n || hs.hs_have != want) {
+		warnx("%s: %d items, %d held; want %d, %d", what, k,
+		    hs.hs_have, n, want);
+		fails++;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static u_char d[MAXLEN];
+	static struct titem ti[MAXLEN];
+	char what[64];
+	unsigned long seed = 1;
+	int count = 100, ch, i, len, n, cut, k;
+
+	while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+		switch(ch) {
+		case 'n':
+			count = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage();
+		}
+	}
+	srandom(seed);
+
+	for (i = 0; i < count; i++) {
+		/* Leave room for a long item past the end. */
+		len = gendesc(d,
+		    MINLEN + random() % (MAXLEN - MINLEN - 3 - 255));
+		n = oneshot(d, len, ti);
+		if (n == 0 || ti[n - 1].ti_off + ti[n - 1].ti_len != len) {
+			warnx("descriptor %d: one-shot parse stopped short", i);
+			fails++;
+			continue;
+		}
+		snprintf(what, sizeof what, "descriptor %d random", i);
+		feed(what, d, len, 0, ti, n, 0);
+		snprintf(what, sizeof what, "descriptor %d bytewise", i);
+		feed(what, d, len, 1, ti, n, 0);
+		snprintf(what, sizeof what, "descriptor %d whole", i);
+		feed(what, d, len, len, ti, n, 0);
+
+		/* Cut inside an item that is longer than a byte. */
+		do
+			k = random() % n;
+		while (ti[k].ti_len < 2);
+		cut = ti[k].ti_off + 1 + random() % (ti[k].ti_len - 1);
+		if (oneshot(d, cut, ti) != k) {
+			warnx("descriptor %d: cut at %d not detected", i, cut);
+			fails++;
+			continue;
+		}
+		snprintf(what, sizeof what, "descriptor %d cut at %d", i, cut);
+		feed(what, d, cut, 0, ti, k, cut - ti[k].ti_off);
+	}
+	if (fails)
+		errx(1, "%d checks failed", fails);
+	printf("%d descriptors ok\n", count);
+	exit(0);
+}
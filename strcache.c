@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <pthread.h>
+#include <dev/usb/usb.h>
+
+#include "strcache.h"
+
+/*
+ * The cache file is a header followed by an open addressed hash
+ * table of fixed size records, so a warm run can probe it directly
+ * in the mapping.  Strings fetched during the run go into a second,
+ * in-memory table with the same layout; both are merged and written
+ * back when the cache is closed.
+ */
+#define SC_MAGIC	"USBSTRC1"
+#define SC_VERSION	1
+#define SC_MINSLOTS	64
+
+struct schdr {
+	char		sh_magic[8];
+	u_int32_t	sh_version;
+	u_int32_t	sh_nslots;
+	u_int32_t	sh_nused;
+	u_int32_t	sh_pad;
+};
+
+struct screc {
+	struct strkey	sr_key;
+	u_char		sr_desc[256];	/* raw descriptor, bLength 0 if free */
+};
+
+struct sctab {
+	struct screc	*st_recs;
+	u_int32_t	st_nslots;	/* always a power of two */
+	u_int32_t	st_nused;
+};
+
+static struct sctab disktab, memtab;
+static void *diskmap;
+static size_t disksize;
+static char *cachefile;
+static pthread_mutex_t sclock = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a */
+u_int64_t
+strhash(const void *p, size_t n)
+{
+	const u_char *s = p;
+	u_int64_t h = 0xcbf29ce484222325ULL;
+
+	while (n--) {
+		h ^= *s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static struct screc *
+sclookup(struct sctab *t, const struct strkey *k)
+{
+	struct screc *r;
+	u_int32_t i, n, mask;
+
+	if (t->st_nslots == 0)
+		return 0;
+	mask = t->st_nslots - 1;
+	/* Bounded, in case a damaged file has no free slot left. */
+	for (i = strhash(k, sizeof *k) & mask, n = 0; n < t->st_nslots;
+	    i = (i + 1) & mask, n++) {
+		r = &t->st_recs[i];
+		if (r->sr_desc[0] == 0)
+			return 0;
+		if (memcmp(&r->sr_key, k, sizeof *k) == 0)
+			return r;
+	}
+	return 0;
+}
+
+static void
+scinsert(struct sctab *t, const struct strkey *k, const u_char *desc)
+{
+	struct sctab nt;
+	struct screc *r;
+	u_int32_t i, mask;
+
+	if ((t->st_nused + 1) * 2 > t->st_nslots) {
+		nt.st_nslots = t->st_nslots ? t->st_nslots * 2 : SC_MINSLOTS;
+		nt.st_nused = 0;
+		nt.st_recs = calloc(nt.st_nslots, sizeof *nt.st_recs);
+		if (nt.st_recs == NULL)
+			err(1, "calloc");
+		for (i = 0; i < t->st_nslots; i++)
+			if (t->st_recs[i].sr_desc[0] != 0)
+				scinsert(&nt, &t->st_recs[i].sr_key,
+				    t->st_recs[i].sr_desc);
+		free(t->st_recs);
+		*t = nt;
+	}
+	mask = t->st_nslots - 1;
+	for (i = strhash(k, sizeof *k) & mask; ; i = (i + 1) & mask) {
+		r = &t->st_recs[i];
+		if (r->sr_desc[0] == 0)
+			break;
+		if (memcmp(&r->sr_key, k, sizeof *k) == 0)
+			return;
+	}
+	r->sr_key = *k;
+	memcpy(r->sr_desc, desc, desc[0]);
+	t->st_nused++;
+}
+
+void
+strcache_open(const char *file)
+{
+	struct schdr *h;
+	struct stat st;
+	int fd;
+
+	cachefile = strdup(file);
+	if (cachefile == NULL)
+		err(1, "strdup");
+	fd = open(file, O_RDONLY);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof *h) {
+		close(fd);
+		return;
+	}
+	disksize = st.st_size;
+	diskmap = mmap(0, disksize, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (diskmap == MAP_FAILED) {
+		warn("%s", file);
+		diskmap = 0;
+		return;
+	}
+	h = diskmap;
+	if (memcmp(h->sh_magic, SC_MAGIC, sizeof h->sh_magic) != 0 ||
+	    h->sh_version != SC_VERSION ||
+	    (h->sh_nslots & (h->sh_nslots - 1)) != 0 ||
+	    h->sh_nused >= h->sh_nslots ||
+	    disksize != sizeof *h + (size_t)h->sh_nslots * sizeof(struct screc)) {
+		warnx("%s: not a string cache, ignored", file);
+		munmap(diskmap, disksize);
+		diskmap = 0;
+		return;
+	}
+	disktab.st_recs = (struct screc *)(h + 1);
+	disktab.st_nslots = h->sh_nslots;
+	disktab.st_nused = h->sh_nused;
+}
+
+static void
+sccopy(usb_string_descriptor_t *us, const struct screc *r)
+{
+	size_t n;
+
+	n = r->sr_desc[0];
+	if (n > sizeof *us)
+		n = sizeof *us;
+	memcpy(us, r->sr_desc, n);
+}
+
+int
+strcache_get(const struct strkey *k, usb_string_descriptor_t *us)
+{
+	struct screc *r;
+
+	/* The mapped table is never modified, so it needs no lock. */
+	r = sclookup(&disktab, k);
+	if (r != 0) {
+		sccopy(us, r);
+		return 1;
+	}
+	/* The in-core one may grow, and move, under a strcache_put. */
+	pthread_mutex_lock(&sclock);
+	r = sclookup(&memtab, k);
+	if (r != 0)
+		sccopy(us, r);
+	pthread_mutex_unlock(&sclock);
+	return r != 0;
+}
+
+void
+strcache_put(const struct strkey *k, const usb_string_descriptor_t *us)
+{
+	u_char desc[256];
+	size_t n;
+
+	n = us->bLength;
+	if (n < 2)
+		return;
+	if (n > sizeof *us)
+		n = sizeof *us;
+	memcpy(desc, us, n);
+	desc[0] = n;
+	pthread_mutex_lock(&sclock);
+	if (sclookup(&disktab, k) == 0)
+		scinsert(&memtab, k, desc);
+	pthread_mutex_unlock(&sclock);
+}
+
+void
+strcache_close(void)
+{
+	struct sctab nt;
+	struct schdr h;
+	char *tmp;
+	size_t n;
+	u_int32_t i;
+	int fd, ok;
+
+	if (cachefile == NULL)
+		return;
+	if (memtab.st_nused != 0) {
+		memset(&nt, 0, sizeof nt);
+		for (i = 0; i < disktab.st_nslots; i++)
+			if (disktab.st_recs[i].sr_desc[0] != 0)
+				scinsert(&nt, &disktab.st_recs[i].sr_key,
+				    disktab.st_recs[i].sr_desc);
+		for (i = 0; i < memtab.st_nslots; i++)
+			if (memtab.st_recs[i].sr_desc[0] != 0)
+				scinsert(&nt, &memtab.st_recs[i].sr_key,
+				    memtab.st_recs[i].sr_desc);
+		memset(&h, 0, sizeof h);
+		memcpy(h.sh_magic, SC_MAGIC, sizeof h.sh_magic);
+		h.sh_version = SC_VERSION;
+		h.sh_nslots = nt.st_nslots;
+		h.sh_nused = nt.st_nused;
+		if (asprintf(&tmp, "%s.XXXXXX", cachefile) < 0)
+			err(1, "asprintf");
+		n = nt.st_nslots * sizeof *nt.st_recs;
+		fd = mkstemp(tmp);
+		if (fd < 0)
+			warn("%s", tmp);
+		else {
+			ok = write(fd, &h, sizeof h) == sizeof h &&
+			    write(fd, nt.st_recs, n) == (ssize_t)n;
+			if (close(fd) < 0 || !ok || rename(tmp, cachefile) < 0) {
+				warn("%s", cachefile);
+				unlink(tmp);
+			}
+		}
+		free(tmp);
+		free(nt.st_recs);
+	}
+	if (diskmap)
+		munmap(diskmap, disksize);
+	free(memtab.st_recs);
+	free(cachefile);
+	cachefile = NULL;
+}
@@ -0,0 +1,1946 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <dirent.h>
+#include <poll.h>
+#include <dev/usb/usb.h>
+#include <dev/usb/usbhid.h>
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/usbdevice_fs.h>
+#endif
+
+#include "usbbus.h"
+#include "usbtrace.h"
+
+int
+usbbus_request(struct usbbus *ub, struct usb_ctl_request *req)
+{
+	usb_device_request_t *dr = &req->ucr_request;
+	struct trspan sp;
+	int r, e;
+
+	if (ub->ub_trace == NULL)
+		return ub->ub_ops->uo_request(ub, req);
+	memset(&sp, 0, sizeof sp);
+	sp.ts_start = trace_now(ub->ub_trace);
+	r = ub->ub_ops->uo_request(ub, req);
+	e = errno;
+	sp.ts_op = TR_REQUEST;
+	sp.ts_addr = req->ucr_addr;
+	sp.ts_type = dr->bmRequestType;
+	sp.ts_request = dr->bRequest;
+	sp.ts_value = UGETW(dr->wValue);
+	sp.ts_index = UGETW(dr->wIndex);
+	sp.ts_length = UGETW(dr->wLength);
+	sp.ts_actlen = r < 0 ? 0 : req->ucr_actlen;
+	sp.ts_error = r < 0 ? e : 0;
+	trace_add(ub->ub_trace, &sp);
+	errno = e;
+	return r;
+}
+
+int
+usbbus_devinfo(struct usbbus *ub, struct usb_device_info *di)
+{
+	struct trspan sp;
+	int r, e;
+
+	if (ub->ub_trace == NULL)
+		return ub->ub_ops->uo_devinfo(ub, di);
+	memset(&sp, 0, sizeof sp);
+	sp.ts_addr = di->udi_addr;
+	sp.ts_start = trace_now(ub->ub_trace);
+	r = ub->ub_ops->uo_devinfo(ub, di);
+	e = errno;
+	sp.ts_op = TR_DEVINFO;
+	sp.ts_error = r < 0 ? e : 0;
+	trace_add(ub->ub_trace, &sp);
+	errno = e;
+	return r;
+}
+
+int
+usbbus_ioctl(struct usbbus *ub, u_long cmd, void *arg)
+{
+	struct trspan sp;
+	int r, e;
+
+	if (ub->ub_trace == NULL)
+		return ub->ub_ops->uo_ioctl(ub, cmd, arg);
+	memset(&sp, 0, sizeof sp);
+	sp.ts_start = trace_now(ub->ub_trace);
+	r = ub->ub_ops->uo_ioctl(ub, cmd, arg);
+	e = errno;
+	sp.ts_op = TR_IOCTL;
+	sp.ts_cmd = cmd;
+	sp.ts_error = r < 0 ? e : 0;
+	trace_add(ub->ub_trace, &sp);
+	errno = e;
+	return r;
+}
+
+/* For backends without an event source: sleep, and say nothing came. */
+static int
+evsleep(int timeout)
+{
+	struct timespec ts;
+
+	ts.tv_sec = timeout / 1000;
+	ts.tv_nsec = timeout % 1000 * 1000000;
+	return nanosleep(&ts, NULL);
+}
+
+int
+usbbus_event(struct usbbus *ub, struct usb_event *ue, int timeout)
+{
+	if (ub->ub_ops->uo_event == NULL)
+		return evsleep(timeout);
+	return ub->ub_ops->uo_event(ub, ue, timeout);
+}
+
+void
+usbbus_close(struct usbbus *ub)
+{
+	if (ub == NULL)
+		return;
+	if (ub->ub_evfd >= 0)
+		close(ub->ub_evfd);
+	ub->ub_ops->uo_close(ub);
+	free(ub);
+}
+
+/*
+ * ugen(4) ioctls in terms of control requests, for the backends that
+ * have no kernel doing them.
+ */
+static int
+ctlreq(struct usbbus *ub, int type, int request, int value, int index,
+       void *data, int len, int *actlen)
+{
+	struct usb_ctl_request req;
+
+	memset(&req, 0, sizeof req);
+	req.ucr_addr = ub->ub_addr;
+	req.ucr_request.bmRequestType = type;
+	req.ucr_request.bRequest = request;
+	USETW(req.ucr_request.wValue, value);
+	USETW(req.ucr_request.wIndex, index);
+	USETW(req.ucr_request.wLength, len);
+	req.ucr_data = data;
+	req.ucr_flags = USBD_SHORT_XFER_OK;
+	if (ub->ub_ops->uo_request(ub, &req) < 0)
+		return -1;
+	if (actlen)
+		*actlen = req.ucr_actlen;
+	return 0;
+}
+
+/* Configuration index for a ugen config index, which may be "current". */
+static int
+cfgindex(struct usbbus *ub, int ci)
+{
+	usb_device_descriptor_t dd;
+	usb_config_descriptor_t cd;
+	u_int8_t cur;
+	int i;
+
+	if (ci != USB_CURRENT_CONFIG_INDEX)
+		return ci;
+	if (ctlreq(ub, UT_READ_DEVICE, UR_GET_CONFIG, 0, 0, &cur, 1,
+	    NULL) < 0 ||
+	    ctlreq(ub, UT_READ_DEVICE, UR_GET_DESCRIPTOR, UDESC_DEVICE << 8,
+	    0, &dd, sizeof dd, NULL) < 0)
+		return -1;
+	for (i = 0; i < dd.bNumConfigurations; i++) {
+		if (ctlreq(ub, UT_READ_DEVICE, UR_GET_DESCRIPTOR,
+		    UDESC_CONFIG << 8 | i, 0, &cd, sizeof cd, NULL) < 0)
+			return -1;
+		if (cd.bConfigurationValue == cur)
+			return i;
+	}
+	errno = ENXIO;		/* unconfigured */
+	return -1;
+}
+
+static int
+ugen_ioctl(struct usbbus *ub, u_long cmd, void *arg)
+{
+	struct usb_alt_interface *ai = arg;
+	struct usb_config_desc *ucd = arg;
+	struct usb_full_desc *ufd = arg;
+	struct usb_ctl_request *req = arg;
+	struct usb_device_info *di = arg;
+	u_int8_t b;
+	int n;
+
+	switch (cmd) {
+	case USB_DISCOVER:
+	case USB_SETDEBUG:
+		return 0;
+	case USB_GET_DEVICE_DESC:
+		return ctlreq(ub, UT_READ_DEVICE, UR_GET_DESCRIPTOR,
+		    UDESC_DEVICE << 8, 0, arg, USB_DEVICE_DESCRIPTOR_SIZE, NULL);
+	case USB_GET_CONFIG:
+		if (ctlreq(ub, UT_READ_DEVICE, UR_GET_CONFIG, 0, 0, &b, 1,
+		    NULL) < 0)
+			return -1;
+		*(int *)arg = b;
+		return 0;
+	case USB_SET_CONFIG:
+		return ctlreq(ub, UT_WRITE_DEVICE, UR_SET_CONFIG, *(int *)arg,
+		    0, NULL, 0, NULL);
+	case USB_GET_CONFIG_DESC:
+		if ((n = cfgindex(ub, ucd->ucd_config_index)) < 0)
+			return -1;
+		return ctlreq(ub, UT_READ_DEVICE, UR_GET_DESCRIPTOR,
+		    UDESC_CONFIG << 8 | n, 0, &ucd->ucd_desc,
+		    USB_CONFIG_DESCRIPTOR_SIZE, NULL);
+	case USB_GET_FULL_DESC:
+		if ((n = cfgindex(ub, ufd->ufd_config_index)) < 0)
+			return -1;
+		return ctlreq(ub, UT_READ_DEVICE, UR_GET_DESCRIPTOR,
+		    UDESC_CONFIG << 8 | n, 0, ufd->ufd_data,
+		    ufd->ufd_size > 0xffff ? 0xffff : ufd->ufd_size, NULL);
+	case USB_GET_ALTINTERFACE:
+		if (ctlreq(ub, UT_READ_INTERFACE, UR_GET_INTERFACE, 0,
+		    ai->uai_interface_index, &b, 1, NULL) < 0)
+			return -1;
+		ai->uai_alt_no = b;
+		return 0;
+	case USB_SET_ALTINTERFACE:
+		return ctlreq(ub, UT_WRITE_INTERFACE, UR_SET_INTERFACE,
+		    ai->uai_alt_no, ai->uai_interface_index, NULL, 0, NULL);
+	case USB_DO_REQUEST:
+		req->ucr_addr = ub->ub_addr;
+		return ub->ub_ops->uo_request(ub, req);
+	case USB_GET_DEVICEINFO:
+		di->udi_addr = ub->ub_addr;
+		return ub->ub_ops->uo_devinfo(ub, di);
+	}
+	errno = ENOTTY;
+	return -1;
+}
+
+/*
+ * NetBSD: straight ioctls on the controller or ugen node.  A ugen node
+ * takes USB_DO_REQUEST and USB_GET_DEVICEINFO instead of the
+ * controller's requests.
+ */
+static int
+nb_request(struct usbbus *ub, struct usb_ctl_request *req)
+{
+	int r;
+
+	r = ioctl(ub->ub_fd, USB_REQUEST, req);
+	if (r < 0 && errno == ENOTTY)
+		r = ioctl(ub->ub_fd, USB_DO_REQUEST, req);
+	return r;
+}
+
+static int
+nb_devinfo(struct usbbus *ub, struct usb_device_info *di)
+{
+	int r;
+
+	r = ioctl(ub->ub_fd, USB_DEVICEINFO, di);
+	if (r < 0 && errno == ENOTTY)
+		r = ioctl(ub->ub_fd, USB_GET_DEVICEINFO, di);
+	return r;
+}
+
+static int
+nb_ioctl(struct usbbus *ub, u_long cmd, void *arg)
+{
+	return ioctl(ub->ub_fd, cmd, arg);
+}
+
+/*
+ * Events come from /dev/usb, which only one process may have open;
+ * if usbd(8) has it we sleep instead.
+ */
+#define NBEVENTS	"/dev/usb"
+
+static int
+nb_event(struct usbbus *ub, struct usb_event *ue, int timeout)
+{
+	struct pollfd pfd;
+	int r;
+
+	if (ub->ub_evfd == -1 &&
+	    (ub->ub_evfd = open(NBEVENTS, O_RDONLY)) < 0)
+		ub->ub_evfd = -2;
+	if (ub->ub_evfd < 0)
+		return evsleep(timeout);
+	pfd.fd = ub->ub_evfd;
+	pfd.events = POLLIN;
+	if ((r = poll(&pfd, 1, timeout)) <= 0)
+		return r;
+	if ((r = read(ub->ub_evfd, ue, sizeof *ue)) != sizeof *ue) {
+		if (r >= 0)
+			errno = EIO;
+		return -1;
+	}
+	return 1;
+}
+
+static void
+nb_close(struct usbbus *ub)
+{
+	close(ub->ub_fd);
+}
+
+static const struct usbbus_ops nb_ops = {
+	nb_request, nb_devinfo, nb_ioctl, nb_close, NULL, NULL, NULL,
+	nb_event
+};
+
+#ifdef __linux__
+/*
+ * Linux usbfs.  A bus directory has a node per device address, opened
+ * the first time the address is used.  Reading a node gives the
+ * device and configuration descriptors the kernel has cached.
+ *
+ * Before going to usbfs at all, requests are answered from sysfs
+ * where the kernel keeps the same descriptors and more, so that a
+ * dump neither sends control transfers nor wakes suspended devices:
+ * the device and configuration descriptors, the current
+ * configuration, the manufacturer, product and serial strings, and
+ * HID report descriptors.  Whatever sysfs does not have goes to the
+ * device.  The device list is read when the bus is opened, and again
+ * by usbbus_event when a device comes or goes.
+ *
+ * For usbq, requests that do go to a device are submitted as URBs
+ * and reaped from whichever device completes one first.
+ */
+#define LXTIMEOUT	5000		/* ms */
+#define LXSYSFS		"/sys/bus/usb/devices"
+
+struct lxsys {
+	char		ls_name[64];	/* e.g. usb1, 1-1.2 */
+	int		ls_parent;	/* address of the hub above, or 0 */
+	int		ls_port;
+	u_char		*ls_desc;	/* the descriptors file, once read */
+	int		ls_desclen;
+	int		ls_lang;	/* first LANGID, 0 unread, -1 none */
+};
+
+struct lxbus {
+	pthread_mutex_t	lx_lock;
+	char		lx_dir[1024];	/* usbfs, empty for sysfs only */
+	char		lx_sys[1024];	/* sysfs devices, empty if none */
+	int		lx_bus;
+	int		lx_fd[USB_MAX_DEVICES];
+	struct lxsys	*lx_dev[USB_MAX_DEVICES];
+	int		lx_nurb[USB_MAX_DEVICES];	/* submitted URBs */
+	struct lxurb	*lx_urbs;	/* submitted, not reaped */
+};
+
+/* A control URB; the buffer is the setup packet and then the data. */
+struct lxurb {
+	struct usbdevfs_urb lu_urb;
+	struct usb_ctl_request *lu_req;
+	void		*lu_cookie;
+	int		lu_addr;
+	int		lu_fd;
+	struct timespec	lu_end;		/* discarded if not done by then */
+	int		lu_why;		/* errno once discarded, else 0 */
+	struct lxurb	*lu_next, **lu_prev;
+	u_char		lu_buf[];
+};
+
+/* Milliseconds from now until end, at least 0. */
+static int
+lx_msto(const struct timespec *end, const struct timespec *now)
+{
+	long ms;
+
+	ms = (end->tv_sec - now->tv_sec) * 1000 +
+	    (end->tv_nsec - now->tv_nsec) / 1000000;
+	return ms < 0 ? 0 : ms;
+}
+
+static int
+lx_fd(struct usbbus *ub, int addr)
+{
+	struct lxbus *lx = ub->ub_priv;
+	char name[1100];
+	int fd;
+
+	if (ub->ub_fd >= 0)
+		return ub->ub_fd;
+	if (lx->lx_dir[0] == 0) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (addr <= 0 || addr >= USB_MAX_DEVICES) {
+		errno = ENXIO;
+		return -1;
+	}
+	pthread_mutex_lock(&lx->lx_lock);
+	if ((fd = lx->lx_fd[addr]) < 0) {
+		snprintf(name, sizeof name, "%s/%03d", lx->lx_dir, addr);
+		fd = open(name, O_RDWR);
+		if (fd < 0 && errno == EACCES)
+			fd = open(name, O_RDONLY);
+		lx->lx_fd[addr] = fd;
+	}
+	pthread_mutex_unlock(&lx->lx_lock);
+	return fd;
+}
+
+/* Read a whole sysfs file into a malloc'ed buffer. */
+static u_char *
+lx_slurp(const char *path, int *lenp)
+{
+	u_char *b = NULL, *nb;
+	int fd, n, len = 0, size = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	for (;;) {
+		if (len == size) {
+			size = size ? size * 2 : 4096;
+			if ((nb = realloc(b, size)) == NULL)
+				break;
+			b = nb;
+		}
+		if ((n = read(fd, b + len, size - len)) <= 0)
+			break;
+		len += n;
+	}
+	close(fd);
+	if (n < 0 || len == 0) {
+		free(b);
+		return NULL;
+	}
+	*lenp = len;
+	return b;
+}
+
+/* Read a text attribute, less its newline.  Returns its length or -1. */
+static int
+lx_attr(struct lxbus *lx, const char *dev, const char *attr, char *buf,
+	int size)
+{
+	char path[1200];
+	int fd, n;
+
+	snprintf(path, sizeof path, "%s/%s/%s", lx->lx_sys, dev, attr);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n < 0)
+		return -1;
+	while (n > 0 && buf[n - 1] == '\n')
+		n--;
+	buf[n] = 0;
+	return n;
+}
+
+static int
+lx_attrnum(struct lxbus *lx, const char *dev, const char *attr, int base)
+{
+	char buf[32];
+
+	if (lx_attr(lx, dev, attr, buf, sizeof buf) <= 0)
+		return -1;
+	return strtol(buf, NULL, base);
+}
+
+/*
+ * Find the devices on our bus.  Device directories are named usbB for
+ * root hubs and B-P[.P...] below them; names with a colon are
+ * interfaces.  Returns -1 if there is no usable sysfs.
+ */
+static int
+lx_sysscan(struct lxbus *lx)
+{
+	struct lxsys *ls;
+	struct dirent *de;
+	DIR *d;
+	char pname[64], *p;
+	int a, i;
+
+	if ((d = opendir(lx->lx_sys)) == NULL)
+		return -1;
+	while ((de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.' || strchr(de->d_name, ':') ||
+		    strlen(de->d_name) >= sizeof ls->ls_name ||
+		    lx_attrnum(lx, de->d_name, "busnum", 10) != lx->lx_bus)
+			continue;
+		a = lx_attrnum(lx, de->d_name, "devnum", 10);
+		if (a <= 0 || a >= USB_MAX_DEVICES || lx->lx_dev[a] ||
+		    (ls = calloc(1, sizeof *ls)) == NULL)
+			continue;
+		strcpy(ls->ls_name, de->d_name);
+		lx->lx_dev[a] = ls;
+	}
+	closedir(d);
+	for (a = 1; a < USB_MAX_DEVICES; a++) {
+		if ((ls = lx->lx_dev[a]) == NULL ||
+		    strncmp(ls->ls_name, "usb", 3) == 0)
+			continue;
+		snprintf(pname, sizeof pname, "%s", ls->ls_name);
+		if ((p = strrchr(pname, '.')) == NULL) {
+			p = strrchr(pname, '-');
+			ls->ls_port = p ? atoi(p + 1) : 0;
+			snprintf(pname, sizeof pname, "usb%d", lx->lx_bus);
+		} else {
+			*p = 0;
+			ls->ls_port = atoi(p + 1);
+		}
+		for (i = 1; i < USB_MAX_DEVICES; i++)
+			if (lx->lx_dev[i] &&
+			    strcmp(lx->lx_dev[i]->ls_name, pname) == 0)
+				ls->ls_parent = i;
+	}
+	return 0;
+}
+
+/* Read the device list again, after devices have come or gone. */
+static void
+lx_sysrescan(struct lxbus *lx)
+{
+	int a;
+
+	pthread_mutex_lock(&lx->lx_lock);
+	for (a = 0; a < USB_MAX_DEVICES; a++)
+		if (lx->lx_dev[a]) {
+			free(lx->lx_dev[a]->ls_desc);
+			free(lx->lx_dev[a]);
+			lx->lx_dev[a] = NULL;
+		}
+	lx_sysscan(lx);
+	pthread_mutex_unlock(&lx->lx_lock);
+}
+
+/* The cached descriptors of a device, read on first use. */
+static const u_char *
+lx_sysdesc(struct lxbus *lx, struct lxsys *ls, int *lenp)
+{
+	char path[1200];
+
+	pthread_mutex_lock(&lx->lx_lock);
+	if (ls->ls_desc == NULL) {
+		snprintf(path, sizeof path, "%s/%s/descriptors", lx->lx_sys,
+			 ls->ls_name);
+		ls->ls_desc = lx_slurp(path, &ls->ls_desclen);
+	}
+	pthread_mutex_unlock(&lx->lx_lock);
+	if (ls->ls_desc == NULL ||
+	    ls->ls_desclen < USB_DEVICE_DESCRIPTOR_SIZE)
+		return NULL;
+	*lenp = ls->ls_desclen;
+	return ls->ls_desc;
+}
+
+/*
+ * The device's first LANGID, which is the language the kernel read
+ * its strings in.  Only asked of the device, once, when a caller
+ * wants a language by number.
+ */
+static int
+lx_syslang(struct usbbus *ub, struct lxsys *ls, int addr)
+{
+	struct lxbus *lx = ub->ub_priv;
+	struct usbdevfs_ctrltransfer ct;
+	u_char buf[4];
+	int fd, lang;
+
+	pthread_mutex_lock(&lx->lx_lock);
+	lang = ls->ls_lang;
+	pthread_mutex_unlock(&lx->lx_lock);
+	if (lang != 0)
+		return lang;
+	lang = -1;
+	if ((fd = lx_fd(ub, addr)) >= 0) {
+		ct.bRequestType = UT_READ_DEVICE;
+		ct.bRequest = UR_GET_DESCRIPTOR;
+		ct.wValue = UDESC_STRING << 8;
+		ct.wIndex = 0;
+		ct.wLength = sizeof buf;
+		ct.timeout = ub->ub_timeout ? ub->ub_timeout : LXTIMEOUT;
+		ct.data = buf;
+		if (ioctl(fd, USBDEVFS_CONTROL, &ct) >= 4 && buf[0] >= 4)
+			lang = UGETW(buf + 2);
+	}
+	pthread_mutex_lock(&lx->lx_lock);
+	ls->ls_lang = lang;
+	pthread_mutex_unlock(&lx->lx_lock);
+	return lang;
+}
+
+/* String attr as a string descriptor; sysfs has it in UTF-8. */
+static int
+lx_sysstring(struct lxbus *lx, struct lxsys *ls, const char *attr,
+	     u_char *d)
+{
+	char buf[USB_MAX_STRING_LEN * 4];
+	const u_char *s;
+	u_int c;
+	int n = 2, k;
+
+	if (lx_attr(lx, ls->ls_name, attr, buf, sizeof buf) < 0)
+		return -1;
+	for (s = (u_char *)buf; *s && n + 4 <= 255; ) {
+		c = *s++;
+		k = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc0 ? 1 : 0;
+		c &= k ? 0x3f >> k : 0x7f;
+		for (; k > 0 && (*s & 0xc0) == 0x80; k--)
+			c = c << 6 | (*s++ & 0x3f);
+		if (c >= 0x10000) {
+			c -= 0x10000;
+			USETW(d + n, 0xd800 | c >> 10);
+			n += 2;
+			c = 0xdc00 | (c & 0x3ff);
+		}
+		USETW(d + n, c);
+		n += 2;
+	}
+	d[0] = n;
+	d[1] = UDESC_STRING;
+	return n;
+}
+
+/* The HID report descriptor of interface ifc in configuration cfg. */
+static u_char *
+lx_sysreport(struct lxbus *lx, struct lxsys *ls, int cfg, int ifc,
+	     int *lenp)
+{
+	char path[1200], sub[1500];
+	struct dirent *de;
+	u_char *b = NULL;
+	DIR *d;
+
+	snprintf(path, sizeof path, "%s/%s:%d.%d", lx->lx_sys, ls->ls_name,
+		 cfg, ifc);
+	if ((d = opendir(path)) == NULL)
+		return NULL;
+	/* The hid device below it is named BBBB:VVVV:PPPP.NNNN. */
+	while (b == NULL && (de = readdir(d)) != NULL) {
+		if (de->d_name[0] == '.' || strchr(de->d_name, ':') == NULL)
+			continue;
+		snprintf(sub, sizeof sub, "%s/%s/report_descriptor", path,
+			 de->d_name);
+		b = lx_slurp(sub, lenp);
+	}
+	closedir(d);
+	return b;
+}
+
+/*
+ * Answer a request from sysfs.  Returns the number of bytes put in
+ * the request's buffer, or -1 if the device has to be asked.
+ */
+static int
+lx_sysreq(struct usbbus *ub, struct usb_ctl_request *req)
+{
+	struct lxbus *lx = ub->ub_priv;
+	usb_device_request_t *dr = &req->ucr_request;
+	usb_device_descriptor_t *dd;
+	struct lxsys *ls;
+	const u_char *desc, *data = NULL;
+	u_char buf[256], *rd = NULL;
+	int value, index, len, n = 0, i, off, dlen, si;
+
+	if (req->ucr_addr <= 0 || req->ucr_addr >= USB_MAX_DEVICES ||
+	    (ls = lx->lx_dev[req->ucr_addr]) == NULL ||
+	    (desc = lx_sysdesc(lx, ls, &dlen)) == NULL)
+		return -1;
+	dd = (usb_device_descriptor_t *)desc;
+	value = UGETW(dr->wValue);
+	index = UGETW(dr->wIndex);
+	len = UGETW(dr->wLength);
+	switch (dr->bmRequestType << 8 | dr->bRequest) {
+	case UT_READ_DEVICE << 8 | UR_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case UDESC_DEVICE:
+			data = desc;
+			n = USB_DEVICE_DESCRIPTOR_SIZE;
+			break;
+		case UDESC_CONFIG:
+			off = USB_DEVICE_DESCRIPTOR_SIZE;
+			for (i = 0; i < (value & 0xff) &&
+			    off + USB_CONFIG_DESCRIPTOR_SIZE <= dlen; i++)
+				off += UGETW(desc + off + 2);
+			if (off + USB_CONFIG_DESCRIPTOR_SIZE > dlen)
+				return -1;
+			data = desc + off;
+			n = UGETW(data + 2);
+			if (n > dlen - off)
+				n = dlen - off;
+			break;
+		case UDESC_STRING:
+			/*
+			 * The kernel's strings are in the first language;
+			 * wIndex 0 is taken to mean that one too.
+			 */
+			si = value & 0xff;
+			if (si == 0 || (index != 0 &&
+			    index != lx_syslang(ub, ls, req->ucr_addr)))
+				return -1;
+			if (si == dd->iManufacturer)
+				n = lx_sysstring(lx, ls, "manufacturer", buf);
+			else if (si == dd->iProduct)
+				n = lx_sysstring(lx, ls, "product", buf);
+			else if (si == dd->iSerialNumber)
+				n = lx_sysstring(lx, ls, "serial", buf);
+			else
+				return -1;
+			if (n < 0)
+				return -1;
+			data = buf;
+			break;
+		default:
+			return -1;
+		}
+		break;
+	case UT_READ_DEVICE << 8 | UR_GET_CONFIG:
+		if ((i = lx_attrnum(lx, ls->ls_name, "bConfigurationValue",
+		    10)) < 0)
+			i = 0;
+		buf[0] = i;
+		data = buf;
+		n = 1;
+		break;
+	case UT_READ_INTERFACE << 8 | UR_GET_DESCRIPTOR:
+		if (value != UDESC_REPORT << 8 ||
+		    (i = lx_attrnum(lx, ls->ls_name, "bConfigurationValue",
+		    10)) <= 0 ||
+		    (rd = lx_sysreport(lx, ls, i, index, &n)) == NULL)
+			return -1;
+		data = rd;
+		break;
+	default:
+		return -1;
+	}
+	if (n > len)
+		n = len;
+	memcpy(req->ucr_data, data, n);
+	free(rd);
+	return n;
+}
+
+/* Set the actual length, failing a short transfer if not allowed. */
+static int
+lx_actlen(struct usb_ctl_request *req, int n)
+{
+	req->ucr_actlen = n;
+	if (n < UGETW(req->ucr_request.wLength) &&
+	    !(req->ucr_flags & USBD_SHORT_XFER_OK)) {
+		errno = EIO;
+		return -1;
+	}
+	return 0;
+}
+
+static int
+lx_request(struct usbbus *ub, struct usb_ctl_request *req)
+{
+	usb_device_request_t *dr = &req->ucr_request;
+	struct usbdevfs_ctrltransfer ct;
+	struct usbdevfs_setinterface si;
+	unsigned int v;
+	int fd, n;
+
+	req->ucr_actlen = 0;
+	if ((n = lx_sysreq(ub, req)) >= 0)
+		return lx_actlen(req, n);
+	if ((fd = lx_fd(ub, req->ucr_addr)) < 0)
+		return -1;
+	/* The kernel must know about configuration changes. */
+	if (dr->bmRequestType == UT_WRITE_DEVICE &&
+	    dr->bRequest == UR_SET_CONFIG) {
+		v = UGETW(dr->wValue);
+		return ioctl(fd, USBDEVFS_SETCONFIGURATION, &v);
+	}
+	if (dr->bmRequestType == UT_WRITE_INTERFACE &&
+	    dr->bRequest == UR_SET_INTERFACE) {
+		si.interface = UGETW(dr->wIndex);
+		si.altsetting = UGETW(dr->wValue);
+		return ioctl(fd, USBDEVFS_SETINTERFACE, &si);
+	}
+	ct.bRequestType = dr->bmRequestType;
+	ct.bRequest = dr->bRequest;
+	ct.wValue = UGETW(dr->wValue);
+	ct.wIndex = UGETW(dr->wIndex);
+	ct.wLength = UGETW(dr->wLength);
+	ct.timeout = ub->ub_timeout ? ub->ub_timeout : LXTIMEOUT;
+	ct.data = req->ucr_data;
+	n = ioctl(fd, USBDEVFS_CONTROL, &ct);
+	if (n < 0)
+		return -1;
+	return lx_actlen(req, n);
+}
+
+static int
+lx_submit(struct usbbus *ub, struct usb_ctl_request *req, void *cookie)
+{
+	struct lxbus *lx = ub->ub_priv;
+	usb_device_request_t *dr = &req->ucr_request;
+	struct lxurb *lu;
+	int fd, n, len, t;
+
+	req->ucr_actlen = 0;
+	if ((n = lx_sysreq(ub, req)) >= 0)
+		return lx_actlen(req, n) < 0 ? -1 : 1;
+	if ((dr->bmRequestType == UT_WRITE_DEVICE &&
+	    dr->bRequest == UR_SET_CONFIG) ||
+	    (dr->bmRequestType == UT_WRITE_INTERFACE &&
+	    dr->bRequest == UR_SET_INTERFACE))
+		return lx_request(ub, req) < 0 ? -1 : 1;
+	if ((fd = lx_fd(ub, req->ucr_addr)) < 0)
+		return -1;
+	len = UGETW(dr->wLength);
+	if ((lu = calloc(1, sizeof *lu + sizeof *dr + len)) == NULL)
+		return -1;
+	memcpy(lu->lu_buf, dr, sizeof *dr);
+	if (!(dr->bmRequestType & UT_READ) && len > 0)
+		memcpy(lu->lu_buf + sizeof *dr, req->ucr_data, len);
+	lu->lu_req = req;
+	lu->lu_cookie = cookie;
+	lu->lu_addr = req->ucr_addr;
+	lu->lu_fd = fd;
+	t = ub->ub_timeout ? ub->ub_timeout : LXTIMEOUT;
+	clock_gettime(CLOCK_MONOTONIC, &lu->lu_end);
+	lu->lu_end.tv_sec += t / 1000;
+	lu->lu_end.tv_nsec += t % 1000 * 1000000;
+	lu->lu_urb.type = USBDEVFS_URB_TYPE_CONTROL;
+	lu->lu_urb.endpoint = 0;
+	lu->lu_urb.buffer = lu->lu_buf;
+	lu->lu_urb.buffer_length = sizeof *dr + len;
+	lu->lu_urb.usercontext = lu;
+	pthread_mutex_lock(&lx->lx_lock);
+	if (ioctl(fd, USBDEVFS_SUBMITURB, &lu->lu_urb) < 0) {
+		pthread_mutex_unlock(&lx->lx_lock);
+		free(lu);
+		return -1;
+	}
+	lx->lx_nurb[lu->lu_addr]++;
+	if ((lu->lu_next = lx->lx_urbs) != NULL)
+		lu->lu_next->lu_prev = &lu->lu_next;
+	lu->lu_prev = &lx->lx_urbs;
+	lx->lx_urbs = lu;
+	pthread_mutex_unlock(&lx->lx_lock);
+	return 0;
+}
+
+/*
+ * Reap a URB from any device that has some outstanding, polling up to
+ * timeout ms, or for ever if it is negative, for one to complete.  A
+ * URB still going after the request timeout is discarded, and reaped
+ * as failed with ETIMEDOUT.
+ */
+static void *
+lx_reap(struct usbbus *ub, int timeout, int *error)
+{
+	struct lxbus *lx = ub->ub_priv;
+	struct pollfd pfd[USB_MAX_DEVICES];
+	struct usbdevfs_urb *urb;
+	struct usb_ctl_request *req;
+	struct timespec end, now;
+	struct lxurb *lu;
+	void *cookie;
+	int a, i, n, ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (timeout > 0) {
+		end.tv_sec += timeout / 1000;
+		end.tv_nsec += timeout % 1000 * 1000000;
+	}
+	for (;;) {
+		n = 0;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = timeout < 0 ? -1 : lx_msto(&end, &now);
+		pthread_mutex_lock(&lx->lx_lock);
+		for (a = 0; a < USB_MAX_DEVICES; a++)
+			if (lx->lx_nurb[a] > 0) {
+				pfd[n].fd = ub->ub_fd >= 0 ? ub->ub_fd :
+				    lx->lx_fd[a];
+				pfd[n++].events = POLLOUT;
+			}
+		/* Poll no longer than until the next URB runs out. */
+		for (lu = lx->lx_urbs; lu != NULL; lu = lu->lu_next) {
+			if (lu->lu_why)
+				continue;
+			if ((i = lx_msto(&lu->lu_end, &now)) == 0) {
+				lu->lu_why = ETIMEDOUT;
+				ioctl(lu->lu_fd, USBDEVFS_DISCARDURB,
+				    &lu->lu_urb);
+			} else if (ms < 0 || i < ms)
+				ms = i;
+		}
+		pthread_mutex_unlock(&lx->lx_lock);
+		if (n == 0) {
+			errno = ECHILD;		/* nothing outstanding */
+			return NULL;
+		}
+		for (i = 0; i < n; i++)
+			if (ioctl(pfd[i].fd, USBDEVFS_REAPURBNDELAY, &urb) == 0)
+				break;
+		if (i < n)
+			break;
+		if (timeout >= 0 && lx_msto(&end, &now) == 0) {
+			errno = ETIMEDOUT;
+			return NULL;
+		}
+		if (poll(pfd, n, ms) < 0 && errno != EINTR)
+			return NULL;
+	}
+	lu = urb->usercontext;
+	req = lu->lu_req;
+	pthread_mutex_lock(&lx->lx_lock);
+	lx->lx_nurb[lu->lu_addr]--;
+	if ((*lu->lu_prev = lu->lu_next) != NULL)
+		lu->lu_next->lu_prev = lu->lu_prev;
+	pthread_mutex_unlock(&lx->lx_lock);
+	*error = 0;
+	if (urb->status < 0)
+		*error = lu->lu_why ? lu->lu_why : -urb->status;
+	else {
+		if (req->ucr_request.bmRequestType & UT_READ)
+			memcpy(req->ucr_data, lu->lu_buf + sizeof req->ucr_request,
+			       urb->actual_length);
+		if (lx_actlen(req, urb->actual_length) < 0)
+			*error = errno;
+	}
+	cookie = lu->lu_cookie;
+	free(lu);
+	return cookie;
+}
+
+/* Discard every URB on the bus; they are reaped with ECANCELED. */
+static void
+lx_cancel(struct usbbus *ub)
+{
+	struct lxbus *lx = ub->ub_priv;
+	struct lxurb *lu;
+
+	pthread_mutex_lock(&lx->lx_lock);
+	for (lu = lx->lx_urbs; lu != NULL; lu = lu->lu_next)
+		if (!lu->lu_why) {
+			lu->lu_why = ECANCELED;
+			ioctl(lu->lu_fd, USBDEVFS_DISCARDURB, &lu->lu_urb);
+		}
+	pthread_mutex_unlock(&lx->lx_lock);
+}
+
+/* Fill in di from the sysfs attributes of a device. */
+static int
+lx_sysinfo(struct lxbus *lx, struct lxsys *ls, struct usb_device_info *di)
+{
+	const char *dev = ls->ls_name;
+	char buf[32];
+	int i, a;
+
+	di->udi_vendorNo = lx_attrnum(lx, dev, "idVendor", 16);
+	di->udi_productNo = lx_attrnum(lx, dev, "idProduct", 16);
+	di->udi_releaseNo = lx_attrnum(lx, dev, "bcdDevice", 16);
+	snprintf(di->udi_release, sizeof di->udi_release, "%x.%02x",
+		 di->udi_releaseNo >> 8, di->udi_releaseNo & 0xff);
+	lx_attr(lx, dev, "manufacturer", di->udi_vendor,
+		sizeof di->udi_vendor);
+	lx_attr(lx, dev, "product", di->udi_product, sizeof di->udi_product);
+	lx_attr(lx, dev, "serial", di->udi_serial, sizeof di->udi_serial);
+	di->udi_class = lx_attrnum(lx, dev, "bDeviceClass", 16);
+	di->udi_subclass = lx_attrnum(lx, dev, "bDeviceSubClass", 16);
+	di->udi_protocol = lx_attrnum(lx, dev, "bDeviceProtocol", 16);
+	if ((i = lx_attrnum(lx, dev, "bConfigurationValue", 10)) > 0)
+		di->udi_config = i;
+	/* Mb/s: 1.5, 12, 480, 53.3-480 for wireless, 5000 and up */
+	buf[0] = 0;
+	lx_attr(lx, dev, "speed", buf, sizeof buf);
+	i = atoi(buf);
+	di->udi_speed = i >= 5000 ? USB_SPEED_SUPER : i >= 53 ?
+	    USB_SPEED_HIGH : i == 1 ? USB_SPEED_LOW : USB_SPEED_FULL;
+	if ((i = lx_attrnum(lx, dev, "bmAttributes", 16)) >= 0 &&
+	    !(i & UC_SELF_POWERED))
+		di->udi_power = lx_attrnum(lx, dev, "bMaxPower", 10);
+	if (di->udi_class == UDCLASS_HUB &&
+	    (i = lx_attrnum(lx, dev, "maxchild", 10)) > 0) {
+		di->udi_nports = i;
+		for (i = 0; i < di->udi_nports && i < 16; i++)
+			di->udi_ports[i] = USB_PORT_POWERED;
+		for (a = 1; a < USB_MAX_DEVICES; a++)
+			if (lx->lx_dev[a] &&
+			    lx->lx_dev[a]->ls_parent == di->udi_addr &&
+			    (i = lx->lx_dev[a]->ls_port) >= 1 && i <= 16)
+				di->udi_ports[i - 1] = a;
+	}
+	snprintf(di->udi_devnames[0], sizeof di->udi_devnames[0], "%.*s",
+		 (int)sizeof di->udi_devnames[0] - 1, dev);
+	return 0;
+}
+
+static int
+lx_devinfo(struct usbbus *ub, struct usb_device_info *di)
+{
+	struct lxbus *lx = ub->ub_priv;
+	usb_device_descriptor_t dd;
+	struct usbdevfs_hub_portinfo pi;
+	struct usbdevfs_ioctl ui;
+	int fd, addr, i, speed;
+
+	addr = di->udi_addr;
+	if (lx->lx_sys[0]) {
+		if (addr <= 0 || addr >= USB_MAX_DEVICES ||
+		    lx->lx_dev[addr] == NULL) {
+			errno = ENXIO;
+			return -1;
+		}
+		memset(di, 0, sizeof *di);
+		di->udi_bus = lx->lx_bus;
+		di->udi_addr = addr;
+		return lx_sysinfo(lx, lx->lx_dev[addr], di);
+	}
+	if ((fd = lx_fd(ub, addr)) < 0)
+		return -1;
+	if (pread(fd, &dd, sizeof dd, 0) != sizeof dd) {
+		errno = EIO;
+		return -1;
+	}
+	memset(di, 0, sizeof *di);
+	di->udi_bus = lx->lx_bus;
+	di->udi_addr = addr;
+	di->udi_vendorNo = UGETW(dd.idVendor);
+	di->udi_productNo = UGETW(dd.idProduct);
+	di->udi_releaseNo = UGETW(dd.bcdDevice);
+	snprintf(di->udi_release, sizeof di->udi_release, "%x.%02x",
+		 di->udi_releaseNo >> 8, di->udi_releaseNo & 0xff);
+	di->udi_class = dd.bDeviceClass;
+	di->udi_subclass = dd.bDeviceSubClass;
+	di->udi_protocol = dd.bDeviceProtocol;
+	speed = ioctl(fd, USBDEVFS_GET_SPEED);
+	/* Linux: 1 low, 2 full, 3 high, 4 wireless, 5 and up super */
+	di->udi_speed = speed >= 5 ? USB_SPEED_SUPER :
+	    speed == 4 ? USB_SPEED_HIGH : speed > 0 ? speed : USB_SPEED_FULL;
+	if (dd.bDeviceClass == UDCLASS_HUB) {
+		ui.ifno = 0;
+		ui.ioctl_code = USBDEVFS_HUB_PORTINFO;
+		ui.data = &pi;
+		if (ioctl(fd, USBDEVFS_IOCTL, &ui) >= 0) {
+			di->udi_nports = pi.nports;
+			for (i = 0; i < pi.nports && i < 16; i++)
+				di->udi_ports[i] = pi.port[i] ? pi.port[i] :
+				    USB_PORT_POWERED;
+		}
+	}
+	return 0;
+}
+
+/*
+ * A uevent is a header line and then KEY=value strings, all NUL
+ * terminated.  Returns 1 for a USB device coming or going on our bus.
+ */
+static int
+lx_uevent(struct lxbus *lx, struct usb_event *ue, const char *buf, int n)
+{
+	const char *p, *action = "", *subsys = "", *type = "";
+	int bus = -1, dev = -1;
+
+	for (p = buf; p < buf + n; p += strlen(p) + 1) {
+		if (strncmp(p, "ACTION=", 7) == 0)
+			action = p + 7;
+		else if (strncmp(p, "SUBSYSTEM=", 10) == 0)
+			subsys = p + 10;
+		else if (strncmp(p, "DEVTYPE=", 8) == 0)
+			type = p + 8;
+		else if (strncmp(p, "BUSNUM=", 7) == 0)
+			bus = atoi(p + 7);
+		else if (strncmp(p, "DEVNUM=", 7) == 0)
+			dev = atoi(p + 7);
+	}
+	if (strcmp(subsys, "usb") != 0 || strcmp(type, "usb_device") != 0 ||
+	    bus != lx->lx_bus || dev <= 0 || dev >= USB_MAX_DEVICES)
+		return 0;
+	memset(ue, 0, sizeof *ue);
+	if (strcmp(action, "add") == 0)
+		ue->ue_type = USB_EVENT_DEVICE_ATTACH;
+	else if (strcmp(action, "remove") == 0)
+		ue->ue_type = USB_EVENT_DEVICE_DETACH;
+	else
+		return 0;
+	clock_gettime(CLOCK_REALTIME, &ue->ue_time);
+	ue->u.ue_device.udi_bus = bus;
+	ue->u.ue_device.udi_addr = dev;
+	return 1;
+}
+
+/*
+ * Events are the kernel's uevents, from a netlink socket.  Without
+ * one the sysfs device list is simply read again after sleeping.
+ */
+static int
+lx_event(struct usbbus *ub, struct usb_event *ue, int timeout)
+{
+	struct lxbus *lx = ub->ub_priv;
+	struct sockaddr_nl sa;
+	struct pollfd pfd;
+	struct timespec now, end;
+	char buf[4096];
+	int fd, n, r = 0, addr;
+
+	if (ub->ub_evfd == -1) {
+		memset(&sa, 0, sizeof sa);
+		sa.nl_family = AF_NETLINK;
+		sa.nl_groups = 1;	/* kernel uevents */
+		fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+		    NETLINK_KOBJECT_UEVENT);
+		if (fd >= 0 && bind(fd, (struct sockaddr *)&sa, sizeof sa) < 0) {
+			close(fd);
+			fd = -1;
+		}
+		ub->ub_evfd = fd < 0 ? -2 : fd;
+	}
+	if (ub->ub_evfd < 0)
+		r = evsleep(timeout);
+	else {
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		end.tv_sec += timeout / 1000;
+		end.tv_nsec += timeout % 1000 * 1000000;
+		pfd.fd = ub->ub_evfd;
+		pfd.events = POLLIN;
+		while (r == 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			n = (end.tv_sec - now.tv_sec) * 1000 +
+			    (end.tv_nsec - now.tv_nsec) / 1000000;
+			if ((r = poll(&pfd, 1, n < 0 ? 0 : n)) <= 0)
+				break;
+			if ((n = recv(ub->ub_evfd, buf, sizeof buf - 1, 0)) < 0) {
+				r = -1;
+				break;
+			}
+			buf[n] = 0;
+			r = lx_uevent(lx, ue, buf, n);
+		}
+	}
+	if (r < 0 || (r == 0 && ub->ub_evfd >= 0))
+		return r;
+	if (lx->lx_sys[0])
+		lx_sysrescan(lx);
+	if (r == 0)
+		return 0;
+	addr = ue->u.ue_device.udi_addr;
+	if (ue->ue_type == USB_EVENT_DEVICE_DETACH) {
+		pthread_mutex_lock(&lx->lx_lock);
+		if (lx->lx_fd[addr] >= 0)
+			close(lx->lx_fd[addr]);
+		lx->lx_fd[addr] = -1;
+		pthread_mutex_unlock(&lx->lx_lock);
+	} else
+		lx_devinfo(ub, &ue->u.ue_device);
+	return 1;
+}
+
+static void
+lx_close(struct usbbus *ub)
+{
+	struct lxbus *lx = ub->ub_priv;
+	struct lxurb *lu;
+	int i;
+
+	/* Closing the files kills any URBs still on them. */
+	if (ub->ub_fd >= 0)
+		close(ub->ub_fd);
+	for (i = 0; i < USB_MAX_DEVICES; i++) {
+		if (lx->lx_fd[i] >= 0)
+			close(lx->lx_fd[i]);
+		if (lx->lx_dev[i]) {
+			free(lx->lx_dev[i]->ls_desc);
+			free(lx->lx_dev[i]);
+		}
+	}
+	while ((lu = lx->lx_urbs) != NULL) {
+		lx->lx_urbs = lu->lu_next;
+		free(lu);
+	}
+	pthread_mutex_destroy(&lx->lx_lock);
+	free(lx);
+}
+
+static const struct usbbus_ops lx_ops = {
+	lx_request, lx_devinfo, ugen_ioctl, lx_close, lx_submit, lx_reap,
+	lx_cancel, lx_event
+};
+
+/*
+ * Open a usbfs bus or device at path, with sysfs at sys.  Either may
+ * be NULL, but not both.
+ */
+static int
+lx_open(struct usbbus *ub, const char *path, const char *sys, int bus)
+{
+	struct lxbus *lx;
+	struct stat st;
+	char *p;
+	int i;
+
+	if (path && stat(path, &st) < 0)
+		return -1;
+	if ((lx = calloc(1, sizeof *lx)) == NULL)
+		return -1;
+	pthread_mutex_init(&lx->lx_lock, NULL);
+	for (i = 0; i < USB_MAX_DEVICES; i++)
+		lx->lx_fd[i] = -1;
+	ub->ub_ops = &lx_ops;
+	ub->ub_priv = lx;
+	ub->ub_fd = -1;
+	ub->ub_addr = -1;
+	lx->lx_bus = bus;
+	if (path) {
+		snprintf(lx->lx_dir, sizeof lx->lx_dir, "%s", path);
+		if (!S_ISDIR(st.st_mode)) {
+			ub->ub_fd = open(path, O_RDWR);
+			if (ub->ub_fd < 0) {
+				lx_close(ub);
+				return -1;
+			}
+			p = strrchr(lx->lx_dir, '/');
+			ub->ub_addr = atoi(p ? p + 1 : lx->lx_dir);
+			if (p)
+				*p = 0;
+		}
+		p = strrchr(lx->lx_dir, '/');
+		lx->lx_bus = atoi(p ? p + 1 : lx->lx_dir);
+	}
+	if (sys) {
+		snprintf(lx->lx_sys, sizeof lx->lx_sys, "%s", sys);
+		if (lx_sysscan(lx) < 0) {
+			lx->lx_sys[0] = 0;
+			if (path == NULL) {
+				lx_close(ub);
+				return -1;
+			}
+		}
+	}
+	/* The ugen ioctls go to the root hub unless told otherwise. */
+	for (i = 1; ub->ub_addr < 0 && i < USB_MAX_DEVICES; i++)
+		if (lx->lx_dev[i] && lx->lx_dev[i]->ls_parent == 0)
+			ub->ub_addr = i;
+	return 0;
+}
+
+/* sysfs:[dir][,bus], sysfs only; dir defaults to LXSYSFS, bus to 1. */
+static int
+lx_sysopen(struct usbbus *ub, const char *spec)
+{
+	char path[1024], *p;
+	int bus = 1;
+
+	snprintf(path, sizeof path, "%s", spec);
+	if ((p = strrchr(path, ',')) != NULL) {
+		*p++ = 0;
+		bus = atoi(p);
+	}
+	return lx_open(ub, NULL, path[0] ? path : LXSYSFS, bus);
+}
+#endif
+
+/*
+ * Simulated bus.  Each device is a file named by its address, holding
+ * its device descriptor, then bNumConfigurations whole configuration
+ * descriptors, then any number of further descriptors: string
+ * descriptors in index order starting with the language table, a hub
+ * descriptor, and records for anything else.  A record is a zero
+ * byte, a descriptor type, a 16 bit little-endian wIndex and length,
+ * and the data; HID report descriptors are stored that way under
+ * their interface number, and so is a hub's port map (type 0xff), a
+ * byte per port with the address of the device on it or 0.  A hub may
+ * also have a port status record (type 0xfe) with wPortStatus and
+ * wPortChange for each port; without one they follow from the map.
+ *
+ * Requests are answered from the blobs after sleeping for the given
+ * number of microseconds, like a device that takes that long.  Blob
+ * files may be added, removed or replaced while the bus is open;
+ * usbbus_event picks up the change.
+ */
+#define SIM_PORTMAP	0xff
+#define SIM_PORTSTATUS	0xfe
+#define SIM_MAXREC	32
+
+struct simrec {
+	int		sr_type;
+	int		sr_index;
+	const u_char	*sr_data;
+	int		sr_len;
+};
+
+struct simdev {
+	u_char		*sd_blob;	/* malloc'ed, or the caller's if sd_ref */
+	int		sd_ref;
+	usb_device_descriptor_t *sd_dd;
+	const u_char	*sd_cfg[256];
+	const u_char	*sd_str[256];
+	int		sd_nstr;
+	const u_char	*sd_hub;
+	struct simrec	sd_rec[SIM_MAXREC];
+	int		sd_nrec;
+	int		sd_config;	/* bConfigurationValue, 0 if none */
+	u_char		sd_alt[256];
+	struct timespec	sd_mtime;	/* of the blob file */
+};
+
+struct simbus {
+	pthread_mutex_t	sb_lock;
+	pthread_cond_t	sb_cancel;	/* sb_gen went up */
+	u_long		sb_gen;		/* requests cancelled so far */
+	struct simdev	*sb_dev[USB_MAX_DEVICES];
+	struct timespec	sb_bad[USB_MAX_DEVICES];	/* mtime of a bad blob */
+	long		sb_usec;
+	u_long		sb_nreq;
+	char		sb_path[1024];	/* the directory, empty if one device */
+};
+
+static const struct simrec *
+sim_rec(struct simdev *sd, int type, int index)
+{
+	int i;
+
+	for (i = 0; i < sd->sd_nrec; i++)
+		if (sd->sd_rec[i].sr_type == type &&
+		    sd->sd_rec[i].sr_index == index)
+			return &sd->sd_rec[i];
+	return NULL;
+}
+
+/* Index a device blob; NULL, after a warning, if it is malformed. */
+static struct simdev *
+sim_parse(const char *name, const u_char *b, size_t len)
+{
+	struct simdev *sd;
+	size_t off;
+	int i, n;
+
+	if ((sd = calloc(1, sizeof *sd)) == NULL)
+		err(1, "calloc");
+	sd->sd_blob = (u_char *)b;
+	sd->sd_dd = (usb_device_descriptor_t *)b;
+	if (len < USB_DEVICE_DESCRIPTOR_SIZE || b[1] != UDESC_DEVICE) {
+		warnx("%s: no device descriptor", name);
+		goto bad;
+	}
+	off = b[0];
+	for (i = 0; i < sd->sd_dd->bNumConfigurations; i++) {
+		if (off + USB_CONFIG_DESCRIPTOR_SIZE > len ||
+		    b[off + 1] != UDESC_CONFIG ||
+		    off + UGETW(b + off + 2) > len) {
+			warnx("%s: bad configuration %d", name, i);
+			goto bad;
+		}
+		sd->sd_cfg[i] = b + off;
+		if (i == 0)
+			sd->sd_config = b[off + 5];
+		off += UGETW(b + off + 2);
+	}
+	while (off < len) {
+		if (b[off] == 0) {
+			if (off + 6 > len || sd->sd_nrec == SIM_MAXREC ||
+			    off + 6 + UGETW(b + off + 4) > len) {
+				warnx("%s: bad record at %zu", name, off);
+				goto bad;
+			}
+			sd->sd_rec[sd->sd_nrec].sr_type = b[off + 1];
+			sd->sd_rec[sd->sd_nrec].sr_index = UGETW(b + off + 2);
+			sd->sd_rec[sd->sd_nrec].sr_len = n = UGETW(b + off + 4);
+			sd->sd_rec[sd->sd_nrec++].sr_data = b + off + 6;
+			off += 6 + n;
+			continue;
+		}
+		if (b[off] < 2 || off + b[off] > len) {
+			warnx("%s: bad descriptor at %zu", name, off);
+			goto bad;
+		}
+		if (b[off + 1] == UDESC_STRING && sd->sd_nstr < 256)
+			sd->sd_str[sd->sd_nstr++] = b + off;
+		else if (b[off + 1] == UDESC_HUB)
+			sd->sd_hub = b + off;
+		off += b[off];
+	}
+	return sd;
+ bad:
+	free(sd);
+	return NULL;
+}
+
+/*
+ * Load the blob file name into *sdp, or set it to NULL if there is no
+ * such file.  Returns -1, having warned, if the file could not be read
+ * or is malformed; it may be half written.
+ */
+static int
+sim_load(const char *name, struct simdev **sdp)
+{
+	struct stat st;
+	u_char *b = NULL;
+	ssize_t n = -1;
+	int fd;
+
+	*sdp = NULL;
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		warn("%s", name);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0)
+		st.st_size = 0;
+	else if ((b = malloc(st.st_size + 1)) != NULL)
+		n = read(fd, b, st.st_size);
+	close(fd);
+	if (n != st.st_size) {
+		if (n < 0)
+			warn("%s", name);
+		else
+			warnx("%s: short read", name);
+		free(b);
+		return -1;
+	}
+	if ((*sdp = sim_parse(name, b, st.st_size)) == NULL) {
+		free(b);
+		return -1;
+	}
+	(*sdp)->sd_mtime = st.st_mtim;
+	return 0;
+}
+
+static void
+sim_free(struct simdev *sd)
+{
+	if (!sd->sd_ref)
+		free(sd->sd_blob);
+	free(sd);
+}
+
+/* The current configuration descriptor, or NULL. */
+static const u_char *
+sim_curcfg(struct simdev *sd)
+{
+	int i;
+
+	for (i = 0; i < sd->sd_dd->bNumConfigurations; i++)
+		if (sd->sd_cfg[i][5] == sd->sd_config)
+			return sd->sd_cfg[i];
+	return NULL;
+}
+
+/* The HID descriptor following interface ifc in the current config. */
+static const u_char *
+sim_hiddesc(struct simdev *sd, int ifc)
+{
+	const u_char *c = sim_curcfg(sd), *p, *e;
+	int in = 0;
+
+	if (c == NULL)
+		return NULL;
+	for (p = c, e = c + UGETW(c + 2); p + 2 <= e && p[0] >= 2; p += p[0]) {
+		if (p[1] == UDESC_INTERFACE)
+			in = p[2] == ifc;
+		else if (in && p[1] == UDESC_HID)
+			return p;
+	}
+	return NULL;
+}
+
+static int
+sim_request(struct usbbus *ub, struct usb_ctl_request *req)
+{
+	struct simbus *sb = ub->ub_priv;
+	usb_device_request_t *dr = &req->ucr_request;
+	struct simdev *sd;
+	const struct simrec *sr;
+	const u_char *data = NULL, *c;
+	u_char buf[4];
+	struct timespec ts;
+	u_long gen;
+	int value, index, len, n = 0, child, r = 0;
+
+	if (req->ucr_addr < 0 || req->ucr_addr >= USB_MAX_DEVICES ||
+	    (sd = sb->sb_dev[req->ucr_addr]) == NULL) {
+		errno = ENXIO;
+		return -1;
+	}
+	if (sb->sb_usec > 0) {
+		n = sb->sb_usec;
+		if (ub->ub_timeout && n > ub->ub_timeout * 1000)
+			n = ub->ub_timeout * 1000;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_sec += n / 1000000;
+		ts.tv_nsec += n % 1000000 * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		/* Take the time the bus would, unless sim_cancel comes. */
+		pthread_mutex_lock(&sb->sb_lock);
+		gen = sb->sb_gen;
+		while (sb->sb_gen == gen && pthread_cond_timedwait(
+		    &sb->sb_cancel, &sb->sb_lock, &ts) != ETIMEDOUT)
+			;
+		gen = sb->sb_gen - gen;
+		pthread_mutex_unlock(&sb->sb_lock);
+		if (gen) {
+			errno = ECANCELED;
+			return -1;
+		}
+		if (n < sb->sb_usec) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		n = 0;
+	}
+	value = UGETW(dr->wValue);
+	index = UGETW(dr->wIndex);
+	len = UGETW(dr->wLength);
+	req->ucr_actlen = 0;
+
+	pthread_mutex_lock(&sb->sb_lock);
+	sb->sb_nreq++;
+	switch (dr->bmRequestType << 8 | dr->bRequest) {
+	case UT_READ_DEVICE << 8 | UR_GET_DESCRIPTOR:
+		switch (value >> 8) {
+		case UDESC_DEVICE:
+			data = (u_char *)sd->sd_dd;
+			n = USB_DEVICE_DESCRIPTOR_SIZE;
+			break;
+		case UDESC_CONFIG:
+			if ((value & 0xff) < sd->sd_dd->bNumConfigurations) {
+				data = sd->sd_cfg[value & 0xff];
+				n = UGETW(data + 2);
+			}
+			break;
+		case UDESC_STRING:
+			if ((value & 0xff) < sd->sd_nstr) {
+				data = sd->sd_str[value & 0xff];
+				n = data[0];
+			}
+			break;
+		}
+		break;
+	case UT_READ_CLASS_DEVICE << 8 | UR_GET_DESCRIPTOR:
+		/* Hubs put up with a type of 0, and usbctl sends that. */
+		if (((value >> 8) == UDESC_HUB || (value >> 8) == 0) &&
+		    (data = sd->sd_hub) != NULL)
+			n = data[0];
+		break;
+	case UT_READ_INTERFACE << 8 | UR_GET_DESCRIPTOR:
+		if ((value >> 8) == UDESC_HID &&
+		    (data = sim_hiddesc(sd, index)) != NULL)
+			n = data[0];
+		else if ((sr = sim_rec(sd, value >> 8, index)) != NULL) {
+			data = sr->sr_data;
+			n = sr->sr_len;
+		}
+		break;
+	case UT_READ_DEVICE << 8 | UR_GET_STATUS:
+		c = sim_curcfg(sd);
+		USETW(buf, c && (c[7] & UC_SELF_POWERED) ? UDS_SELF_POWERED : 0);
+		data = buf;
+		n = 2;
+		break;
+	case UT_READ_INTERFACE << 8 | UR_GET_STATUS:
+	case UT_READ_ENDPOINT << 8 | UR_GET_STATUS:
+		USETW(buf, 0);
+		data = buf;
+		n = 2;
+		break;
+	case UT_READ_CLASS_DEVICE << 8 | UR_GET_STATUS:
+		if (sd->sd_hub) {
+			memset(buf, 0, 4);
+			data = buf;
+			n = 4;
+		}
+		break;
+	case UT_READ_CLASS_OTHER << 8 | UR_GET_STATUS:
+		if (sd->sd_hub == NULL || index < 1 || index > sd->sd_hub[2])
+			break;
+		sr = sim_rec(sd, SIM_PORTSTATUS, 0);
+		if (sr && index * 4 <= sr->sr_len) {
+			data = sr->sr_data + (index - 1) * 4;
+			n = 4;
+			break;
+		}
+		sr = sim_rec(sd, SIM_PORTMAP, 0);
+		child = sr && index <= sr->sr_len ? sr->sr_data[index - 1] : 0;
+		USETW(buf, UPS_PORT_POWER | (child ?
+		    UPS_CURRENT_CONNECT_STATUS | UPS_PORT_ENABLED : 0));
+		USETW(buf + 2, 0);
+		data = buf;
+		n = 4;
+		break;
+	case UT_READ_DEVICE << 8 | UR_GET_CONFIG:
+		buf[0] = sd->sd_config;
+		data = buf;
+		n = 1;
+		break;
+	case UT_WRITE_DEVICE << 8 | UR_SET_CONFIG:
+		for (n = 0; n < sd->sd_dd->bNumConfigurations; n++)
+			if (sd->sd_cfg[n][5] == value)
+				break;
+		if (value != 0 && n == sd->sd_dd->bNumConfigurations)
+			break;
+		sd->sd_config = value;
+		memset(sd->sd_alt, 0, sizeof sd->sd_alt);
+		data = buf;
+		n = 0;
+		break;
+	case UT_READ_INTERFACE << 8 | UR_GET_INTERFACE:
+		buf[0] = sd->sd_alt[index & 0xff];
+		data = buf;
+		n = 1;
+		break;
+	case UT_WRITE_INTERFACE << 8 | UR_SET_INTERFACE:
+		sd->sd_alt[index & 0xff] = value;
+		data = buf;
+		n = 0;
+		break;
+	}
+	if (data == NULL) {
+		errno = EIO;		/* stall */
+		r = -1;
+	} else {
+		if (n > len)
+			n = len;
+		if (n > 0)
+			memcpy(req->ucr_data, data, n);
+		req->ucr_actlen = n;
+		if (n < len && !(req->ucr_flags & USBD_SHORT_XFER_OK)) {
+			errno = EIO;
+			r = -1;
+		}
+	}
+	pthread_mutex_unlock(&sb->sb_lock);
+	return r;
+}
+
+/* Plain text of a string descriptor, in the manner of the kernel. */
+static void
+sim_string(struct simdev *sd, int si, char *s, size_t size)
+{
+	const u_char *d;
+	size_t i, n;
+
+	*s = 0;
+	if (si == 0 || si >= sd->sd_nstr)
+		return;
+	d = sd->sd_str[si];
+	n = d[0] / 2 - 1;
+	for (i = 0; i < n && i < size - 1; i++)
+		s[i] = d[3 + 2 * i] ? '?' : d[2 + 2 * i];
+	s[i] = 0;
+}
+
+static int
+sim_devinfo(struct usbbus *ub, struct usb_device_info *di)
+{
+	struct simbus *sb = ub->ub_priv;
+	const struct simrec *sr;
+	const u_char *c;
+	struct simdev *sd;
+	int addr, i, bcd;
+
+	addr = di->udi_addr;
+	if (addr < 0 || addr >= USB_MAX_DEVICES ||
+	    (sd = sb->sb_dev[addr]) == NULL) {
+		errno = ENXIO;
+		return -1;
+	}
+	memset(di, 0, sizeof *di);
+	di->udi_addr = addr;
+	di->udi_vendorNo = UGETW(sd->sd_dd->idVendor);
+	di->udi_productNo = UGETW(sd->sd_dd->idProduct);
+	di->udi_releaseNo = UGETW(sd->sd_dd->bcdDevice);
+	snprintf(di->udi_release, sizeof di->udi_release, "%x.%02x",
+		 di->udi_releaseNo >> 8, di->udi_releaseNo & 0xff);
+	sim_string(sd, sd->sd_dd->iManufacturer, di->udi_vendor,
+	    sizeof di->udi_vendor);
+	sim_string(sd, sd->sd_dd->iProduct, di->udi_product,
+	    sizeof di->udi_product);
+	sim_string(sd, sd->sd_dd->iSerialNumber, di->udi_serial,
+	    sizeof di->udi_serial);
+	di->udi_class = sd->sd_dd->bDeviceClass;
+	di->udi_subclass = sd->sd_dd->bDeviceSubClass;
+	di->udi_protocol = sd->sd_dd->bDeviceProtocol;
+	bcd = UGETW(sd->sd_dd->bcdUSB);
+	di->udi_speed = bcd >= 0x0300 ? USB_SPEED_SUPER :
+	    bcd >= 0x0200 ? USB_SPEED_HIGH : USB_SPEED_FULL;
+	pthread_mutex_lock(&sb->sb_lock);
+	di->udi_config = sd->sd_config;
+	c = sim_curcfg(sd);
+	pthread_mutex_unlock(&sb->sb_lock);
+	if (c && !(c[7] & UC_SELF_POWERED))
+		di->udi_power = c[8] * UC_POWER_FACTOR;
+	snprintf(di->udi_devnames[0], sizeof di->udi_devnames[0], "sim%d",
+		 addr);
+	if (sd->sd_hub) {
+		sr = sim_rec(sd, SIM_PORTMAP, 0);
+		di->udi_nports = sd->sd_hub[2];
+		for (i = 0; i < di->udi_nports && i < 16; i++)
+			di->udi_ports[i] = sr && i < sr->sr_len &&
+			    sr->sr_data[i] ? sr->sr_data[i] : USB_PORT_POWERED;
+	}
+	return 0;
+}
+
+static int
+sim_ioctl(struct usbbus *ub, u_long cmd, void *arg)
+{
+	struct simbus *sb = ub->ub_priv;
+	struct usb_device_stats *st = arg;
+
+	if (cmd == USB_DEVICESTATS) {
+		memset(st, 0, sizeof *st);
+		pthread_mutex_lock(&sb->sb_lock);
+		st->uds_requests[UE_CONTROL] = sb->sb_nreq;
+		pthread_mutex_unlock(&sb->sb_lock);
+		return 0;
+	}
+	return ugen_ioctl(ub, cmd, arg);
+}
+
+/*
+ * No real hotplug here: after sleeping, blob files that have come,
+ * gone or changed since the last look are loaded again, and the first
+ * device that came or went is reported.  A blob that does not load,
+ * perhaps because it is still being written, is left as it was until
+ * the file changes again.
+ */
+static int
+sim_event(struct usbbus *ub, struct usb_event *ue, int timeout)
+{
+	struct simbus *sb = ub->ub_priv;
+	struct simdev *sd, *old;
+	struct stat st;
+	char name[1100];
+	int a, type, r = 0;
+
+	if (evsleep(timeout) < 0)
+		return -1;
+	if (sb->sb_path[0] == 0)
+		return 0;
+	for (a = 0; a < USB_MAX_DEVICES; a++) {
+		snprintf(name, sizeof name, "%s/%d", sb->sb_path, a);
+		old = sb->sb_dev[a];
+		sd = NULL;
+		if (stat(name, &st) < 0) {
+			if (old == NULL)
+				continue;
+			type = USB_EVENT_DEVICE_DETACH;
+		} else if (old == NULL ||
+		    old->sd_mtime.tv_sec != st.st_mtim.tv_sec ||
+		    old->sd_mtime.tv_nsec != st.st_mtim.tv_nsec) {
+			if (sb->sb_bad[a].tv_sec == st.st_mtim.tv_sec &&
+			    sb->sb_bad[a].tv_nsec == st.st_mtim.tv_nsec)
+				continue;
+			if (sim_load(name, &sd) < 0) {
+				sb->sb_bad[a] = st.st_mtim;
+				continue;
+			}
+			if (sd == NULL)
+				continue;
+			type = old ? 0 : USB_EVENT_DEVICE_ATTACH;
+		} else
+			continue;
+		pthread_mutex_lock(&sb->sb_lock);
+		sb->sb_dev[a] = sd;
+		pthread_mutex_unlock(&sb->sb_lock);
+		if (old)
+			sim_free(old);
+		if (type == 0 || r)
+			continue;
+		memset(ue, 0, sizeof *ue);
+		ue->ue_type = type;
+		clock_gettime(CLOCK_REALTIME, &ue->ue_time);
+		ue->u.ue_device.udi_addr = a;
+		if (sd)
+			sim_devinfo(ub, &ue->u.ue_device);
+		r = 1;
+	}
+	return r;
+}
+
+static void
+sim_close(struct usbbus *ub)
+{
+	struct simbus *sb = ub->ub_priv;
+	int i;
+
+	for (i = 0; i < USB_MAX_DEVICES; i++)
+		if (sb->sb_dev[i])
+			sim_free(sb->sb_dev[i]);
+	pthread_cond_destroy(&sb->sb_cancel);
+	pthread_mutex_destroy(&sb->sb_lock);
+	free(sb);
+}
+
+/* Fail the requests being answered now with ECANCELED. */
+static void
+sim_cancel(struct usbbus *ub)
+{
+	struct simbus *sb = ub->ub_priv;
+
+	pthread_mutex_lock(&sb->sb_lock);
+	sb->sb_gen++;
+	pthread_cond_broadcast(&sb->sb_cancel);
+	pthread_mutex_unlock(&sb->sb_lock);
+}
+
+static const struct usbbus_ops sim_ops = {
+	sim_request, sim_devinfo, sim_ioctl, sim_close, NULL, NULL,
+	sim_cancel, sim_event
+};
+
+static void
+sim_init(struct simbus *sb)
+{
+	pthread_condattr_t ca;
+
+	pthread_mutex_init(&sb->sb_lock, NULL);
+	/* sim_request's waits are on the monotonic clock. */
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&sb->sb_cancel, &ca);
+	pthread_condattr_destroy(&ca);
+}
+
+static int
+sim_open(struct usbbus *ub, const char *spec)
+{
+	struct simbus *sb;
+	struct stat st;
+	char path[1024], name[1100], *p;
+	int a;
+
+	snprintf(path, sizeof path, "%s", spec);
+	if ((sb = calloc(1, sizeof *sb)) == NULL)
+		return -1;
+	if ((p = strrchr(path, ',')) != NULL) {
+		*p++ = 0;
+		sb->sb_usec = atol(p);
+	}
+	if (stat(path, &st) < 0) {
+		free(sb);
+		return -1;
+	}
+	sim_init(sb);
+	ub->ub_ops = &sim_ops;
+	ub->ub_priv = sb;
+	ub->ub_fd = -1;
+	ub->ub_addr = -1;
+	if (!S_ISDIR(st.st_mode)) {
+		p = strrchr(path, '/');
+		a = atoi(p ? p + 1 : path);
+		if (a < 0 || a >= USB_MAX_DEVICES)
+			errx(1, "%s: not a device address", path);
+		ub->ub_addr = a;
+		if (sim_load(path, &sb->sb_dev[a]) < 0)
+			goto bad;
+		return 0;
+	}
+	snprintf(sb->sb_path, sizeof sb->sb_path, "%s", path);
+	for (a = 0; a < USB_MAX_DEVICES; a++) {
+		snprintf(name, sizeof name, "%s/%d", path, a);
+		if (sim_load(name, &sb->sb_dev[a]) < 0)
+			goto bad;
+		if (sb->sb_dev[a] != NULL && ub->ub_addr < 0)
+			ub->ub_addr = a;
+	}
+	return 0;
+ bad:
+	sim_close(ub);
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Open a bus from a spec string as described in usbbus.h.  Returns
+ * NULL with errno set if it cannot be opened.
+ */
+struct usbbus *
+usbbus_open(const char *spec)
+{
+	struct usbbus *ub;
+	int r;
+
+	if ((ub = calloc(1, sizeof *ub)) == NULL)
+		return NULL;
+	ub->ub_evfd = -1;
+	if (strncmp(spec, "sim:", 4) == 0)
+		r = sim_open(ub, spec + 4);
+#ifdef __linux__
+	else if (strncmp(spec, "sysfs:", 6) == 0)
+		r = lx_sysopen(ub, spec + 6);
+	else if (strncmp(spec, "/dev/bus/usb", 12) == 0)
+		r = lx_open(ub, spec, LXSYSFS, 0);
+#endif
+	else {
+		ub->ub_ops = &nb_ops;
+		ub->ub_fd = open(spec, O_RDWR);
+		r = ub->ub_fd < 0 ? -1 : 0;
+	}
+	if (r < 0) {
+		free(ub);
+		return NULL;
+	}
+	return ub;
+}
+
+struct usbbus *
+usbbus_blob(const char *name, const void *blob, size_t len, int addr)
+{
+	struct usbbus *ub;
+	struct simbus *sb;
+	struct simdev *sd;
+
+	if (addr < 0 || addr >= USB_MAX_DEVICES ||
+	    (sd = sim_parse(name, blob, len)) == NULL)
+		return NULL;
+	sd->sd_ref = 1;
+	if ((ub = calloc(1, sizeof *ub)) == NULL ||
+	    (sb = calloc(1, sizeof *sb)) == NULL)
+		err(1, "calloc");
+	sim_init(sb);
+	sb->sb_dev[addr] = sd;
+	ub->ub_ops = &sim_ops;
+	ub->ub_priv = sb;
+	ub->ub_fd = -1;
+	ub->ub_addr = addr;
+	ub->ub_evfd = -1;
+	return ub;
+}
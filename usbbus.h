@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Control transfer backends.  A bus is opened from a spec string:
+ *
+ *	/dev/usbN		NetBSD controller, devices by address
+ *	/dev/ugenN.00		NetBSD generic device
+ *	/dev/bus/usb/BBB	Linux usbfs bus directory
+ *	/dev/bus/usb/BBB/DDD	Linux usbfs device
+ *	sysfs:[dir][,bus]	Linux sysfs only, no transfers at all
+ *	sim:dir[,usec]		simulated bus, one blob file per address
+ *	sim:dir/N[,usec]	one simulated device
+ *
+ * usbbus_request and usbbus_devinfo work like the USB_REQUEST and
+ * USB_DEVICEINFO ioctls.  usbbus_ioctl takes any other NetBSD usb(4)
+ * or ugen(4) ioctl; backends other than NetBSD do the ugen ones with
+ * control requests to the bus's only (or first) device, and fail the
+ * rest with ENOTTY.  The Linux backends answer what they can from
+ * the descriptors cached in sysfs; a sysfs only bus fails everything
+ * else with EOPNOTSUPP.  All of them are safe to call from several
+ * threads at once.
+ *
+ * usbbus_blob opens a simulated bus with one device at addr, answered
+ * from a blob in the sim file format that the caller keeps valid until
+ * usbbus_close; it warns, using name, and returns NULL if the blob is
+ * malformed.
+ *
+ * usbbus_event waits up to timeout ms for a hotplug event and returns
+ * 1 with the event filled in, or 0 if none came.  NetBSD reads them
+ * from /dev/usb, Linux from the kernel's uevents, and the simulated
+ * bus notices blob files coming, going or changing; a backend with no
+ * event source just sleeps.  Once it has returned, usbbus_devinfo
+ * reflects the change.  Unlike the rest, it must not be called while
+ * other threads are using the bus.
+ */
+struct usbbus;
+struct trace;
+
+struct usbbus_ops {
+	int	(*uo_request)(struct usbbus *, struct usb_ctl_request *);
+	int	(*uo_devinfo)(struct usbbus *, struct usb_device_info *);
+	int	(*uo_ioctl)(struct usbbus *, u_long, void *);
+	void	(*uo_close)(struct usbbus *);
+	/*
+	 * Optional, for usbq: submit returns 1 or -1 if done at once;
+	 * reap waits up to a timeout in ms, or for ever if negative, and
+	 * fails with ETIMEDOUT; cancel makes whatever is on the bus at
+	 * the time complete soon, failed with ECANCELED.
+	 */
+	int	(*uo_submit)(struct usbbus *, struct usb_ctl_request *, void *);
+	void	*(*uo_reap)(struct usbbus *, int, int *);
+	void	(*uo_cancel)(struct usbbus *);
+	/* Optional, for usbbus_event. */
+	int	(*uo_event)(struct usbbus *, struct usb_event *, int);
+};
+
+struct usbbus {
+	const struct usbbus_ops *ub_ops;
+	int		ub_fd;		/* NetBSD, or a single usbfs device */
+	int		ub_addr;	/* device the ugen ioctls go to */
+	void		*ub_priv;
+	struct trace	*ub_trace;	/* see usbtrace.h, NULL if off */
+	int		ub_timeout;	/* per request, ms; 0 for default */
+	int		ub_evfd;	/* event source, -1 until opened */
+};
+
+struct usbbus *usbbus_open(const char *);
+struct usbbus *usbbus_blob(const char *, const void *, size_t, int);
+int usbbus_request(struct usbbus *, struct usb_ctl_request *);
+int usbbus_devinfo(struct usbbus *, struct usb_device_info *);
+int usbbus_ioctl(struct usbbus *, u_long, void *);
+int usbbus_event(struct usbbus *, struct usb_event *, int);
+void usbbus_close(struct usbbus *);
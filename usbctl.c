@@ -26,21 +26,47 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <dirent.h>
 #include <fcntl.h>
+#include <fnmatch.h>
 #include <unistd.h>
 #include <err.h>
 #include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
 #include <dev/usb/usb.h>
 #include <dev/usb/usbhid.h>
 
+#include "arena.h"
+#include "hidrep.h"
+#include "strcache.h"
+#include "usbbus.h"
+#include "usbdesc.h"
+#include "usbout.h"
+#include "usbq.h"
+#include "usbsnap.h"
+#include "usbtrace.h"
+
 #ifndef USB_STACK_VERSION
 #define ucr_addr addr
 #define ucr_request request
 #define ucr_data data
 #define ucr_flags flags
+#define ucr_actlen actlen
 #define udi_addr addr
 #define udi_class class
+#define udi_vendorNo vendorNo
+#define udi_productNo productNo
+#define udi_releaseNo releaseNo
 #endif
 
 #ifndef UICLASS_HID
@@ -64,31 +90,259 @@
 #define NSTRINGS
 
 int num = 0;
+int ofmt = OFMT_TEXT;
+
+/*
+ * Per-device state.  Everything needed to dump one device lives here
+ * so that several devices can be dumped concurrently; out is stdout
+ * for a serial dump or a private memory stream when using -j.
+ */
+struct usbdev {
+	struct usbbus *ub;	/* controller */
+	int	addr;
+	FILE	*out;
+	char	*obuf;
+	size_t	olen;
+	struct strkey skey;	/* string cache key, less the index */
+	int	keyed;		/* skey tells units apart; else no cache */
+	struct arena arena;	/* descriptor buffers, freed per device */
+	u_char	pfstr[256 / 8];	/* strings prefetched */
+	double	deadline;	/* monotime, 0 if none */
+	int	error;		/* errno of the first failure, 0 if none */
+	char	what[32];	/* and what it was reading */
+	struct snapid sid;	/* identity for -S */
+	int	cached;		/* answers come from the snapshot */
+	const char *name;	/* blob it came from with -B, or NULL */
+	int	unknown;	/* descriptors prdesc could not decode */
+	char	**cstr;		/* strings read for prconfig, or NULL */
+};
 
-static int usbf, usbaddr;
 void
-setupstrings(int f, int addr)
+setupdev(struct usbdev *ud, struct usbbus *ub, int addr, FILE *out)
 {
-	usbf = f;
-	usbaddr = addr;
+	ud->ub = ub;
+	ud->addr = addr;
+	ud->out = out;
+	ud->obuf = 0;
+	ud->olen = 0;
+	memset(&ud->skey, 0, sizeof ud->skey);
+	ud->keyed = 0;
+	memset(&ud->arena, 0, sizeof ud->arena);
+	memset(ud->pfstr, 0, sizeof ud->pfstr);
+	ud->deadline = 0;
+	ud->error = 0;
+	memset(&ud->sid, 0, sizeof ud->sid);
+	ud->cached = 0;
+	ud->name = NULL;
+	ud->unknown = 0;
+	ud->cstr = NULL;
 }
 
 void
-getstring(int si, char *s)
+setupkey(struct usbdev *ud, struct usb_device_info *di)
 {
-	struct usb_ctl_request req;
-	int r, i, n;
-	u_int16_t c;
-	usb_string_descriptor_t us;
+	ud->skey.sk_vendor = di->udi_vendorNo;
+	ud->skey.sk_product = di->udi_productNo;
+	ud->skey.sk_release = di->udi_releaseNo;
+#ifdef USB_STACK_VERSION
+	/*
+	 * Without the serial number every unit of a model would share
+	 * cache entries, the serial number string among them.
+	 */
+	ud->skey.sk_serial = strhash(di->udi_serial, strlen(di->udi_serial));
+	ud->keyed = 1;
+#endif
+}
 
-	if (si == 0 || num) {
-		*s = 0;
+/*
+ * Answers prefetched with -P, by address.  The lists are built before
+ * any device is dumped and only read afterwards.  The daemon (-L) also
+ * records every answer that came from the bus, so that a device is
+ * only read once however often it is rendered.
+ */
+struct pfent {
+	struct usbq_req	pf_q;
+	struct pfent	*pf_next;
+	u_char		pf_data[];
+};
+
+struct pfent *pfcache[USB_MAX_DEVICES];
+int pfrecord;
+
+void
+pf_record(struct usb_ctl_request *req)
+{
+	struct pfent *pf;
+	int n = req->ucr_actlen;
+
+	if ((pf = calloc(1, sizeof *pf + n)) == NULL)
+		err(1, "calloc");
+	pf->pf_q.uq_req = *req;
+	pf->pf_q.uq_req.ucr_data = pf->pf_data;
+	memcpy(pf->pf_data, req->ucr_data, n);
+	pf->pf_next = pfcache[req->ucr_addr & 0x7f];
+	pfcache[req->ucr_addr & 0x7f] = pf;
+}
+
+void
+pf_forget(int addr)
+{
+	struct pfent *pf;
+
+	while ((pf = pfcache[addr]) != NULL) {
+		pfcache[addr] = pf->pf_next;
+		free(pf);
+	}
+}
+
+/*
+ * Time limits for -w and -W.  A device gets a fair share of what is
+ * left of the total budget when its dump starts; once that runs out
+ * every further request for it fails at once with ETIMEDOUT, so the
+ * dump finishes with what it has and is marked partial.  Requests
+ * that fail in a way that may be transient are retried with a
+ * doubling backoff, but never past the deadline.
+ */
+#define RETRIES		2
+#define BACKOFF		0.01		/* s, doubled for each retry */
+
+int retries = RETRIES;		/* 0 for blobs, which always answer alike */
+double budgetend;		/* 0 if no budget */
+int budgetjobs = 1;
+int devsleft;
+
+double
+monotime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void
+startdev(struct usbdev *ud)
+{
+	double t, share;
+	int left;
+
+	ud->error = 0;
+	ud->deadline = 0;
+	if (budgetend == 0)
+		return;
+	left = __atomic_fetch_sub(&devsleft, 1, __ATOMIC_RELAXED);
+	t = monotime();
+	share = budgetend - t;
+	if (left > budgetjobs)
+		share = share * budgetjobs / left;
+	ud->deadline = t + share;
+}
+
+/* Note the first thing that could not be read from a device. */
+void
+devfail(struct usbdev *ud, const char *fmt, ...)
+{
+	va_list ap;
+
+	/* Not the device's fault, nor anything it could do better. */
+	if (errno == EOPNOTSUPP || ud->error)
 		return;
+	ud->error = errno;
+	va_start(ap, fmt);
+	vsnprintf(ud->what, sizeof ud->what, fmt, ap);
+	va_end(ap);
+}
+
+int
+retryable(int e)
+{
+	switch (e) {
+	case EIO:
+	case EPROTO:
+	case EILSEQ:
+	case EAGAIN:
+	case EINTR:
+		return 1;
 	}
-	req.ucr_addr = usbaddr;
+	return 0;
+}
+
+/*
+ * Do a control request, using a prefetched answer to the same request
+ * if there is one that is long enough.
+ */
+int
+ctlrequest(struct usbdev *ud, struct usb_ctl_request *req)
+{
+	usb_device_request_t *dr = &req->ucr_request, *pr;
+	struct pfent *pf;
+	struct timespec ts;
+	double wait = BACKOFF;
+	int len, plen, n, r, try;
+
+	len = UGETW(dr->wLength);
+	for (pf = pfcache[req->ucr_addr & 0x7f]; pf; pf = pf->pf_next) {
+		pr = &pf->pf_q.uq_req.ucr_request;
+		plen = UGETW(pr->wLength);
+		n = pf->pf_q.uq_req.ucr_actlen;
+		if (pf->pf_q.uq_error || pr->bmRequestType != dr->bmRequestType ||
+		    pr->bRequest != dr->bRequest ||
+		    UGETW(pr->wValue) != UGETW(dr->wValue) ||
+		    UGETW(pr->wIndex) != UGETW(dr->wIndex) ||
+		    (plen < len && n == plen))
+			continue;
+		if (n > len)
+			n = len;
+		memcpy(req->ucr_data, pf->pf_q.uq_req.ucr_data, n);
+		req->ucr_actlen = n;
+		if (n < len && !(req->ucr_flags & USBD_SHORT_XFER_OK)) {
+			errno = EIO;
+			return -1;
+		}
+		return 0;
+	}
+	for (try = 0; ; try++) {
+		if (ud->deadline && monotime() >= ud->deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		r = usbbus_request(ud->ub, req);
+		if (r == 0 && pfrecord)
+			pf_record(req);
+		if (r == 0 || try == retries || !retryable(errno))
+			return r;
+		if (ud->deadline && monotime() + wait >= ud->deadline) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		ts.tv_sec = wait;
+		ts.tv_nsec = (wait - ts.tv_sec) * 1e9;
+		nanosleep(&ts, NULL);
+		wait *= 2;
+	}
+}
+
+/*
+ * Get string descriptor si, from the cache if possible.  Returns -1
+ * if there is no such string or it could not be read.
+ */
+int
+getstringdesc(struct usbdev *ud, int si, usb_string_descriptor_t *us)
+{
+	struct usb_ctl_request req;
+	struct strkey key;
+	int r;
+
+	if (si == 0 || num)
+		return -1;
+	key = ud->skey;
+	key.sk_index = si;
+	if (ud->keyed && strcache_get(&key, us))
+		return 0;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_DEVICE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
-	req.ucr_data = &us;
+	req.ucr_data = us;
 	USETW2(req.ucr_request.wValue, UDESC_STRING, si);
 	USETW(req.ucr_request.wIndex, 0);
 #ifdef NSTRINGS
@@ -98,21 +352,34 @@ getstring(int si, char *s)
 	USETW(req.ucr_request.wLength, 1);
 	req.ucr_flags = 0;
 #endif
-	r = ioctl(usbf, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0) {
-		fprintf(stderr, "getstring %d failed (error=%d)\n", si, errno);
-		*s = 0;
-		return;
+		devfail(ud, "string %d", si);
+		return -1;
 	}
 #ifndef NSTRINGS
-	USETW(req.ucr_request.wLength, us.bLength);
-	r = ioctl(usbf, USB_REQUEST, &req);
-	if (r < 0)
-		err(1, "USB_REQUEST");
+	USETW(req.ucr_request.wLength, us->bLength);
+	r = ctlrequest(ud, &req);
+	if (r < 0) {
+		devfail(ud, "string %d", si);
+		return -1;
+	}
 #endif
-	n = us.bLength / 2 - 1;
+	if (ud->keyed)
+		strcache_put(&key, us);
+	return 0;
+}
+
+/* String descriptor us as text, with \uXXXX for anything past Latin-1. */
+void
+usstring(const usb_string_descriptor_t *us, char *s)
+{
+	int i, n;
+	u_int16_t c;
+
+	n = us->bLength / 2 - 1;
 	for (i = 0; i < n; i++) {
-		c = UGETW(us.bString[i]);
+		c = UGETW(us->bString[i]);
 		if ((c & 0xff00) == 0)
 			*s++ = c;
 		else if ((c & 0x00ff) == 0)
@@ -126,14 +393,26 @@ getstring(int si, char *s)
 }
 
 void
-prunits(int f)
+getstring(struct usbdev *ud, int si, char *s)
+{
+	usb_string_descriptor_t us;
+
+	if (getstringdesc(ud, si, &us) < 0) {
+		*s = 0;
+		return;
+	}
+	usstring(&us, s);
+}
+
+void
+prunits(struct usbbus *ub)
 {
 	struct usb_device_info di;
 	int r, n, i;
 
 	for(n = i = 0; i < USB_MAX_DEVICES; i++) {
 		di.udi_addr = i;
-		r = ioctl(f, USB_DEVICEINFO, &di);
+		r = usbbus_devinfo(ub, &di);
 		if (r == 0) {
 			printf("USB device %d: %d\n", i, di.udi_class);
 			n++;
@@ -145,7 +424,7 @@ prunits(int f)
 char *
 descTypeName(int t)
 {
-	static char b[100];
+	static __thread char b[100];
 	char *p = 0;
 
 	switch (t) {
@@ -184,7 +463,7 @@ descTypeName(int t)
 char *
 acSubTypeName(int t)
 {
-	static char b[100];
+	static __thread char b[100];
 	char *p = 0;
 
 	switch (t) {
@@ -208,7 +487,7 @@ acSubTypeName(int t)
 char *
 asSubTypeName(int t)
 {
-	static char b[100];
+	static __thread char b[100];
 	char *p = 0;
 
 	switch (t) {
@@ -226,14 +505,14 @@ asSubTypeName(int t)
 
 #define MAXSTR (127*6)
 void
-prdevd(usb_device_descriptor_t *d)
+prdevd(struct usbdev *ud, usb_device_descriptor_t *d)
 {
 	char man[MAXSTR], prod[MAXSTR], ser[MAXSTR];
-	getstring(d->iManufacturer, man);
-	getstring(d->iProduct, prod);
-	getstring(d->iSerialNumber, ser);
-	if (d->bDescriptorType != UDESC_DEVICE) printf("weird descriptorType, should be %d\n", UDESC_DEVICE);
-	printf("\
+	getstring(ud, d->iManufacturer, man);
+	getstring(ud, d->iProduct, prod);
+	getstring(ud, d->iSerialNumber, ser);
+	if (d->bDescriptorType != UDESC_DEVICE) fprintf(ud->out, "weird descriptorType, should be %d\n", UDESC_DEVICE);
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bcdUSB=%x.%02x bDeviceClass=%d bDeviceSubClass=%d\n\
 bDeviceProtocol=%d bMaxPacketSize=%d idVendor=0x%04x idProduct=0x%04x bcdDevice=%x\n\
 iManufacturer=%d(%s) iProduct=%d(%s) iSerialNumber=%d(%s) bNumConfigurations=%d\n",
@@ -246,13 +525,23 @@ iManufacturer=%d(%s) iProduct=%d(%s) iSerialNumber=%d(%s) bNumConfigurations=%d\
 	       d->bNumConfigurations);
 }
 
+/* A string for the configuration text, read already by prconfig. */
+void
+getcstring(struct usbdev *ud, int si, char *s)
+{
+	if (ud->cstr != NULL && ud->cstr[si] != NULL)
+		strcpy(s, ud->cstr[si]);
+	else
+		getstring(ud, si, s);
+}
+
 void
-prconfd(usb_config_descriptor_t *d)
+prconfd(struct usbdev *ud, usb_config_descriptor_t *d)
 {
 	char conf[MAXSTR];
-	getstring(d->iConfiguration, conf);
-	if (d->bDescriptorType != UDESC_CONFIG) printf("weird descriptorType, should be %d\n", UDESC_CONFIG);
-	printf("\
+	getcstring(ud, d->iConfiguration, conf);
+	if (d->bDescriptorType != UDESC_CONFIG) fprintf(ud->out, "weird descriptorType, should be %d\n", UDESC_CONFIG);
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s wTotalLength=%d bNumInterface=%d\n\
 bConfigurationValue=%d iConfiguration=%d(%s) bmAttributes=%x bMaxPower=%d mA\n",
 	       d->bLength, descTypeName(d->bDescriptorType), 
@@ -263,12 +552,12 @@ bConfigurationValue=%d iConfiguration=%d(%s) bmAttributes=%x bMaxPower=%d mA\n",
 }
 
 void
-prifcd(usb_interface_descriptor_t *d)
+prifcd(struct usbdev *ud, usb_interface_descriptor_t *d)
 {
 	char ifc[MAXSTR];
-	getstring(d->iInterface, ifc);
-	if (d->bDescriptorType != UDESC_INTERFACE) printf("weird descriptorType, should be %d\n", UDESC_INTERFACE);
-	printf("\
+	getcstring(ud, d->iInterface, ifc);
+	if (d->bDescriptorType != UDESC_INTERFACE) fprintf(ud->out, "weird descriptorType, should be %d\n", UDESC_INTERFACE);
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bInterfaceNumber=%d bAlternateSetting=%d\n\
 bNumEndpoints=%d bInterfaceClass=%d bInterfaceSubClass=%d\n\
 bInterfaceProtocol=%d iInterface=%d(%s)\n",
@@ -282,10 +571,10 @@ char *xfernames[] = { "control", "isochronous", "bulk", "interrupt" };
 char *xfertypes[] = { "", "-async", "-adaptive", "-sync" };
 
 void
-prendpd(usb_endpoint_descriptor_t *d)
+prendpd(struct usbdev *ud, usb_endpoint_descriptor_t *d)
 {
-	if (d->bDescriptorType != UDESC_ENDPOINT) printf("weird descriptorType, should be %d\n", UDESC_ENDPOINT);
-	printf("\
+	if (d->bDescriptorType != UDESC_ENDPOINT) fprintf(ud->out, "weird descriptorType, should be %d\n", UDESC_ENDPOINT);
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bEndpointAddress=%d-%s\n\
 bmAttributes=%s%s wMaxPacketSize=%d bInterval=%d\n",
 	       d->bLength, descTypeName(d->bDescriptorType),
@@ -297,10 +586,10 @@ bmAttributes=%s%s wMaxPacketSize=%d bInterval=%d\n",
 }
 
 void
-prhubd(usb_hub_descriptor_t *d)
+prhubd(struct usbdev *ud, usb_hub_descriptor_t *d)
 {
-	if (d->bDescriptorType != UDESC_HUB) printf("weird descriptorType, should be %d\n", UDESC_HUB);
-	printf("\
+	if (d->bDescriptorType != UDESC_HUB) fprintf(ud->out, "weird descriptorType, should be %d\n", UDESC_HUB);
+	fprintf(ud->out, "\
 bDescLength=%d bDescriptorType=%s bNbrPorts=%d wHubCharacteristics=%02x\n\
 bPwrOn2PwrGood=%d bHubContrCurrent=%d DeviceRemovable=%x\n",
 	       d->bDescLength, descTypeName(d->bDescriptorType), d->bNbrPorts,
@@ -309,18 +598,18 @@ bPwrOn2PwrGood=%d bHubContrCurrent=%d DeviceRemovable=%x\n",
 }
 
 void
-prhidd(usb_hid_descriptor_t *d)
+prhidd(struct usbdev *ud, usb_hid_descriptor_t *d)
 {
 	int i;
 
-	printf("\
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bcdHID=%x.%02x bCountryCode=%d bNumDescriptors=%d\n",
 	       d->bLength, descTypeName(d->bDescriptorType), 
 	       UGETW(d->bcdHID) >> 8,
 	       UGETW(d->bcdHID) & 0xff, d->bCountryCode,
 	       d->bNumDescriptors);
 	for(i = 0; i < d->bNumDescriptors; i++) {
-		printf("bDescriptorType[%d]=%s, wDescriptorLength[%d]=%d\n",
+		fprintf(ud->out, "bDescriptorType[%d]=%s, wDescriptorLength[%d]=%d\n",
 		       i, descTypeName(d->descrs[i].bDescriptorType),
 		       i, UGETW(d->descrs[i].wDescriptorLength));
 	}
@@ -340,7 +629,7 @@ bLength=%d bDescriptorType=%s bcdHID=%x.%02x bCountryCode=%d bNumDescriptors=%d\
 char *
 descCDCSubtypeName(int s)
 {
-	static char buf[20];
+	static __thread char buf[20];
 
 	switch (s) {
 	case UDESCSUB_CDC_HEADER: return "header";
@@ -384,16 +673,16 @@ struct usb_cdc_union_descriptor {
 };
 
 void
-prcdcd(usb_descriptor_t *ud)
+prcdcd(struct usbdev *ud, usb_descriptor_t *desc)
 {
-	if (ud->bDescriptorType != UDESC_CS_INTERFACE)
-		printf("prcdcd: strange bDescriptorType=%d\n", 
-		       ud->bDescriptorType);
-	switch (ud->bDescriptorSubtype) {
+	if (desc->bDescriptorType != UDESC_CS_INTERFACE)
+		fprintf(ud->out, "prcdcd: strange bDescriptorType=%d\n", 
+		       desc->bDescriptorType);
+	switch (desc->bDescriptorSubtype) {
 	case UDESCSUB_CDC_HEADER:
 	{
-		struct usb_cdc_header_descriptor *d = (void *)ud;
-		printf("\
+		struct usb_cdc_header_descriptor *d = (void *)desc;
+		fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bcdCDC=%x.%02x\n",
 		       d->bLength, 
@@ -405,8 +694,8 @@ bcdCDC=%x.%02x\n",
 	}
 	case UDESCSUB_CDC_CM:
 	{
-		struct usb_cdc_cm_descriptor *d = (void *)ud;
-		printf("\
+		struct usb_cdc_cm_descriptor *d = (void *)desc;
+		fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bmCapabilities=0x%x bDataInterface=%d\n",
 		       d->bLength, 
@@ -418,8 +707,8 @@ bmCapabilities=0x%x bDataInterface=%d\n",
 	}
 	case UDESCSUB_CDC_ACM:
 	{
-		struct usb_cdc_acm_descriptor *d = (void *)ud;
-		printf("\
+		struct usb_cdc_acm_descriptor *d = (void *)desc;
+		fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bmCapabilities=0x%x\n",
 		       d->bLength, 
@@ -430,9 +719,9 @@ bmCapabilities=0x%x\n",
 	}
 	case UDESCSUB_CDC_UNION:
 	{
-		struct usb_cdc_union_descriptor *d = (void *)ud;
+		struct usb_cdc_union_descriptor *d = (void *)desc;
 		int i;
-		printf("\
+		fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bMasterInterface=%d",
 		       d->bLength, 
@@ -440,213 +729,328 @@ bMasterInterface=%d",
 		       descCDCSubtypeName(d->bDescriptorSubtype), 
 		       d->bMasterInterface);
 		for (i = 0; i < d->bLength - 4; i++)
-			printf(" bSlaveInterface%d=%d", 
+			fprintf(ud->out, " bSlaveInterface%d=%d", 
 			       i, d->bSlaveInterface[i]);
-		printf("\n");
+		fprintf(ud->out, "\n");
 		break;
 	}
 	default:
-		printf("prcdcd: unknown bDescriptorSubtype=%d\n",
-		       ud->bDescriptorSubtype);
+		fprintf(ud->out, "prcdcd: unknown bDescriptorSubtype=%d\n",
+		       desc->bDescriptorSubtype);
 		break;
 	}
 }
 
 void
-prbits(int bits, char **strs, int n)
+prbits(struct usbdev *ud, int bits, char **strs, int n)
 {
 	int i;
 
 	for(i = 0; i < n; i++, bits >>= 1)
 		if (strs[i*2])
-			printf("%s%s", i == 0 ? "" : ", ", strs[i*2 + (bits&1)]);
+			fprintf(ud->out, "%s%s", i == 0 ? "" : ", ", strs[i*2 + (bits&1)]);
 }
 
+char *hidgstr[] = {
+	"Usage Page", 
+	"Logical Min", "Logical Max",
+	"Physical Min", "Physical Max",
+	"Unit Exponent", "Unit",
+	"Report size", "Report ID", 
+	"Report count", 
+	"Push", "Pop", 
+	"??12", "??13", "??14", "??15"
+};
+char *hidlstr[] = {
+	"Usage",
+	"Usage Min", "Usage Max",
+	"Designator index",
+	"Designator Min", "Designator Max",
+	"??6", "String index",
+	"String Min", "String Max",
+	"Set delimiter",
+	"??11", "??12", "??13", "??14", "??15"
+};
+char *hidinputbits[] = {
+	"Data", "Constant",
+	"Array", "Variable",
+	"Absolute", "Relative",
+	"No wrap", "Wrap",
+	"Linear", "Non linear",
+	"Preferred state", "No Preferred",
+	"No null position", "Null position",
+	0, 0,
+	"Bit field", "Bufferred bytes"
+};
+char *hidoutputbits[] = {
+	"Data", "Constant",
+	"Array", "Variable",
+	"Absolute", "Relative",
+	"No wrap", "Wrap",
+	"Linear", "Non linear",
+	"Preferred state", "No Preferred",
+	"No null position", "Null position",
+	"Non volatile", "Volatile",
+	"Bit field", "Bufferred bytes"
+};
+char *hidcolls[] = {
+	"Physical", "Application", "Logical"
+};
+
+/*
+ * Report descriptor printer.  The state lives in a struct repparse
+ * so a descriptor can be printed a chunk at a time as it comes in.
+ */
+struct repparse {
+	struct hidstream rp_hs;
+	int	rp_ind;
+};
+
 void
-prreportd(u_char *d, int len)
+prreport_feed(struct usbdev *ud, struct repparse *rp, const u_char *d, int len)
 {
-	int ind;
-	u_char *p;
+	const u_char *p;
+	struct hiditem it;
 
 #if 0
 	for(i = 0; i < len; i++)
-		printf("%02x ", d[i]);
-	printf("\n");
+		fprintf(ud->out, "%02x ", d[i]);
+	fprintf(ud->out, "\n");
 #endif
 
-	ind = 0;
-	for(p = d; p < d + len;) {
+	for(p = d; hid_feed(&rp->rp_hs, &p, d + len, &it) == 0;) {
 		int bTag, bType, bSize;
-		u_char *data;
 		long dval;
-		static char *gstr[] = {
-			"Usage Page", 
-			"Logical Min", "Logical Max",
-			"Physical Min", "Physical Max",
-			"Unit Exponent", "Unit",
-			"Report size", "Report ID", 
-			"Report count", 
-			"Push", "Pop", 
-			"??12", "??13", "??14", "??15"};
-		static char *lstr[] = {
-			"Usage",
-			"Usage Min", "Usage Max",
-			"Designator index",
-			"Designator Min", "Designator Max",
-			"??6", "String index",
-			"String Min", "String Max",
-			"Set delimiter",
-			"??11", "??12", "??13", "??14", "??15"
-		};
-		static char *inputbits[] = {
-			"Data", "Constant",
-			"Array", "Variable",
-			"Absolute", "Relative",
-			"No wrap", "Wrap",
-			"Linear", "Non linear",
-			"Preferred state", "No Preferred",
-			"No null position", "Null position",
-			0, 0,
-			"Bit field", "Bufferred bytes"
-		};
-		static char *outputbits[] = {
-			"Data", "Constant",
-			"Array", "Variable",
-			"Absolute", "Relative",
-			"No wrap", "Wrap",
-			"Linear", "Non linear",
-			"Preferred state", "No Preferred",
-			"No null position", "Null position",
-			"Non volatile", "Volatile",
-			"Bit field", "Bufferred bytes"
-		};
-		static char *colls[] = {
-			"Physical", "Application", "Logical"
-		};
-
-		/*printf("pos = %d\n", p - d);*/
-		bSize = *p++;
-		if (bSize == 0xfe) {
-			/* long item */
-			bSize = *p++;
-			bSize |= *p++ << 8;
-			bTag = *p++;
-			data = p;
-			p += bSize;
-		} else {
-			/* short item */
-			bTag = bSize >> 4;
-			bType = (bSize >> 2) & 3;
-			bSize &= 3;
-			if (bSize == 3) bSize = 4;
-			data = p;
-			p += bSize;
-		}
+
+		/*fprintf(ud->out, "pos = %d\n", p - d);*/
+		bTag = it.hi_tag;
+		bType = it.hi_type;
+		bSize = it.hi_size;
 		switch(bSize) {
 		case 0:
-			dval = 0;
-			break;
 		case 1:
-			dval = *data++;
-			break;
 		case 2:
-			dval = *data++;
-			dval |= *data++ << 8;
-			dval = dval;
+			dval = it.hi_uval;
 			break;
 		case 4:
-			dval = *data++;
-			dval |= *data++ << 8;
-			dval |= *data++ << 16;
-			dval |= *data++ << 24;
+			dval = it.hi_sval;
 			break;
 		default:
-			printf("BAD LENGTH %d\n", bSize);
+			fprintf(ud->out, "BAD LENGTH %d\n", bSize);
+			dval = 0;
 			break;
 		}
-#define INDENT printf("%*s", ind * 3, "")
+#define INDENT fprintf(ud->out, "%*s", rp->rp_ind * 3, "")
 		switch (bType) {
 		case 0:		/* Main */
 			switch (bTag) {
 			case 8:
 				INDENT;
-				printf("Input (");
-				prbits(dval, inputbits, 9);
-				printf(")\n");
+				fprintf(ud->out, "Input (");
+				prbits(ud, dval, hidinputbits, 9);
+				fprintf(ud->out, ")\n");
 				break;
 			case 9:
 				INDENT;
-				printf("Output (");
-				prbits(dval, outputbits, 9);
-				printf(")\n");
+				fprintf(ud->out, "Output (");
+				prbits(ud, dval, hidoutputbits, 9);
+				fprintf(ud->out, ")\n");
 				break;
 			case 10:
 				INDENT;
 				if (dval >= 0 && dval <= 2)
-					printf("Collection (%s)\n", colls[dval]);
+					fprintf(ud->out, "Collection (%s)\n", hidcolls[dval]);
 				else
-					printf("Collection (%ld)\n", dval);
-				ind++;
+					fprintf(ud->out, "Collection (%ld)\n", dval);
+				rp->rp_ind++;
 				break;
 			case 11:
 				INDENT;
-				printf("Feature (");
-				prbits(dval, outputbits, 9);
-				printf(")\n");
+				fprintf(ud->out, "Feature (");
+				prbits(ud, dval, hidoutputbits, 9);
+				fprintf(ud->out, ")\n");
 				break;
 			case 12:
-				ind--;
+				rp->rp_ind--;
 				INDENT;
-				printf("End Collection\n");
+				fprintf(ud->out, "End Collection\n");
 				break;
 			default:
 				INDENT;
-				printf("??Main bType=%d\n", bTag);
+				fprintf(ud->out, "??Main bType=%d\n", bTag);
 				break;
 			}
 			break;
 		case 1:		/* Global */
 			INDENT;
-			printf("%s(%ld)\n", gstr[bTag], dval);
+			fprintf(ud->out, "%s(%ld)\n", hidgstr[bTag], dval);
 			break;
 		case 2:		/* Local */
 			INDENT;
-			printf("%s(%ld)\n", lstr[bTag], dval);
+			fprintf(ud->out, "%s(%ld)\n", hidlstr[bTag], dval);
 			break;
 		default:
 			INDENT;
-			printf("default\n");
+			fprintf(ud->out, "default\n");
 			break;
 		}
 	}
 }
 
+/*
+ * Text of configurations and report descriptors, interned by content
+ * so that identical devices are formatted once.  A key is a tag byte
+ * and whatever the text depends on; entries live as long as we do.
+ */
+#define NINTERN		256
+
+struct intern {
+	u_int64_t	in_hash;
+	u_char		*in_key;
+	size_t		in_klen;
+	char		*in_text;
+	size_t		in_tlen;
+	int		in_unknown;	/* counted while formatting */
+	struct intern	*in_next;
+};
+
+struct intern *interns[NINTERN];
+pthread_mutex_t internlock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Text being formatted, between intern_begin and intern_end. */
+struct internbuf {
+	FILE		*ib_out;	/* where it goes in the end */
+	char		*ib_text;
+	size_t		ib_tlen;
+	int		ib_unknown;	/* ud->unknown at the start */
+};
+
+/* Write out the text for key; 0 if there is none yet. */
+int
+intern_write(struct usbdev *ud, const void *key, size_t klen)
+{
+	struct intern *in;
+	u_int64_t h = strhash(key, klen);
+
+	pthread_mutex_lock(&internlock);
+	for (in = interns[h % NINTERN]; in; in = in->in_next)
+		if (in->in_hash == h && in->in_klen == klen &&
+		    memcmp(in->in_key, key, klen) == 0)
+			break;
+	pthread_mutex_unlock(&internlock);
+	if (in == NULL)
+		return 0;
+	fwrite(in->in_text, 1, in->in_tlen, ud->out);
+	ud->unknown += in->in_unknown;
+	return 1;
+}
+
+/* Keep text, which is malloc'ed, as the text for key. */
+void
+intern_put(const void *key, size_t klen, char *text, size_t tlen, int unknown)
+{
+	struct intern *in;
+
+	if ((in = malloc(sizeof *in)) == NULL ||
+	    (in->in_key = malloc(klen)) == NULL)
+		err(1, "malloc");
+	in->in_hash = strhash(key, klen);
+	memcpy(in->in_key, key, klen);
+	in->in_klen = klen;
+	in->in_text = text;
+	in->in_tlen = tlen;
+	in->in_unknown = unknown;
+	pthread_mutex_lock(&internlock);
+	in->in_next = interns[in->in_hash % NINTERN];
+	interns[in->in_hash % NINTERN] = in;
+	pthread_mutex_unlock(&internlock);
+}
+
+/*
+ * Format into memory between these two; intern_end writes the text
+ * out and keeps it, unless something failed on the way.
+ */
+void
+intern_begin(struct usbdev *ud, struct internbuf *ib)
+{
+	ib->ib_out = ud->out;
+	ib->ib_unknown = ud->unknown;
+	if ((ud->out = open_memstream(&ib->ib_text, &ib->ib_tlen)) == NULL)
+		err(1, "open_memstream");
+}
+
+void
+intern_end(struct usbdev *ud, struct internbuf *ib, const void *key,
+	   size_t klen)
+{
+	if (fclose(ud->out) == EOF)
+		err(1, "open_memstream");
+	ud->out = ib->ib_out;
+	fwrite(ib->ib_text, 1, ib->ib_tlen, ud->out);
+	if (ud->error == 0)
+		intern_put(key, klen, ib->ib_text, ib->ib_tlen,
+		    ud->unknown - ib->ib_unknown);
+	else
+		free(ib->ib_text);
+}
+
 void
-gethubdesc(int f, usb_hub_descriptor_t *d, int addr)
+prreportd(struct usbdev *ud, u_char *d, int len)
+{
+	struct repparse rp;
+	struct internbuf ib;
+	u_char *key;
+
+	key = aalloc(&ud->arena, len + 1);
+	key[0] = 'R';
+	memcpy(key + 1, d, len);
+	if (intern_write(ud, key, len + 1))
+		return;
+	intern_begin(ud, &ib);
+	memset(&rp, 0, sizeof rp);
+	prreport_feed(ud, &rp, d, len);
+	if (rp.rp_hs.hs_have)
+		fprintf(ud->out, "Truncated item\n");
+	intern_end(ud, &ib, key, len + 1);
+}
+
+/*
+ * The get* functions return 0, or -1 after noting the failure with
+ * devfail.  A hub descriptor fails with EOPNOTSUPP on a bus that
+ * cannot ask (sysfs only), and the hub is dumped like any other
+ * device.  gethubdesc returns the number of bytes it got instead;
+ * the rest of *d is zeroed.
+ */
+int
+gethubdesc(struct usbdev *ud, usb_hub_descriptor_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	memset(d, 0, sizeof *d);
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_CLASS_DEVICE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
 	USETW(req.ucr_request.wValue, 0);
 	USETW(req.ucr_request.wIndex, 0);
-	USETW(req.ucr_request.wLength, USB_HUB_DESCRIPTOR_SIZE);
+	USETW(req.ucr_request.wLength, sizeof *d);
 	req.ucr_data = d;
-	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
-	if (r < 0)
-		err(1, "USB_REQUEST");
+	req.ucr_flags = USBD_SHORT_XFER_OK;
+	r = ctlrequest(ud, &req);
+	if (r < 0) {
+		devfail(ud, "hub descriptor");
+		return r;
+	}
+	return req.ucr_actlen;
 }
 
-void
-getdevicedesc(int f, usb_device_descriptor_t *d, int addr)
+int
+getdevicedesc(struct usbdev *ud, usb_device_descriptor_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_DEVICE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
 	USETW2(req.ucr_request.wValue, UDESC_DEVICE, 0);
@@ -654,47 +1058,80 @@ getdevicedesc(int f, usb_device_descriptor_t *d, int addr)
 	USETW(req.ucr_request.wLength, USB_DEVICE_DESCRIPTOR_SIZE);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "device descriptor");
+	return r;
 }
 
-void
-getconfigdesc(int f, int i, usb_config_descriptor_t *d, int size, int addr)
+/*
+ * Fetch configuration descriptor i with all its interface, endpoint
+ * and class descriptors.  The first request asks for CONFIG_SPECULATE
+ * bytes with a short transfer allowed, which gets the whole thing in
+ * one go for almost every device; only when wTotalLength turns out to
+ * be larger is a second request made.  Devices that refuse the big
+ * request get the old header-then-body sequence.  The buffer comes
+ * from the device's arena and is returned with its valid length, or
+ * NULL if it could not be read.
+ */
+#define CONFIG_SPECULATE 1024
+
+usb_config_descriptor_t *
+getconfigdesc(struct usbdev *ud, int i, int *lenp)
 {
 	struct usb_ctl_request req;
-	int r;
+	usb_config_descriptor_t *d;
+	int r, len;
 
-	req.ucr_addr = addr;
+	d = aalloc(&ud->arena, CONFIG_SPECULATE);
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_DEVICE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
 	USETW2(req.ucr_request.wValue, UDESC_CONFIG, i);
 	USETW(req.ucr_request.wIndex, 0);
-	USETW(req.ucr_request.wLength, USB_CONFIG_DESCRIPTOR_SIZE);
+	USETW(req.ucr_request.wLength, CONFIG_SPECULATE);
 	req.ucr_data = d;
-	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
-	if (r < 0)
-		err(1, "USB_REQUEST");
-	req.ucr_addr = addr;
-	req.ucr_request.bmRequestType = UT_READ_DEVICE;
-	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
-	USETW2(req.ucr_request.wValue, UDESC_CONFIG, i);
-	USETW(req.ucr_request.wIndex, 0);
-	USETW(req.ucr_request.wLength, UGETW(d->wTotalLength));
+	req.ucr_flags = USBD_SHORT_XFER_OK;
+	r = ctlrequest(ud, &req);
+	if (r < 0 || req.ucr_actlen < USB_CONFIG_DESCRIPTOR_SIZE) {
+		USETW(req.ucr_request.wLength, USB_CONFIG_DESCRIPTOR_SIZE);
+		req.ucr_flags = 0;
+		r = ctlrequest(ud, &req);
+		if (r < 0)
+			goto fail;
+		req.ucr_actlen = USB_CONFIG_DESCRIPTOR_SIZE;
+	}
+	len = UGETW(d->wTotalLength);
+	if (len <= req.ucr_actlen) {
+		atrim(&ud->arena, d, len);
+		*lenp = len;
+		return d;
+	}
+
+	atrim(&ud->arena, d, 0);
+	d = aalloc(&ud->arena, len);
+	USETW(req.ucr_request.wLength, len);
 	req.ucr_data = d;
-	r = ioctl(f, USB_REQUEST, &req);
+	req.ucr_flags = USBD_SHORT_XFER_OK;
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		goto fail;
+	if (req.ucr_actlen < len)
+		len = req.ucr_actlen;
+	*lenp = len;
+	return d;
+ fail:
+	devfail(ud, "configuration %d", i);
+	return NULL;
 }
 
-void
-gethiddesc(int f, int i, usb_hid_descriptor_t *d, int size, int addr)
+int
+gethiddesc(struct usbdev *ud, int i, usb_hid_descriptor_t *d, int size)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_INTERFACE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
 	USETW2(req.ucr_request.wValue, UDESC_HID, 0);
@@ -702,18 +1139,19 @@ gethiddesc(int f, int i, usb_hid_descriptor_t *d, int size, int addr)
 	USETW(req.ucr_request.wLength, size);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "HID descriptor %d", i);
+	return r;
 }
 
-void
-getreportdesc(int f, int ifc, int no, char *d, int size, int addr)
+int
+getreportdesc(struct usbdev *ud, int ifc, int no, u_char *d, int size)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_INTERFACE;
 	req.ucr_request.bRequest = UR_GET_DESCRIPTOR;
 	USETW2(req.ucr_request.wValue, UDESC_REPORT, no);
@@ -721,18 +1159,19 @@ getreportdesc(int f, int ifc, int no, char *d, int size, int addr)
 	USETW(req.ucr_request.wLength, size);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "report descriptor %d", ifc);
+	return r;
 }
 
-void
-getportstatus(int f, int i, usb_port_status_t *d, int addr)
+int
+getportstatus(struct usbdev *ud, int i, usb_port_status_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_CLASS_OTHER;
 	req.ucr_request.bRequest = UR_GET_STATUS;
 	USETW(req.ucr_request.wValue, 0);
@@ -740,18 +1179,19 @@ getportstatus(int f, int i, usb_port_status_t *d, int addr)
 	USETW(req.ucr_request.wLength, 4);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "port %d status", i);
+	return r;
 }
 
-void
-gethubstatus(int f, usb_hub_status_t *d, int addr)
+int
+gethubstatus(struct usbdev *ud, usb_hub_status_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_CLASS_DEVICE;
 	req.ucr_request.bRequest = UR_GET_STATUS;
 	USETW(req.ucr_request.wValue, 0);
@@ -759,18 +1199,19 @@ gethubstatus(int f, usb_hub_status_t *d, int addr)
 	USETW(req.ucr_request.wLength, 4);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "hub status");
+	return r;
 }
 
-void
-getconfiguration(int f, u_int8_t *d, int addr)
+int
+getconfiguration(struct usbdev *ud, u_int8_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_DEVICE;
 	req.ucr_request.bRequest = UR_GET_CONFIG;
 	USETW(req.ucr_request.wValue, 0);
@@ -778,18 +1219,39 @@ getconfiguration(int f, u_int8_t *d, int addr)
 	USETW(req.ucr_request.wLength, 1);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "current configuration");
+	return r;
 }
 
-void
-getdevicestatus(int f, usb_status_t *d, int addr)
+int
+getinterface(struct usbdev *ud, int ifc, u_int8_t *d)
+{
+	struct usb_ctl_request req;
+	int r;
+
+	req.ucr_addr = ud->addr;
+	req.ucr_request.bmRequestType = UT_READ_INTERFACE;
+	req.ucr_request.bRequest = UR_GET_INTERFACE;
+	USETW(req.ucr_request.wValue, 0);
+	USETW(req.ucr_request.wIndex, ifc);
+	USETW(req.ucr_request.wLength, 1);
+	req.ucr_data = d;
+	req.ucr_flags = 0;
+	r = ctlrequest(ud, &req);
+	if (r < 0)
+		devfail(ud, "alternate setting of interface %d", ifc);
+	return r;
+}
+
+int
+getdevicestatus(struct usbdev *ud, usb_status_t *d)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_DEVICE;
 	req.ucr_request.bRequest = UR_GET_STATUS;
 	USETW(req.ucr_request.wValue, 0);
@@ -797,18 +1259,19 @@ getdevicestatus(int f, usb_status_t *d, int addr)
 	USETW(req.ucr_request.wLength, 2);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "device status");
+	return r;
 }
 
-void
-getinterfacestatus(int f, usb_status_t *d, int addr, int ifc)
+int
+getinterfacestatus(struct usbdev *ud, usb_status_t *d, int ifc)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_INTERFACE;
 	req.ucr_request.bRequest = UR_GET_STATUS;
 	USETW(req.ucr_request.wValue, 0);
@@ -816,18 +1279,19 @@ getinterfacestatus(int f, usb_status_t *d, int addr, int ifc)
 	USETW(req.ucr_request.wLength, 2);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "interface %d status", ifc);
+	return r;
 }
 
-void
-getendpointstatus(int f, usb_status_t *d, int addr, int endp)
+int
+getendpointstatus(struct usbdev *ud, usb_status_t *d, int endp)
 {
 	struct usb_ctl_request req;
 	int r;
 
-	req.ucr_addr = addr;
+	req.ucr_addr = ud->addr;
 	req.ucr_request.bmRequestType = UT_READ_ENDPOINT;
 	req.ucr_request.bRequest = UR_GET_STATUS;
 	USETW(req.ucr_request.wValue, 0);
@@ -835,9 +1299,10 @@ getendpointstatus(int f, usb_status_t *d, int addr, int endp)
 	USETW(req.ucr_request.wLength, 2);
 	req.ucr_data = d;
 	req.ucr_flags = 0;
-	r = ioctl(f, USB_REQUEST, &req);
+	r = ctlrequest(ud, &req);
 	if (r < 0)
-		err(1, "USB_REQUEST");
+		devfail(ud, "endpoint %d status", endp);
+	return r;
 }
 
 void
@@ -845,7 +1310,16 @@ usage(void)
 {
 	extern char *__progname;
 
-	fprintf(stderr, "Usage: %s [-a addr] [-f device] [-d]\n", __progname);
+	fprintf(stderr, "Usage: %s [-a addr] [-C cachefile] [-f device] [-d] [-j jobs]\n"
+		"       [-o text|json|bin] [-P depth] [-t] [-T tracefile] [-v]\n"
+		"       [-M interval] [-S snapshot [-D]] [-W budget] [-w timeout]\n"
+		"       %s -L socket [-f device] [-C cachefile] [-M interval] [-v]\n"
+		"       %s -c socket [-a addr] [-o text|json|bin] [-s index]\n"
+		"       %s -B path [-j jobs] [-o text|json|bin]\n"
+		"       %s [-f device] [-j jobs] [-o text|json] -q query [-F fields]\n"
+		"       %s -b [-f device] [-W budget] [-w timeout]\n",
+		__progname, __progname, __progname, __progname, __progname,
+		__progname);
 	exit(1);
 }
 
@@ -951,11 +1425,11 @@ struct usb_audio_extension_unit {
 };
 
 void
-pracdesc(struct usb_audio_control_descriptor *d)
+pracdesc(struct usbdev *ud, struct usb_audio_control_descriptor *d)
 {
 	int i;
 
-	printf("\
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s bcdADC=%x.%02x\n\
 wTotalLength=%d bInCollection=%x\n",
 	       d->bLength, descTypeName(d->bDescriptorType), 
@@ -963,13 +1437,13 @@ wTotalLength=%d bInCollection=%x\n",
 	       UGETW(d->bcdADC) >> 8, UGETW(d->bcdADC) & 0xff,
 	       UGETW(d->wTotalLength), d->bInCollection);
 	for (i = 0; i < d->bLength - 8; i++)
-		printf("baInterfaceNr[%d]=%d\n", i, d->baInterfaceNr[i]);
+		fprintf(ud->out, "baInterfaceNr[%d]=%d\n", i, d->baInterfaceNr[i]);
 }
 
 void
-prasigd(struct usb_audio_streaming_interface_descriptor *d)
+prasigd(struct usbdev *ud, struct usb_audio_streaming_interface_descriptor *d)
 {
-	printf("\
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bTerminalLink=%d bDelay=%d wFormatTag=%d\n",
 	       d->bLength, descTypeName(d->bDescriptorType),
@@ -979,9 +1453,9 @@ bTerminalLink=%d bDelay=%d wFormatTag=%d\n",
 }
 
 void
-prasiepd(struct usb_audio_streaming_endpoint_descriptor *d)
+prasiepd(struct usbdev *ud, struct usb_audio_streaming_endpoint_descriptor *d)
 {
-	printf("\
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s bmAttributes=%x\n\
 bLockDelayUnits=%d wLockDelay=%d\n",
 	       d->bLength, descTypeName(d->bDescriptorType),
@@ -992,12 +1466,12 @@ bLockDelayUnits=%d wLockDelay=%d\n",
 
 
 void
-prast1d(struct usb_audio_streaming_type1_descriptor *d)
+prast1d(struct usbdev *ud, struct usb_audio_streaming_type1_descriptor *d)
 {
 	int i, f;
 	u_char *p;
 
-	printf("\
+	fprintf(ud->out, "\
 bLength=%d bDescriptorType=%s bDescriptorSubtype=%s\n\
 bFormatType=%d bNrChannels=%d bSubFrameSize=%d\n\
 bBitResolution=%d bSamFreqType=%d\n",
@@ -1009,19 +1483,19 @@ bBitResolution=%d bSamFreqType=%d\n",
 #define GETSAMP(f,p) f = p[0] | (p[1] << 8) | (p[2] << 16), p+=3
 	if (d->bSamFreqType == 0) {
 		GETSAMP(f, p);
-		printf("tSampLo=%d\n", f);
+		fprintf(ud->out, "tSampLo=%d\n", f);
 		GETSAMP(f, p);
-		printf("tSampHi=%d\n", f);
+		fprintf(ud->out, "tSampHi=%d\n", f);
 	} else {
 		for (i = 0; i < d->bSamFreqType; i++) {
 			GETSAMP(f, p);
-			printf("tSamFreq[%d]=%d\n", i, f);
+			fprintf(ud->out, "tSamFreq[%d]=%d\n", i, f);
 		}
 	}
 }
 
 void
-pratd(struct usb_audio_descriptor *d)
+pratd(struct usbdev *ud, struct usb_audio_descriptor *d)
 {
 	struct usb_audio_input_terminal *it;
 	struct usb_audio_output_terminal *ot;
@@ -1036,8 +1510,8 @@ bLength=%d bDescriptorType=%s bDescriptorSubtype=%d\n",
 	switch (d->bDescriptorSubtype) {
 	case UDESCSUB_AC_INPUT:
 		it = (void *)d;
-		printf("Input terminal descriptor\n%s", msg);
-		printf("\
+		fprintf(ud->out, "Input terminal descriptor\n%s", msg);
+		fprintf(ud->out, "\
 bTerminalId=%d wTerminalType=%d bAssocTerminal=%d\n\
 bNrChannels=%d wChannelConfig=%04x\n\
 iChannelNames=%d iTerminal=%d\n",
@@ -1048,8 +1522,8 @@ iChannelNames=%d iTerminal=%d\n",
 		break;
 	case UDESCSUB_AC_OUTPUT:
 		ot = (void *)d;
-		printf("Output terminal descriptor\n%s", msg);
-		printf("\
+		fprintf(ud->out, "Output terminal descriptor\n%s", msg);
+		fprintf(ud->out, "\
 bTerminalId=%d wTerminalType=%d bAssocTerminal=%d\n\
 bSourceId=%d iTerminal=%d\n",
 		       ot->bTerminalId, UGETW(ot->wTerminalType),
@@ -1058,60 +1532,58 @@ bSourceId=%d iTerminal=%d\n",
 		break;
 	case UDESCSUB_AC_MIXER:
 		mu = (void *)d;
-		printf("Mixer unit descriptor\n%s", msg);
-		printf("bUnitId=%d bNrInPins=%d\n",
+		fprintf(ud->out, "Mixer unit descriptor\n%s", msg);
+		fprintf(ud->out, "bUnitId=%d bNrInPins=%d\n",
 		       mu->bUnitId, mu->bNrInPins);
 		{
 			u_char *src = mu->baSourceID;
 			int i;
-			printf("baSourceID=");
+			fprintf(ud->out, "baSourceID=");
 			for (i = 0; i < mu->bNrInPins; i++)
-				printf(" %d", src[i]);
-			printf("\n");
+				fprintf(ud->out, " %d", src[i]);
+			fprintf(ud->out, "\n");
 		}
 		break;
 	case UDESCSUB_AC_FEATURE:
 		fu = (void *)d;
-		printf("Feature unit descriptor\n%s", msg);
-		printf("bUnitId=%d bSourceId=%d bControlSize=%d\n",
+		fprintf(ud->out, "Feature unit descriptor\n%s", msg);
+		fprintf(ud->out, "bUnitId=%d bSourceId=%d bControlSize=%d\n",
 		       fu->bUnitId, fu->bSourceId, fu->bControlSize);
 		{
 			u_char *ctl = fu->bmaControls;
 			int i, j, s;
 			s = (fu->bLength - 6) / fu->bControlSize;
 			for (i = 0; i < s; i++) {
-				printf("bmaControls[%d]=", i);
+				fprintf(ud->out, "bmaControls[%d]=", i);
 				for (j = 0; j < fu->bControlSize; j++)
-					printf("%02x", ctl[fu->bControlSize-j-1]);
+					fprintf(ud->out, "%02x", ctl[fu->bControlSize-j-1]);
 				ctl += fu->bControlSize;
-				printf("\n");
+				fprintf(ud->out, "\n");
 			}
 		}
 		break;
 	case UDESCSUB_AC_EXTENSION:
 		eu = (void *)d;
-		printf("Extension unit descriptor\n%s", msg);
-		printf("bUnitId=%d bNrInPins=%d wExtensionCode=%d\n",
+		fprintf(ud->out, "Extension unit descriptor\n%s", msg);
+		fprintf(ud->out, "bUnitId=%d bNrInPins=%d wExtensionCode=%d\n",
 		       eu->bUnitId, eu->bNrInPins, UGETW(eu->wExtensionCode));
 		{
 			u_char *src = eu->baSourceID;
 			int i;
-			printf("baSourceID=");
+			fprintf(ud->out, "baSourceID=");
 			for (i = 0; i < eu->bNrInPins; i++)
-				printf(" %d", src[i]);
-			printf("\n");
+				fprintf(ud->out, " %d", src[i]);
+			fprintf(ud->out, "\n");
 		}
 		break;
 	default:
-		printf("Descriptor\n%s   ...\n", msg);
+		fprintf(ud->out, "Descriptor\n%s   ...\n", msg);
 		break;
 	}
 }
 
-int globf, globaddr;
-
-void *
-prdesc(void *p, int *class, int *subclass, int *iface, int conf)
+void
+prdesc(struct usbdev *ud, void *p, int *class, int *subclass, int *iface, int conf)
 {
 	usb_descriptor_t *d = p;
 	struct usb_audio_descriptor *ad;
@@ -1119,17 +1591,17 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 	
 	switch (d->bDescriptorType) {
 	case UDESC_DEVICE:
-		printf("DEVICE descriptor:\n");
-		prdevd(p);
+		fprintf(ud->out, "DEVICE descriptor:\n");
+		prdevd(ud, p);
 		break;
 	case UDESC_CONFIG:
-		printf("CONFIGURATION descriptor:\n");
-		prconfd(p);
+		fprintf(ud->out, "CONFIGURATION descriptor:\n");
+		prconfd(ud, p);
 		*iface = -1;
 		break;
 	case UDESC_INTERFACE:
-		printf("INTERFACE descriptor %d:\n", ++*iface);
-		prifcd(p);
+		fprintf(ud->out, "INTERFACE descriptor %d:\n", ++*iface);
+		prifcd(ud, p);
 		id = p;
 		if (id->bInterfaceClass != 0) {
 			*class = id->bInterfaceClass;
@@ -1137,8 +1609,8 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 		}
 		break;
 	case UDESC_ENDPOINT:
-		printf("ENDPOINT descriptor:\n");
-		prendpd(p);
+		fprintf(ud->out, "ENDPOINT descriptor:\n");
+		prendpd(ud, p);
 		break;
 #if 0
 	case UDESC_HUB:
@@ -1150,25 +1622,29 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 			usb_hid_descriptor_t *hid = p;
 			int k;
 			
-			printf("HID descriptor:\n");
-			prhidd(p);
-			printf("\n");
+			fprintf(ud->out, "HID descriptor:\n");
+			prhidd(ud, p);
+			fprintf(ud->out, "\n");
 			for(k = 0; k < hid->bNumDescriptors; k++) {
 				int type, len;
-				u_char buf[256];
+				u_char *buf;
 
+				if (6 + 3 * (k + 1) > hid->bLength)
+					break;
 				type = hid->descrs[k].bDescriptorType;
 				len = UGETW(hid->descrs[k].wDescriptorLength);
 				if (type == UDESC_REPORT) {
-					getreportdesc(globf, *iface, k, buf, len, globaddr);
-					printf("Report descriptor\n");
-					prreportd(buf, len);
+					buf = aalloc(&ud->arena, len);
+					if (getreportdesc(ud, *iface, k, buf, len) < 0)
+						continue;
+					fprintf(ud->out, "Report descriptor\n");
+					prreportd(ud, buf, len);
 				} else if (type == UDESC_PHYSICAL) {
-					printf("Physical descriptor ...\n");
+					fprintf(ud->out, "Physical descriptor ...\n");
 				} else {
-					printf("Unknown HID descriptor type %d\n", type);
+					fprintf(ud->out, "Unknown HID descriptor type %d\n", type);
 				}
-				printf("\n");
+				fprintf(ud->out, "\n");
 			}
 		} else
 			goto def;
@@ -1179,16 +1655,16 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 			if (*subclass == UISUBCLASS_AUDIOCONTROL) {
 				switch (ad->bDescriptorSubtype) {
 				case UDESCSUB_AC_HEADER:
-					printf("AC interface descriptor\n");
-					pracdesc(p);
+					fprintf(ud->out, "AC interface descriptor\n");
+					pracdesc(ud, p);
 					break;
 				case UDESCSUB_AC_INPUT:
 				case UDESCSUB_AC_OUTPUT:
 				case UDESCSUB_AC_FEATURE:
 				case UDESCSUB_AC_MIXER:
 				case UDESCSUB_AC_EXTENSION:
-					printf("AC unit descriptor\n");
-					pratd(p);
+					fprintf(ud->out, "AC unit descriptor\n");
+					pratd(ud, p);
 					break;
 				default:
 					goto def;
@@ -1196,10 +1672,10 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 			} else if (*subclass == UISUBCLASS_AUDIOSTREAM) {
 				switch (ad->bDescriptorSubtype) {
 				case UDESCSUB_AS_GENERAL:
-					prasigd(p);
+					prasigd(ud, p);
 					break;
 				case UDESCSUB_AS_FORMAT_TYPE:
-					prast1d(p);
+					prast1d(ud, p);
 					break;
 				default:
 					goto def;
@@ -1212,8 +1688,8 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 			case UDESCSUB_CDC_CM:
 			case UDESCSUB_CDC_ACM:
 			case UDESCSUB_CDC_UNION:
-				printf("CDC INTERFACE descriptor:\n");
-				prcdcd(p);
+				fprintf(ud->out, "CDC INTERFACE descriptor:\n");
+				prcdcd(ud, p);
 				break;
 			default:
 				goto def;
@@ -1225,12 +1701,12 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 		ad = p;
 		if (*class == UICLASS_AUDIO) {
 			if (*subclass == UISUBCLASS_AUDIOCONTROL) {
-				printf("CONTROL %d\n", ad->bDescriptorSubtype);
+				fprintf(ud->out, "CONTROL %d\n", ad->bDescriptorSubtype);
 				goto def;
 			} else if (*subclass == UISUBCLASS_AUDIOSTREAM) {
 				switch (ad->bDescriptorSubtype) {
 				case UDESCSUB_AS_GENERAL:
-					prasiepd(p);
+					prasiepd(ud, p);
 					break;
 				default:
 					goto def;
@@ -1242,150 +1718,2871 @@ prdesc(void *p, int *class, int *subclass, int *iface, int conf)
 		break;
 	default:
 	def:
-		printf("Unknown descriptor (class %d/%d):\n", *class, *subclass);
-		printf("bLength=%d bDescriptorType=%d bDescriptorSubtype=%d ...\n", d->bLength, 
+		ud->unknown++;
+		fprintf(ud->out, "Unknown descriptor (class %d/%d):\n", *class, *subclass);
+		fprintf(ud->out, "bLength=%d bDescriptorType=%d bDescriptorSubtype=%d ...\n", d->bLength, 
 		       d->bDescriptorType, d->bDescriptorSubtype
 		       );
 		break;
 	}
-	return (u_char *)p + d->bLength;
 }
 	
-
+/*
+ * How many of the descriptors in ux prdesc would call unknown, for
+ * the output formats that do not go through it.  class and subclass
+ * are the device's, as prconfig starts prdesc with.
+ */
 int
-main(int argc, char **argv)
+countunknown(struct udesc_index *ux, int class, int subclass)
 {
-	int f, r, i;
-	char *dev = USBDEV;
-	usb_device_descriptor_t dd;
-#define USB_CONFIGSPACE 1024
-	struct usb_getconfigdesc {
-		usb_config_descriptor_t ucd;
-		u_char	filler[USB_CONFIGSPACE];
-	} cd;
-	u_char *p, *enddata;
-	usb_hub_descriptor_t hd;
-	usb_port_status_t ps;
-	usb_hub_status_t hs;
-	int ch;
-	extern char *optarg;
-	extern int optind;
-	int disconly = 0, nodisc = 0;
-	struct usb_device_info di;
-	int addr;
-	int doaddr = -1, si = -1;
-	u_int8_t cconf;
-	int iface;
+	usb_descriptor_t *d;
+	usb_interface_descriptor_t *id;
+	int k, sub, n = 0;
 
-	while ((ch = getopt(argc, argv, "a:f:dmns:")) != -1) {
-		switch(ch) {
-		case 'a':
-			nodisc = 1;
-			doaddr = atoi(optarg);
-			break;
-		case 'f':
-			dev = optarg;
+	for (k = 0; k < ux->ux_ndesc; k++) {
+		d = UDESC_AT(ux, k);
+		sub = d->bLength >= 3 ? d->bDescriptorSubtype : -1;
+		switch (d->bDescriptorType) {
+		case UDESC_DEVICE:
+		case UDESC_CONFIG:
+		case UDESC_ENDPOINT:
 			break;
-		case 'd':
-			disconly = 1;
+		case UDESC_INTERFACE:
+			id = (usb_interface_descriptor_t *)d;
+			if (id->bInterfaceClass != 0) {
+				class = id->bInterfaceClass;
+				subclass = id->bInterfaceSubClass;
+			}
 			break;
-		case 'n':
-			nodisc = 1;
+		case UDESC_CS_DEVICE:
+			n += class != UICLASS_HID;
 			break;
-		case 'm':
-			num = 1;
+		case UDESC_CS_INTERFACE:
+			if (class == UICLASS_AUDIO &&
+			    subclass == UISUBCLASS_AUDIOCONTROL)
+				n += sub != UDESCSUB_AC_HEADER &&
+				    sub != UDESCSUB_AC_INPUT &&
+				    sub != UDESCSUB_AC_OUTPUT &&
+				    sub != UDESCSUB_AC_FEATURE &&
+				    sub != UDESCSUB_AC_MIXER &&
+				    sub != UDESCSUB_AC_EXTENSION;
+			else if (class == UICLASS_AUDIO &&
+			    subclass == UISUBCLASS_AUDIOSTREAM)
+				n += sub != UDESCSUB_AS_GENERAL &&
+				    sub != UDESCSUB_AS_FORMAT_TYPE;
+			else if (class == UICLASS_CDC)
+				n += sub != UDESCSUB_CDC_HEADER &&
+				    sub != UDESCSUB_CDC_CM &&
+				    sub != UDESCSUB_CDC_ACM &&
+				    sub != UDESCSUB_CDC_UNION;
+			else
+				n++;
 			break;
-		case 's':
-			si = atoi(optarg);
+		case UDESC_CS_ENDPOINT:
+			n += class != UICLASS_AUDIO ||
+			    subclass != UISUBCLASS_AUDIOSTREAM ||
+			    sub != UDESCSUB_AS_GENERAL;
 			break;
-		case '?':
 		default:
-			usage();
+			n++;
+			break;
 		}
 	}
-	argc -= optind;
-	argv += optind;
-
-	f = open(dev, O_RDWR);
-	if (f < 0)
-		err(1, "%s", dev);
-	globf = f;
+	return n;
+}
 
-	if (doaddr > 0 && si >= 0) {
-		char buf[128];
-		setupstrings(f, doaddr);
-		getstring(si, buf);
-		printf("string %d = '%s'\n", si, buf);
+/*
+ * Configuration i, with everything it leads to.  The text depends on
+ * the blob, on the model through report descriptors, and on the
+ * iConfiguration and iInterface strings, which may differ from unit
+ * to unit.  So the key has the device descriptor in it as well, and
+ * the strings, which are read first and kept for the formatting.
+ */
+void
+prconfig(struct usbdev *ud, usb_device_descriptor_t *dd, int i,
+	 usb_config_descriptor_t *cd, int len)
+{
+	struct udesc_index ux;
+	struct internbuf ib;
+	char *strs[256];
+	const u_char *p, *e;
+	int class, subclass, iface, k, si;
+	size_t klen, n;
+	u_char *key;
+
+	memset(strs, 0, sizeof strs);
+	klen = 2 + sizeof *dd + len;
+	e = (u_char *)cd + len;
+	for (p = (u_char *)cd; p + 2 <= e && p[0] >= 2 && p + p[0] <= e;
+	    p += p[0]) {
+		if (p[1] == UDESC_CONFIG && p[0] >= USB_CONFIG_DESCRIPTOR_SIZE)
+			si = p[6];
+		else if (p[1] == UDESC_INTERFACE && p[0] >= 9)
+			si = p[8];
+		else
+			continue;
+		if (si == 0 || strs[si] != NULL)
+			continue;
+		strs[si] = aalloc(&ud->arena, MAXSTR);
+		getstring(ud, si, strs[si]);
+		klen += 1 + strlen(strs[si]) + 1;
+	}
+	key = aalloc(&ud->arena, klen);
+	key[0] = 'C';
+	key[1] = i;
+	memcpy(key + 2, dd, sizeof *dd);
+	memcpy(key + 2 + sizeof *dd, cd, len);
+	for (n = 2 + sizeof *dd + len, si = 1; si < 256; si++)
+		if (strs[si] != NULL) {
+			key[n++] = si;
+			strcpy((char *)key + n, strs[si]);
+			n += strlen(strs[si]) + 1;
+		}
+	if (intern_write(ud, key, klen))
+		return;
+	ud->cstr = strs;
+	intern_begin(ud, &ib);
+
+	fprintf(ud->out, "CONFIGURATION descriptor %d:\n", i);
+	prconfd(ud, cd);
+	fprintf(ud->out, "\n");
+	udesc_parse(&ux, cd, len, &ud->arena);
+
+	class = dd->bDeviceClass;
+	subclass = dd->bDeviceSubClass;
+
+	iface = -1;
+	for (k = 1; k < ux.ux_ndesc; k++) {
+		prdesc(ud, UDESC_AT(&ux, k), &class, &subclass, &iface, i);
+		fprintf(ud->out, "\n");
+	}
+	if (ux.ux_bad >= 0)
+		fprintf(ud->out, "Bad descriptor length %d at offset %d\n\n",
+		    ux.ux_buf[ux.ux_bad], ux.ux_bad);
+	intern_end(ud, &ib, key, klen);
+	ud->cstr = NULL;
+}
+
+void
+dumpdev(struct usbdev *ud)
+{
+	int addr = ud->addr;
+	int i;
+	usb_device_descriptor_t dd;
+	usb_config_descriptor_t *cd;
+	int len;
+	usb_hub_descriptor_t hd;
+	usb_port_status_t ps;
+	usb_hub_status_t hs;
+	u_int8_t cconf;
+
+	startdev(ud);
+	if (ud->name)
+		fprintf(ud->out, "BLOB %s\n", ud->name);
+	fprintf(ud->out, "DEVICE addr %d\n", addr);
+	if (getdevicedesc(ud, &dd) < 0)
+		goto out;
+	fprintf(ud->out, "DEVICE descriptor:\n");
+	prdevd(ud, &dd);
+	fprintf(ud->out, "\n");
+	/*getdevicestatus(ud, &status);
+	 printf("Device status %04x\n", status);*/
+
+	for(i = 0; i < dd.bNumConfigurations; i++) {
+		if ((cd = getconfigdesc(ud, i, &len)) == NULL)
+			continue;
+		prconfig(ud, &dd, i, cd, len);
+	}
+	if (getconfiguration(ud, &cconf) == 0)
+		fprintf(ud->out, "current configuration %d\n\n", cconf);
+#if 1
+	if (dd.bDeviceClass == UICLASS_HUB && gethubdesc(ud, &hd) >= 0) {
+		fprintf(ud->out, "HUB descriptor:\n");
+		prhubd(ud, &hd);
+		fprintf(ud->out, "\n");
+		if (gethubstatus(ud, &hs) == 0)
+			fprintf(ud->out, "Hub status %04x %04x\n\n",
+			       UGETW(hs.wHubStatus), UGETW(hs.wHubChange));
+		for(i = 1; i <= hd.bNbrPorts; i++) {
+			if (getportstatus(ud, i, &ps) < 0)
+				continue;
+			fprintf(ud->out, "Port %d status=%04x change=%04x\n\n", i,
+			       UGETW(ps.wPortStatus), UGETW(ps.wPortChange));
+		}
+	}
+#endif
+ out:
+	if (ud->error)
+		fprintf(ud->out, "PARTIAL: %s: %s\n\n", ud->what,
+		    strerror(ud->error));
+	fprintf(ud->out, "----------\n");
+	afree(&ud->arena);
+}
+
+/*
+ * Mark a string index as referenced, for the strings member of
+ * structured output.
+ */
+#define SETSTR(set, i)	((set)[(i) >> 3] |= 1 << ((i) & 7))
+#define HASSTR(set, i)	((set)[(i) >> 3] & (1 << ((i) & 7)))
+
+/*
+ * Dump a device as JSON or binary (see usbout.h).  The whole record
+ * is built in memory and written with one call.
+ */
+void
+outdev(struct usbdev *ud)
+{
+	int addr = ud->addr;
+	struct obuf ob;
+	usb_device_descriptor_t dd;
+	usb_config_descriptor_t *cd;
+	usb_interface_descriptor_t *id;
+	usb_string_descriptor_t us;
+	usb_hub_descriptor_t hd;
+	usb_port_status_t ps;
+	usb_hub_status_t hs;
+	struct udesc_index ux;
+	u_char strs[256 / 8];
+	u_int8_t cconf, b;
+	char key[4];
+	size_t rec = 0;
+	int i, k, len, hlen;
+
+	startdev(ud);
+	memset(&ob, 0, sizeof ob);
+	memset(strs, 0, sizeof strs);
+	if (ofmt == OFMT_JSON) {
+		js_open(&ob, NULL, '{');
+		if (ud->name)
+			js_str(&ob, "blob", ud->name);
+		js_uint(&ob, "addr", addr);
+	} else {
+		rec = bin_begin(&ob);
+		b = addr;
+		bin_item(&ob, OB_ADDR, -1, &b, 1);
+		if (ud->name)
+			bin_item(&ob, OB_BLOB, -1, ud->name, strlen(ud->name));
+	}
+	if (getdevicedesc(ud, &dd) < 0)
+		goto out;
+	SETSTR(strs, dd.iManufacturer);
+	SETSTR(strs, dd.iProduct);
+	SETSTR(strs, dd.iSerialNumber);
+	if (ofmt == OFMT_JSON) {
+		js_desc(&ob, "device", &dd, sizeof dd);
+		js_open(&ob, "configs", '[');
+	} else
+		bin_item(&ob, OB_DEVICE, -1, &dd, sizeof dd);
+
+	for (i = 0; i < dd.bNumConfigurations; i++) {
+		if ((cd = getconfigdesc(ud, i, &len)) == NULL)
+			continue;
+		udesc_parse(&ux, cd, len, &ud->arena);
+		ud->unknown += countunknown(&ux, dd.bDeviceClass,
+		    dd.bDeviceSubClass);
+		SETSTR(strs, cd->iConfiguration);
+		for (k = 0; k < ux.ux_nalts; k++) {
+			id = UDESC_IFC(&ux, k);
+			SETSTR(strs, id->iInterface);
+		}
+		if (ofmt == OFMT_JSON) {
+			js_open(&ob, NULL, '{');
+			js_uint(&ob, "index", i);
+			js_open(&ob, "descriptors", '[');
+			for (k = 0; k < ux.ux_ndesc; k++)
+				js_desc(&ob, NULL, UDESC_AT(&ux, k),
+				    ux.ux_len - ux.ux_desc[k]);
+			js_close(&ob, ']');
+			if (ux.ux_bad >= 0)
+				js_uint(&ob, "bad_offset", ux.ux_bad);
+			js_close(&ob, '}');
+		} else
+			bin_item(&ob, OB_CONFIG, i, cd, len);
+	}
+	if (ofmt == OFMT_JSON)
+		js_close(&ob, ']');
+
+	if (getconfiguration(ud, &cconf) == 0) {
+		if (ofmt == OFMT_JSON)
+			js_uint(&ob, "current_config", cconf);
+		else
+			bin_item(&ob, OB_CURCONFIG, -1, &cconf, 1);
+	}
+
+	if (dd.bDeviceClass == UICLASS_HUB &&
+	    (hlen = gethubdesc(ud, &hd)) >= 0) {
+		k = gethubstatus(ud, &hs);
+		if (ofmt == OFMT_JSON) {
+			js_desc(&ob, "hub", &hd, hlen);
+			if (k == 0) {
+				js_uint(&ob, "hub_status", UGETW(hs.wHubStatus));
+				js_uint(&ob, "hub_change", UGETW(hs.wHubChange));
+			}
+			js_open(&ob, "ports", '[');
+		} else {
+			bin_item(&ob, OB_HUB, -1, &hd, hlen);
+			if (k == 0)
+				bin_item(&ob, OB_HUBSTATUS, -1, &hs, sizeof hs);
+		}
+		for (i = 1; i <= hd.bNbrPorts; i++) {
+			if (getportstatus(ud, i, &ps) < 0)
+				continue;
+			if (ofmt == OFMT_JSON) {
+				js_open(&ob, NULL, '{');
+				js_uint(&ob, "port", i);
+				js_uint(&ob, "status", UGETW(ps.wPortStatus));
+				js_uint(&ob, "change", UGETW(ps.wPortChange));
+				js_close(&ob, '}');
+			} else
+				bin_item(&ob, OB_PORTSTATUS, i, &ps, sizeof ps);
+		}
+		if (ofmt == OFMT_JSON)
+			js_close(&ob, ']');
+	}
+
+	if (ofmt == OFMT_JSON)
+		js_open(&ob, "strings", '{');
+	for (i = 1; i < 256; i++) {
+		if (!HASSTR(strs, i) || getstringdesc(ud, i, &us) < 0)
+			continue;
+		if (ofmt == OFMT_JSON) {
+			snprintf(key, sizeof key, "%d", i);
+			js_utf16(&ob, key, &us);
+		} else
+			bin_item(&ob, OB_STRING, i, &us, us.bLength);
+	}
+	if (ofmt == OFMT_JSON)
+		js_close(&ob, '}');
+
+ out:
+	if (ud->error && ofmt == OFMT_JSON) {
+		js_open(&ob, "partial", '{');
+		js_str(&ob, "what", ud->what);
+		js_str(&ob, "error", strerror(ud->error));
+		js_close(&ob, '}');
+	} else if (ud->error)
+		bin_item(&ob, OB_PARTIAL, ud->error & 0xff, ud->what,
+		    strlen(ud->what));
+	if (ofmt == OFMT_JSON) {
+		js_close(&ob, '}');
+		js_end(&ob);
+	} else
+		bin_end(&ob, rec);
+
+	if (ob_write(&ob, ud->out) < 0)
+		err(1, "write");
+	ob_free(&ob);
+	afree(&ud->arena);
+}
+
+/*
+ * Queries, -q expr, and projections, -F fields.  expr is one or more
+ * terms "field op value" joined by "&&", op one of == != < <= > >=.
+ * String fields take an fnmatch(3) pattern, with == and != only; a
+ * single & is part of the pattern, and "&&" in a value can be matched
+ * as "&[&]".  A list field matches if any member does, and != if none
+ * is equal.  With -F in text, strings are quoted with ' and \ escaped
+ * and anything unprintable as \uXXXX, the way JSON does it.
+ *
+ * Fields are ranked by what it takes to learn them: USB_DEVICEINFO,
+ * which the device loop has anyway, then the device descriptor, the
+ * configurations, strings, hub ports and HID report descriptors.
+ * Terms are tried cheapest first and a device is dropped at the first
+ * that fails, so most devices never get past USB_DEVICEINFO.  With -F
+ * a device that matched is printed as just those fields, one line (or
+ * JSON object) per device, and nothing else is asked for.  Answers
+ * are recorded while filtering and not asked for again.
+ */
+#define QL_INFO		0
+#define QL_DEVICE	1
+#define QL_CONFIG	2
+#define QL_STRING	3
+#define QL_PORTS	4
+#define QL_REPORT	5
+
+#define QK_NUM		0
+#define QK_LIST		1
+#define QK_STR		2
+
+enum {
+	Q_ADDR, Q_CLASS, Q_SUBCLASS, Q_PROTOCOL, Q_VENDOR, Q_PRODUCT,
+	Q_RELEASE, Q_SPEED, Q_POWER, Q_NPORTS,
+	Q_BCDUSB, Q_MAXPACKET, Q_NCONFIG,
+	Q_IFCLASS, Q_IFSUBCLASS, Q_IFPROTOCOL, Q_ENDPOINTS,
+	Q_MANUFACTURER, Q_PRODUCTSTR, Q_SERIAL,
+	Q_PORTS, Q_REPORT,
+	Q_NFIELDS
+};
+
+const struct qfield {
+	const char	*qf_name;
+	int		qf_level;
+	int		qf_kind;
+	const char	*qf_fmt;	/* for numbers in text */
+} qfields[Q_NFIELDS] = {
+	{ "addr",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "class",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "subclass",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "protocol",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "idVendor",		QL_INFO,	QK_NUM,		"0x%04lx" },
+	{ "idProduct",		QL_INFO,	QK_NUM,		"0x%04lx" },
+	{ "bcdDevice",		QL_INFO,	QK_NUM,		"0x%04lx" },
+	{ "speed",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "power",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "nports",		QL_INFO,	QK_NUM,		"%lu" },
+	{ "bcdUSB",		QL_DEVICE,	QK_NUM,		"0x%04lx" },
+	{ "bMaxPacketSize",	QL_DEVICE,	QK_NUM,		"%lu" },
+	{ "bNumConfigurations",	QL_DEVICE,	QK_NUM,		"%lu" },
+	{ "ifclass",		QL_CONFIG,	QK_LIST,	"%lu" },
+	{ "ifsubclass",		QL_CONFIG,	QK_LIST,	"%lu" },
+	{ "ifprotocol",		QL_CONFIG,	QK_LIST,	"%lu" },
+	{ "endpoints",		QL_CONFIG,	QK_LIST,	"0x%02lx" },
+	{ "manufacturer",	QL_STRING,	QK_STR },
+	{ "product",		QL_STRING,	QK_STR },
+	{ "serial",		QL_STRING,	QK_STR },
+	{ "ports",		QL_PORTS,	QK_LIST,	"0x%04lx" },
+	{ "report",		QL_REPORT,	QK_STR },
+};
+
+#define QOP_EQ		0
+#define QOP_NE		1
+#define QOP_LT		2
+#define QOP_LE		3
+#define QOP_GT		4
+#define QOP_GE		5
+
+struct qterm {
+	int		qt_field;
+	int		qt_op;
+	u_long		qt_num;
+	char		*qt_str;
+};
+
+#define QMAXTERMS	16
+#define QMAXREPORTS	8
+
+struct qterm qterms[QMAXTERMS];
+int nqterms;
+int qproj[Q_NFIELDS];
+int nqproj;
+
+/* What has been learnt about a device while evaluating fields. */
+struct qdev {
+	struct usbdev	*qd_ud;
+	struct usb_device_info qd_di;
+	int		qd_dev;		/* device descriptor: 1 ok, -1 failed */
+	usb_device_descriptor_t qd_dd;
+	int		qd_cfg;		/* configurations looked at */
+	struct udesc_index *qd_ux;
+	int		qd_nux;
+};
+
+struct qval {
+	int		qv_n;		/* numbers */
+	u_long		qv_num[256];
+	char		*qv_str;
+	char		qv_buf[MAXSTR];
+	int		qv_isus;	/* qv_str came from qv_us */
+	usb_string_descriptor_t qv_us;
+};
+
+int
+qfield(const char *name, size_t len)
+{
+	int f;
+
+	for (f = 0; f < Q_NFIELDS; f++)
+		if (strlen(qfields[f].qf_name) == len &&
+		    strncmp(qfields[f].qf_name, name, len) == 0)
+			return f;
+	errx(1, "%.*s: unknown field", (int)len, name);
+}
+
+/* Parse -q, and sort the terms cheapest first. */
+void
+qparse(char *expr)
+{
+	struct qterm *qt, t;
+	char *term, *next, *p, *e;
+	int i, j;
+
+	for (term = expr; term != NULL; term = next) {
+		if ((next = strstr(term, "&&")) != NULL) {
+			*next = 0;
+			next += 2;
+		}
+		while (*term == ' ')
+			term++;
+		if (*term == 0)
+			errx(1, "empty term in query");
+		if (nqterms == QMAXTERMS)
+			errx(1, "too many terms");
+		qt = &qterms[nqterms++];
+		for (p = term; *p && !strchr("=!<> ", *p); p++)
+			;
+		qt->qt_field = qfield(term, p - term);
+		while (*p == ' ')
+			p++;
+		if (strncmp(p, "==", 2) == 0 || strncmp(p, "!=", 2) == 0 ||
+		    strncmp(p, "<=", 2) == 0 || strncmp(p, ">=", 2) == 0) {
+			qt->qt_op = p[0] == '=' ? QOP_EQ : p[0] == '!' ? QOP_NE :
+			    p[0] == '<' ? QOP_LE : QOP_GE;
+			p += 2;
+		} else if (*p == '<' || *p == '>') {
+			qt->qt_op = *p++ == '<' ? QOP_LT : QOP_GT;
+		} else
+			errx(1, "%s: no comparison", term);
+		while (*p == ' ')
+			p++;
+		for (e = p + strlen(p); e > p && e[-1] == ' '; )
+			*--e = 0;
+		if (qfields[qt->qt_field].qf_kind == QK_STR) {
+			if (qt->qt_op != QOP_EQ && qt->qt_op != QOP_NE)
+				errx(1, "%s: strings only take == and !=",
+				    term);
+			qt->qt_str = p;
+		} else {
+			qt->qt_num = strtoul(p, &e, 0);
+			if (*p == 0 || *e != 0)
+				errx(1, "%s: not a number", p);
+		}
+	}
+	for (i = 1; i < nqterms; i++) {
+		t = qterms[i];
+		for (j = i; j > 0 && qfields[qterms[j - 1].qt_field].qf_level >
+		    qfields[t.qt_field].qf_level; j--)
+			qterms[j] = qterms[j - 1];
+		qterms[j] = t;
+	}
+}
+
+/*
+ * A string for -F in text, quoted, taken from the descriptor us, as
+ * -o json does, if there is one.
+ */
+void
+prquoted(FILE *f, const char *s, const usb_string_descriptor_t *us)
+{
+	u_int c;
+	int i, n;
+
+	if (us) {
+		n = us->bLength / 2 - 1;
+		if (n > (int)(sizeof us->bString / sizeof us->bString[0]))
+			n = sizeof us->bString / sizeof us->bString[0];
+	} else
+		n = strlen(s);
+	fputc('\'', f);
+	for (i = 0; i < n; i++) {
+		c = us ? UGETW(us->bString[i]) : (u_char)s[i];
+		if (c == '\'' || c == '\\')
+			fprintf(f, "\\%c", c);
+		else if (c >= 0x20 && c < 0x7f)
+			fputc(c, f);
+		else
+			fprintf(f, "\\u%04x", c);
+	}
+	fputc('\'', f);
+}
+
+/* Parse -F. */
+void
+qparseproj(const char *list)
+{
+	const char *p;
+
+	for (; *list; list = *p ? p + 1 : p) {
+		p = list + strcspn(list, ",");
+		if (p == list)
+			continue;
+		if (nqproj == Q_NFIELDS)
+			errx(1, "too many fields");
+		qproj[nqproj++] = qfield(list, p - list);
+	}
+}
+
+void
+qinit(struct qdev *qd, struct usbdev *ud, struct usb_device_info *di)
+{
+	memset(qd, 0, sizeof *qd);
+	qd->qd_ud = ud;
+	qd->qd_di = *di;
+}
+
+/* Fetch what a field of this level needs; -1 if it cannot be had. */
+int
+qload(struct qdev *qd, int level)
+{
+	struct usbdev *ud = qd->qd_ud;
+	usb_config_descriptor_t *cd;
+	int i, n, len;
+
+	if (level == QL_INFO)
+		return 0;
+	if (qd->qd_dev == 0)
+		qd->qd_dev = getdevicedesc(ud, &qd->qd_dd) < 0 ? -1 : 1;
+	if (qd->qd_dev < 0)
+		return -1;
+	if ((level == QL_CONFIG || level == QL_REPORT) && !qd->qd_cfg) {
+		qd->qd_cfg = 1;
+		n = qd->qd_dd.bNumConfigurations;
+		qd->qd_ux = aalloc(&ud->arena, (n + 1) * sizeof *qd->qd_ux);
+		for (i = 0; i < n; i++)
+			if ((cd = getconfigdesc(ud, i, &len)) != NULL)
+				udesc_parse(&qd->qd_ux[qd->qd_nux++], cd, len,
+				    &ud->arena);
+	}
+	return 0;
+}
+
+void
+qadd(struct qval *v, u_long n)
+{
+	int i;
+
+	for (i = 0; i < v->qv_n; i++)
+		if (v->qv_num[i] == n)
+			return;
+	if (v->qv_n < 256)
+		v->qv_num[v->qv_n++] = n;
+}
+
+/* HID report descriptors, in hex, separated by commas. */
+void
+qreports(struct qdev *qd, struct qval *v)
+{
+	struct usbdev *ud = qd->qd_ud;
+	struct udesc_index *ux;
+	usb_interface_descriptor_t *id;
+	usb_hid_descriptor_t *hid;
+	u_char *buf[QMAXREPORTS];
+	int len[QMAXREPORTS];
+	int i, a, c, k, n = 0, size = 1;
+	char *s;
+
+	for (i = 0; i < qd->qd_nux; i++) {
+		ux = &qd->qd_ux[i];
+		for (a = 0; a < ux->ux_nalts; a++) {
+			id = UDESC_IFC(ux, a);
+			if (id->bInterfaceClass != UICLASS_HID)
+				continue;
+			for (c = 0; c < ux->ux_alts[a].ua_ncs; c++) {
+				hid = (usb_hid_descriptor_t *)UDESC_CS(ux, a, c);
+				if (hid->bDescriptorType != UDESC_HID)
+					continue;
+				for (k = 0; k < hid->bNumDescriptors &&
+				    6 + 3 * (k + 1) <= hid->bLength &&
+				    n < QMAXREPORTS; k++) {
+					if (hid->descrs[k].bDescriptorType !=
+					    UDESC_REPORT)
+						continue;
+					len[n] = UGETW(hid->descrs[k].wDescriptorLength);
+					buf[n] = aalloc(&ud->arena, len[n]);
+					if (getreportdesc(ud, id->bInterfaceNumber,
+					    k, buf[n], len[n]) == 0)
+						size += 2 * len[n++] + 1;
+				}
+			}
+		}
+	}
+	v->qv_str = s = aalloc(&ud->arena, size);
+	*s = 0;
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			*s++ = ',';
+		for (k = 0; k < len[i]; k++, s += 2)
+			sprintf(s, "%02x", buf[i][k]);
+	}
+}
+
+/* The value of field f; -1 if it could not be read. */
+int
+qget(struct qdev *qd, int f, struct qval *v)
+{
+	struct usbdev *ud = qd->qd_ud;
+	struct usb_device_info *di = &qd->qd_di;
+	usb_device_descriptor_t *dd = &qd->qd_dd;
+	usb_interface_descriptor_t *id;
+	usb_hub_descriptor_t hd;
+	usb_port_status_t ps;
+	struct udesc_index *ux;
+	const char *alt = NULL;
+	int i, a, e, n, si = 0;
+
+	v->qv_n = 0;
+	v->qv_str = v->qv_buf;
+	v->qv_buf[0] = 0;
+	v->qv_isus = 0;
+	if (qload(qd, qfields[f].qf_level) < 0)
+		return -1;
+	switch (f) {
+	case Q_ADDR:		qadd(v, di->udi_addr); break;
+	case Q_CLASS:		qadd(v, di->udi_class); break;
+	case Q_SUBCLASS:	qadd(v, di->udi_subclass); break;
+	case Q_PROTOCOL:	qadd(v, di->udi_protocol); break;
+	case Q_VENDOR:		qadd(v, di->udi_vendorNo); break;
+	case Q_PRODUCT:		qadd(v, di->udi_productNo); break;
+	case Q_RELEASE:		qadd(v, di->udi_releaseNo); break;
+	case Q_SPEED:		qadd(v, di->udi_speed); break;
+	case Q_POWER:		qadd(v, di->udi_power); break;
+	case Q_NPORTS:		qadd(v, di->udi_nports); break;
+	case Q_BCDUSB:		qadd(v, UGETW(dd->bcdUSB)); break;
+	case Q_MAXPACKET:	qadd(v, dd->bMaxPacketSize); break;
+	case Q_NCONFIG:		qadd(v, dd->bNumConfigurations); break;
+	case Q_IFCLASS:
+	case Q_IFSUBCLASS:
+	case Q_IFPROTOCOL:
+		for (i = 0; i < qd->qd_nux; i++) {
+			ux = &qd->qd_ux[i];
+			for (a = 0; a < ux->ux_nalts; a++) {
+				id = UDESC_IFC(ux, a);
+				if (id->bAlternateSetting != 0)
+					continue;
+				qadd(v, f == Q_IFCLASS ? id->bInterfaceClass :
+				    f == Q_IFSUBCLASS ? id->bInterfaceSubClass :
+				    id->bInterfaceProtocol);
+			}
+		}
+		break;
+	case Q_ENDPOINTS:
+		for (i = 0; i < qd->qd_nux; i++) {
+			ux = &qd->qd_ux[i];
+			for (a = 0; a < ux->ux_nalts; a++)
+				for (e = 0; e < ux->ux_alts[a].ua_nep; e++)
+					qadd(v, UDESC_EP(ux, a, e)->
+					    bEndpointAddress);
+		}
+		break;
+	case Q_MANUFACTURER:
+		si = dd->iManufacturer;
+		alt = di->udi_vendor;
+		break;
+	case Q_PRODUCTSTR:
+		si = dd->iProduct;
+		alt = di->udi_product;
+		break;
+	case Q_SERIAL:
+		si = dd->iSerialNumber;
+		alt = di->udi_serial;
+		break;
+	case Q_PORTS:
+		if (dd->bDeviceClass != UICLASS_HUB)
+			break;
+		if ((n = di->udi_nports) == 0) {
+			if (gethubdesc(ud, &hd) < 0)
+				return -1;
+			n = hd.bNbrPorts;
+		}
+		for (i = 1; i <= n; i++)
+			if (getportstatus(ud, i, &ps) == 0)
+				v->qv_num[v->qv_n++] = UGETW(ps.wPortStatus);
+		break;
+	case Q_REPORT:
+		qreports(qd, v);
+		break;
+	}
+	/* A bus that cannot read strings may still know them. */
+	if (alt) {
+		if (getstringdesc(ud, si, &v->qv_us) == 0) {
+			usstring(&v->qv_us, v->qv_buf);
+			v->qv_isus = v->qv_buf[0] != 0;
+		}
+		if (v->qv_buf[0] == 0)
+			snprintf(v->qv_buf, sizeof v->qv_buf, "%s", alt);
+	}
+	return 0;
+}
+
+int
+qcmp(int op, u_long a, u_long b)
+{
+	switch (op) {
+	case QOP_EQ:	return a == b;
+	case QOP_NE:	return a != b;
+	case QOP_LT:	return a < b;
+	case QOP_LE:	return a <= b;
+	case QOP_GT:	return a > b;
+	default:	return a >= b;
+	}
+}
+
+/* Does the device pass every term of -q? */
+int
+qmatch(struct usbdev *ud, struct usb_device_info *di)
+{
+	struct qdev qd;
+	struct qterm *qt;
+	struct qval v;
+	int i, k, r = 1;
+
+	qinit(&qd, ud, di);
+	for (i = 0; i < nqterms && r; i++) {
+		qt = &qterms[i];
+		if (qget(&qd, qt->qt_field, &v) < 0) {
+			r = 0;
+			break;
+		}
+		if (qfields[qt->qt_field].qf_kind == QK_STR) {
+			r = fnmatch(qt->qt_str, v.qv_str, 0) == 0;
+			if (qt->qt_op == QOP_NE)
+				r = !r;
+			continue;
+		}
+		for (r = 0, k = 0; k < v.qv_n && !r; k++)
+			r = qcmp(qt->qt_op == QOP_NE ? QOP_EQ : qt->qt_op,
+			    v.qv_num[k], qt->qt_num);
+		if (qt->qt_op == QOP_NE)
+			r = !r;
+	}
+	afree(&ud->arena);
+	return r;
+}
+
+/* Print the -F fields of a device. */
+void
+prfields(struct usbdev *ud)
+{
+	struct usb_device_info di;
+	struct qdev qd;
+	struct qval v;
+	struct obuf ob;
+	const struct qfield *qf;
+	int i, k;
+
+	startdev(ud);
+	memset(&di, 0, sizeof di);
+	di.udi_addr = ud->addr;
+	if (usbbus_devinfo(ud->ub, &di) < 0)
+		devfail(ud, "device info");
+	qinit(&qd, ud, &di);
+	memset(&ob, 0, sizeof ob);
+	if (ofmt == OFMT_JSON)
+		js_open(&ob, NULL, '{');
+	for (i = 0; i < nqproj; i++) {
+		qf = &qfields[qproj[i]];
+		if (qget(&qd, qproj[i], &v) < 0)
+			continue;
+		if (ofmt == OFMT_JSON) {
+			if (v.qv_isus)
+				js_utf16(&ob, qf->qf_name, &v.qv_us);
+			else if (qf->qf_kind == QK_STR)
+				js_str(&ob, qf->qf_name, v.qv_str);
+			else if (qf->qf_kind == QK_NUM)
+				js_uint(&ob, qf->qf_name, v.qv_num[0]);
+			else {
+				js_open(&ob, qf->qf_name, '[');
+				for (k = 0; k < v.qv_n; k++)
+					js_uint(&ob, NULL, v.qv_num[k]);
+				js_close(&ob, ']');
+			}
+			continue;
+		}
+		fprintf(ud->out, "%s%s=", i ? " " : "", qf->qf_name);
+		if (qf->qf_kind == QK_STR)
+			prquoted(ud->out, v.qv_str,
+			    v.qv_isus ? &v.qv_us : NULL);
+		for (k = 0; k < v.qv_n; k++) {
+			if (k > 0)
+				fputc(',', ud->out);
+			fprintf(ud->out, qf->qf_fmt, v.qv_num[k]);
+		}
+	}
+	if (ofmt == OFMT_JSON) {
+		if (ud->error) {
+			js_open(&ob, "partial", '{');
+			js_str(&ob, "what", ud->what);
+			js_str(&ob, "error", strerror(ud->error));
+			js_close(&ob, '}');
+		}
+		js_close(&ob, '}');
+		js_end(&ob);
+		if (ob_write(&ob, ud->out) < 0)
+			err(1, "write");
+		ob_free(&ob);
+	} else {
+		if (ud->error)
+			fprintf(ud->out, " partial='%s: %s'", ud->what,
+			    strerror(ud->error));
+		fputc('\n', ud->out);
+	}
+	afree(&ud->arena);
+}
+
+/*
+ * Worker pool for -j.  Workers take the next undumped device, dump it
+ * into its own memory stream and mark it done; the main thread writes
+ * the buffers out in address order as soon as each one is complete.
+ * The optional before hook readies a device, which is skipped if it
+ * fails; after runs once it has been dumped.
+ */
+struct dumppool {
+	pthread_mutex_t	lock;
+	pthread_cond_t	cv;
+	struct usbdev	*devs;
+	char		*done;
+	int		ndevs;
+	int		next;
+	int		(*before)(struct usbdev *);
+	void		(*after)(struct usbdev *);
+};
+
+void *
+dumpworker(void *arg)
+{
+	struct dumppool *dp = arg;
+	struct usbdev *ud;
+	int n;
+
+	for (;;) {
+		pthread_mutex_lock(&dp->lock);
+		n = dp->next++;
+		pthread_mutex_unlock(&dp->lock);
+		if (n >= dp->ndevs)
+			break;
+		ud = &dp->devs[n];
+		if (dp->before == NULL || dp->before(ud) == 0) {
+			ud->out = open_memstream(&ud->obuf, &ud->olen);
+			if (ud->out == NULL)
+				err(1, "open_memstream");
+			if (nqproj)
+				prfields(ud);
+			else if (ofmt == OFMT_TEXT)
+				dumpdev(ud);
+			else
+				outdev(ud);
+			fclose(ud->out);
+			if (dp->after)
+				dp->after(ud);
+		}
+		pthread_mutex_lock(&dp->lock);
+		dp->done[n] = 1;
+		pthread_cond_broadcast(&dp->cv);
+		pthread_mutex_unlock(&dp->lock);
+	}
+	return 0;
+}
+
+void
+dumpall(struct usbdev *devs, int ndevs, int njobs,
+	int (*before)(struct usbdev *), void (*after)(struct usbdev *))
+{
+	struct dumppool dp;
+	pthread_t *tids;
+	int i, e;
+
+	if (njobs > ndevs)
+		njobs = ndevs;
+	dp.devs = devs;
+	dp.done = calloc(ndevs, 1);
+	tids = calloc(njobs, sizeof *tids);
+	if (dp.done == NULL || tids == NULL)
+		err(1, "calloc");
+	dp.ndevs = ndevs;
+	dp.next = 0;
+	dp.before = before;
+	dp.after = after;
+	pthread_mutex_init(&dp.lock, NULL);
+	pthread_cond_init(&dp.cv, NULL);
+	for (i = 0; i < njobs; i++) {
+		e = pthread_create(&tids[i], NULL, dumpworker, &dp);
+		if (e) {
+			errno = e;
+			err(1, "pthread_create");
+		}
+	}
+	for (i = 0; i < ndevs; i++) {
+		pthread_mutex_lock(&dp.lock);
+		while (!dp.done[i])
+			pthread_cond_wait(&dp.cv, &dp.lock);
+		pthread_mutex_unlock(&dp.lock);
+		if (dp.devs[i].olen > 0)
+			fwrite(dp.devs[i].obuf, 1, dp.devs[i].olen, stdout);
+		free(dp.devs[i].obuf);
+	}
+	fflush(stdout);
+	for (i = 0; i < njobs; i++)
+		pthread_join(tids[i], NULL);
+	pthread_cond_destroy(&dp.cv);
+	pthread_mutex_destroy(&dp.lock);
+	free(tids);
+	free(dp.done);
+}
+
+/*
+ * Prefetch for -P.  Everything a dump will ask for is requested up
+ * front through a usbq, with up to depth requests in flight across
+ * all devices: the device descriptor first, then as each answer comes
+ * in whatever it leads to (configurations, strings, HID reports, hub
+ * and port status).  The answers go into pfcache, where ctlrequest
+ * finds them; anything that failed is simply asked again later.
+ * Answers reaped to make room for a request wait on the done list to
+ * be followed up by the loop in prefetch, which keeps the follow-ups
+ * from nesting.
+ */
+struct prefetch {
+	struct usbq	*q;
+	int		depth;
+	int		out;		/* submitted, not reaped */
+	struct pfent	*done, **donetail;	/* reaped, not followed up */
+};
+
+/*
+ * Reap an answer onto the done list.  Once the budget is spent what
+ * is still outstanding is cancelled; it is reaped all the same.
+ */
+void
+pf_reap(struct prefetch *pp)
+{
+	struct pfent *pf;
+	double left;
+	int ms = -1;
+
+	if (budgetend != 0) {
+		left = budgetend - monotime();
+		ms = left > 0 ? left * 1e3 + 1 : 0;
+	}
+	while ((pf = (struct pfent *)usbq_reap(pp->q, ms)) == NULL) {
+		if (errno != ETIMEDOUT)
+			err(1, "usbq_reap");
+		usbq_cancel(pp->q);
+		ms = -1;
+	}
+	pp->out--;
+	pf->pf_next = NULL;
+	*pp->donetail = pf;
+	pp->donetail = &pf->pf_next;
+}
+
+void
+pf_submit(struct prefetch *pp, struct usbdev *ud, int type, int request,
+	  int value, int index, int len, int flags)
+{
+	struct pfent *pf;
+	struct usb_ctl_request *req;
+
+	if (budgetend != 0 && monotime() >= budgetend)
+		return;
+	while (pp->out >= pp->depth)
+		pf_reap(pp);
+	if ((pf = calloc(1, sizeof *pf + len)) == NULL)
+		err(1, "calloc");
+	pf->pf_q.uq_arg = ud;
+	req = &pf->pf_q.uq_req;
+	req->ucr_addr = ud->addr;
+	req->ucr_request.bmRequestType = type;
+	req->ucr_request.bRequest = request;
+	USETW(req->ucr_request.wValue, value);
+	USETW(req->ucr_request.wIndex, index);
+	USETW(req->ucr_request.wLength, len);
+	req->ucr_data = pf->pf_data;
+	req->ucr_flags = flags;
+	usbq_submit(pp->q, &pf->pf_q);
+	pp->out++;
+}
+
+/* Strings are asked for the way getstringdesc does. */
+void
+pf_string(struct prefetch *pp, struct usbdev *ud, int si)
+{
+	struct strkey key;
+	usb_string_descriptor_t us;
+
+	if (si == 0 || num || HASSTR(ud->pfstr, si))
+		return;
+	SETSTR(ud->pfstr, si);
+	key = ud->skey;
+	key.sk_index = si;
+	if (ud->keyed && strcache_get(&key, &us))
+		return;
+	pf_submit(pp, ud, UT_READ_DEVICE, UR_GET_DESCRIPTOR,
+	    UDESC_STRING << 8 | si, 0, sizeof(usb_string_descriptor_t),
+	    USBD_SHORT_XFER_OK);
+}
+
+/* Follow up on a whole configuration descriptor. */
+void
+pf_config(struct prefetch *pp, struct usbdev *ud, const u_char *p, int len)
+{
+	const u_char *e = p + len;
+	usb_hid_descriptor_t *hid;
+	int class = -1, ifc = 0, k;
+
+	pf_string(pp, ud, p[6]);
+	for (; p + 2 <= e && p[0] >= 2 && p + p[0] <= e; p += p[0]) {
+		if (p[1] == UDESC_INTERFACE && p[0] >= 9) {
+			ifc = p[2];
+			class = p[5];
+			pf_string(pp, ud, p[8]);
+		} else if (p[1] == UDESC_CS_DEVICE && class == UICLASS_HID) {
+			hid = (usb_hid_descriptor_t *)p;
+			for (k = 0; k < hid->bNumDescriptors &&
+			    6 + 3 * (k + 1) <= hid->bLength; k++)
+				if (hid->descrs[k].bDescriptorType ==
+				    UDESC_REPORT)
+					pf_submit(pp, ud, UT_READ_INTERFACE,
+					    UR_GET_DESCRIPTOR,
+					    UDESC_REPORT << 8 | k, ifc,
+					    UGETW(hid->descrs[k].wDescriptorLength),
+					    0);
+		}
+	}
+}
+
+void
+pf_done(struct prefetch *pp, struct pfent *pf)
+{
+	struct usbdev *ud = pf->pf_q.uq_arg;
+	struct usb_ctl_request *req = &pf->pf_q.uq_req;
+	usb_device_descriptor_t *dd;
+	usb_hub_descriptor_t *hd;
+	int value, n, i, tlen;
+
+	pf->pf_next = pfcache[ud->addr];
+	pfcache[ud->addr] = pf;
+	if (pf->pf_q.uq_error)
+		return;
+	value = UGETW(req->ucr_request.wValue);
+	n = req->ucr_actlen;
+	switch (req->ucr_request.bmRequestType << 8 |
+	    req->ucr_request.bRequest) {
+	case UT_READ_DEVICE << 8 | UR_GET_DESCRIPTOR:
+		if (value >> 8 == UDESC_DEVICE) {
+			dd = (usb_device_descriptor_t *)pf->pf_data;
+			for (i = 0; i < dd->bNumConfigurations; i++)
+				pf_submit(pp, ud, UT_READ_DEVICE,
+				    UR_GET_DESCRIPTOR, UDESC_CONFIG << 8 | i, 0,
+				    CONFIG_SPECULATE, USBD_SHORT_XFER_OK);
+			pf_submit(pp, ud, UT_READ_DEVICE, UR_GET_CONFIG, 0, 0,
+			    1, 0);
+			pf_string(pp, ud, dd->iManufacturer);
+			pf_string(pp, ud, dd->iProduct);
+			pf_string(pp, ud, dd->iSerialNumber);
+			if (dd->bDeviceClass == UICLASS_HUB) {
+				pf_submit(pp, ud, UT_READ_CLASS_DEVICE,
+				    UR_GET_DESCRIPTOR, 0, 0,
+				    sizeof(usb_hub_descriptor_t),
+				    USBD_SHORT_XFER_OK);
+				pf_submit(pp, ud, UT_READ_CLASS_DEVICE,
+				    UR_GET_STATUS, 0, 0, 4, 0);
+			}
+		} else if (value >> 8 == UDESC_CONFIG &&
+		    n >= USB_CONFIG_DESCRIPTOR_SIZE) {
+			tlen = UGETW(pf->pf_data + 2);
+			if (tlen > n && n == UGETW(req->ucr_request.wLength))
+				pf_submit(pp, ud, UT_READ_DEVICE,
+				    UR_GET_DESCRIPTOR, value, 0, tlen,
+				    USBD_SHORT_XFER_OK);
+			else
+				pf_config(pp, ud, pf->pf_data,
+				    tlen < n ? tlen : n);
+		}
+		break;
+	case UT_READ_CLASS_DEVICE << 8 | UR_GET_DESCRIPTOR:
+		hd = (usb_hub_descriptor_t *)pf->pf_data;
+		for (i = 1; i <= hd->bNbrPorts; i++)
+			pf_submit(pp, ud, UT_READ_CLASS_OTHER, UR_GET_STATUS,
+			    0, i, 4, 0);
+		break;
+	}
+}
+
+void
+prefetch(struct usbbus *ub, struct usbdev *devs, int ndevs, int depth,
+	 int verbose)
+{
+	struct prefetch pp;
+	struct usbq_stats st;
+	struct pfent *pf;
+	int i;
+
+	pp.q = usbq_open(ub, depth);
+	pp.depth = depth;
+	pp.out = 0;
+	pp.done = NULL;
+	pp.donetail = &pp.done;
+	for (i = 0; i < ndevs; i++)
+		if (!devs[i].cached)
+			pf_submit(&pp, &devs[i], UT_READ_DEVICE,
+			    UR_GET_DESCRIPTOR, UDESC_DEVICE << 8, 0,
+			    USB_DEVICE_DESCRIPTOR_SIZE, 0);
+	while (pp.out > 0 || pp.done != NULL) {
+		if (pp.done == NULL)
+			pf_reap(&pp);
+		pf = pp.done;
+		if ((pp.done = pf->pf_next) == NULL)
+			pp.donetail = &pp.done;
+		pf_done(&pp, pf);
+	}
+	if (verbose) {
+		usbq_stats(pp.q, &st);
+		fprintf(stderr, "prefetch: %lu requests, max depth %d, "
+		    "latency avg %.3f max %.3f ms\n", st.qs_completed,
+		    st.qs_maxdepth, st.qs_completed ?
+		    st.qs_latsum / st.qs_completed * 1e3 : 0.0,
+		    st.qs_latmax * 1e3);
+	}
+	usbq_close(pp.q);
+}
+
+/*
+ * Hub monitor, -M.  The tree is built from the port maps the kernel
+ * keeps for every hub (usbbus_devinfo, no bus traffic), which are read
+ * again after every event and at the latest every interval ms.  Only
+ * a port whose map entry changed, or that has the device an event
+ * names, is asked for its status: on a chain of 7 port hubs asking
+ * them all each time costs more than the events are worth.  What
+ * differs from the last look is reported, and so is any bit newly set
+ * in wPortChange; the hub driver clears those, so they are only read.
+ * Ports are asked once when their hub is first watched, to have
+ * something to compare with.  Where ports cannot be asked (sysfs), the
+ * maps are all there is.
+ */
+struct monhub {
+	int		mh_hub;		/* 1 if a hub being watched */
+	int		mh_tier;	/* 1 for a root hub */
+	int		mh_nports;
+	u_int8_t	mh_ports[16];	/* as in udi_ports */
+	u_int16_t	mh_status[16];	/* wPortStatus last seen */
+	u_int16_t	mh_change[16];	/* wPortChange last seen */
+};
+
+struct monhub monhubs[USB_MAX_DEVICES];
+
+const struct {
+	u_int16_t	mb_bit;
+	u_int16_t	mb_change;
+	const char	*mb_on, *mb_off;
+} monbits[] = {
+	{ UPS_PORT_POWER, 0, "power on", "power off" },
+	{ UPS_CURRENT_CONNECT_STATUS, UPS_C_CONNECT_STATUS,
+	  "connect", "disconnect" },
+	{ UPS_RESET, UPS_C_PORT_RESET, "reset", "reset done" },
+	{ UPS_PORT_ENABLED, UPS_C_PORT_ENABLED, "enable", "disable" },
+	{ UPS_SUSPEND, UPS_C_SUSPEND, "suspend", "resume" },
+	{ UPS_OVERCURRENT_INDICATOR, UPS_C_OVERCURRENT_INDICATOR,
+	  "overcurrent", "overcurrent cleared" },
+};
+
+#define ISADDR(p)	((p) > 0 && (p) < USB_MAX_DEVICES)
+
+/* What a port map entry says about a port's status. */
+u_int16_t
+monstate(u_int8_t p)
+{
+	if (ISADDR(p))
+		return UPS_PORT_POWER | UPS_CURRENT_CONNECT_STATUS |
+		    UPS_PORT_ENABLED;
+	switch (p) {
+	case USB_PORT_ENABLED:
+		return UPS_PORT_POWER | UPS_PORT_ENABLED;
+	case USB_PORT_SUSPENDED:
+		return UPS_PORT_POWER | UPS_PORT_ENABLED | UPS_SUSPEND;
+	case USB_PORT_POWERED:
+		return UPS_PORT_POWER;
+	default:
+		return 0;
+	}
+}
+
+/* The status and change bits of port i, or what the map entry p says. */
+void
+monget(struct usbbus *ub, int addr, int i, u_int8_t p, u_int16_t *st,
+       u_int16_t *ch)
+{
+	struct usbdev ud;
+	usb_port_status_t ps;
+
+	setupdev(&ud, ub, addr, stdout);
+	if (getportstatus(&ud, i, &ps) == 0) {
+		*st = UGETW(ps.wPortStatus);
+		*ch = UGETW(ps.wPortChange);
+	} else {
+		*st = monstate(p);
+		*ch = 0;
+	}
+}
+
+void
+montime(const struct timespec *ts)
+{
+	struct timespec now;
+	struct tm tm;
+	char buf[32];
+
+	if (ts == NULL || ts->tv_sec == 0) {
+		clock_gettime(CLOCK_REALTIME, &now);
+		ts = &now;
+	}
+	localtime_r(&ts->tv_sec, &tm);
+	strftime(buf, sizeof buf, "%H:%M:%S", &tm);
+	printf("%s.%03ld ", buf, ts->tv_nsec / 1000000);
+}
+
+/* Start watching the hub at addr, and every hub below it. */
+void
+monadd(struct usbbus *ub, int addr, int tier, int print)
+{
+	struct monhub *mh = &monhubs[addr];
+	struct usb_device_info di;
+	int i;
+
+	di.udi_addr = addr;
+	if (usbbus_devinfo(ub, &di) < 0 || di.udi_class != UICLASS_HUB)
+		return;
+	mh->mh_hub = 1;
+	mh->mh_tier = tier;
+	mh->mh_nports = di.udi_nports < 16 ? di.udi_nports : 16;
+	if (print)
+		printf("%*shub %d: %d ports%s%s\n", 2 * (tier - 1), "", addr,
+		    di.udi_nports, di.udi_product[0] ? ", " : "",
+		    di.udi_product);
+	for (i = 0; i < mh->mh_nports; i++) {
+		mh->mh_ports[i] = di.udi_ports[i];
+		monget(ub, addr, i + 1, di.udi_ports[i], &mh->mh_status[i],
+		    &mh->mh_change[i]);
+		if (!ISADDR(di.udi_ports[i]))
+			continue;
+		if (print)
+			printf("%*sport %d: addr %d\n", 2 * tier, "", i + 1,
+			    di.udi_ports[i]);
+		monadd(ub, di.udi_ports[i], tier + 1, print);
+	}
+}
+
+/* Stop watching addr and whatever hangs off it. */
+void
+mondel(int addr)
+{
+	struct monhub *mh = &monhubs[addr];
+	int i;
+
+	if (!mh->mh_hub)
+		return;
+	mh->mh_hub = 0;
+	for (i = 0; i < mh->mh_nports; i++)
+		if (ISADDR(mh->mh_ports[i]))
+			mondel(mh->mh_ports[i]);
+}
+
+/*
+ * Look at port i of hub addr, which the port map now has as p, and
+ * print what happened since the last look.  A change bit newly set
+ * with no difference in status means it went and came back (or came
+ * and went) in between.
+ */
+void
+monport(struct usbbus *ub, int addr, int i, u_int8_t p)
+{
+	struct monhub *mh = &monhubs[addr];
+	u_int16_t st, ch, was = mh->mh_status[i - 1];
+	u_int8_t old = mh->mh_ports[i - 1];
+	size_t k;
+
+	monget(ub, addr, i, p, &st, &ch);
+	for (k = 0; k < sizeof monbits / sizeof monbits[0]; k++) {
+		if (!((st ^ was) & monbits[k].mb_bit) &&
+		    !(ch & ~mh->mh_change[i - 1] & monbits[k].mb_change))
+			continue;
+		montime(NULL);
+		printf("hub %d port %d: ", addr, i);
+		if ((st ^ was) & monbits[k].mb_bit)
+			printf("%s", st & monbits[k].mb_bit ?
+			    monbits[k].mb_on : monbits[k].mb_off);
+		else if (st & monbits[k].mb_bit)
+			printf("%s, %s", monbits[k].mb_off, monbits[k].mb_on);
+		else
+			printf("%s, %s", monbits[k].mb_on, monbits[k].mb_off);
+		if (monbits[k].mb_bit == UPS_CURRENT_CONNECT_STATUS) {
+			if (ISADDR(old))
+				printf(" (was addr %d)", old);
+			if (ISADDR(p))
+				printf(" (addr %d)", p);
+		}
+		printf("\n");
+	}
+	mh->mh_ports[i - 1] = p;
+	mh->mh_status[i - 1] = st;
+	mh->mh_change[i - 1] = ch;
+	if (old == p)
+		return;
+	if (ISADDR(old))
+		mondel(old);
+	if (ISADDR(p))
+		monadd(ub, p, mh->mh_tier + 1, 0);
+}
+
+/*
+ * Read every watched hub's port map, and look at the ports whose entry
+ * changed or that have evaddr, the device an event names, on them now
+ * or had it before (0 for none).
+ */
+void
+monsweep(struct usbbus *ub, int evaddr)
+{
+	struct usb_device_info di;
+	u_int8_t p, old;
+	int addr, i;
+
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		if (!monhubs[addr].mh_hub)
+			continue;
+		di.udi_addr = addr;
+		if (usbbus_devinfo(ub, &di) < 0) {
+			montime(NULL);
+			printf("hub %d: gone\n", addr);
+			mondel(addr);
+			continue;
+		}
+		for (i = 0; i < monhubs[addr].mh_nports; i++) {
+			p = di.udi_ports[i];
+			old = monhubs[addr].mh_ports[i];
+			if (p != old || (evaddr && (p == evaddr ||
+			    old == evaddr)))
+				monport(ub, addr, i + 1, p);
+		}
+	}
+}
+
+void
+monitor(struct usbbus *ub, int interval)
+{
+	struct usb_device_info di;
+	struct usb_event ue;
+	u_char hub[USB_MAX_DEVICES], below[USB_MAX_DEVICES];
+	int addr, i, r, evaddr;
+
+	/* Root hubs are the hubs on no other hub's ports. */
+	memset(hub, 0, sizeof hub);
+	memset(below, 0, sizeof below);
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		di.udi_addr = addr;
+		if (usbbus_devinfo(ub, &di) < 0 || di.udi_class != UICLASS_HUB)
+			continue;
+		hub[addr] = 1;
+		for (i = 0; i < di.udi_nports && i < 16; i++)
+			if (ISADDR(di.udi_ports[i]))
+				below[di.udi_ports[i]] = 1;
+	}
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++)
+		if (hub[addr] && !below[addr])
+			monadd(ub, addr, 1, 1);
+	for (;;) {
+		fflush(stdout);
+		r = usbbus_event(ub, &ue, interval);
+		if (r < 0 && errno != EINTR)
+			err(1, "usbbus_event");
+		evaddr = 0;
+		if (r > 0 && (ue.ue_type == USB_EVENT_DEVICE_ATTACH ||
+		    ue.ue_type == USB_EVENT_DEVICE_DETACH)) {
+			evaddr = ue.u.ue_device.udi_addr;
+			montime(&ue.ue_time);
+			printf("addr %d: %s%s%s\n", ue.u.ue_device.udi_addr,
+			    ue.ue_type == USB_EVENT_DEVICE_ATTACH ?
+			    "attach" : "detach",
+			    ue.u.ue_device.udi_product[0] ? ", " : "",
+			    ue.u.ue_device.udi_product);
+		}
+		monsweep(ub, evaddr);
+	}
+}
+
+/*
+ * Periodic bandwidth, -b.  The interrupt and isochronous endpoints of
+ * the current alternate setting of every interface in each device's
+ * current configuration are costed in bus time per transaction with
+ * the formulas of USB 2.0 section 5.11.3, as host controller drivers
+ * do, times the high bandwidth multiplier in wMaxPacketSize.  The load
+ * is that of the worst (micro)frame, the one where every endpoint is
+ * due at once: a transaction has to fit in the frame it is in, however
+ * seldom it comes, and the scheduler is not relied on to spread them.
+ * The largest alternate setting of each interface is what the device
+ * may come to need, say when an audio stream starts, and is given as
+ * the most it can take.
+ *
+ * High speed load is in us per 125 us microframe, of which 100 may be
+ * periodic; full and low speed in us per 1 ms frame, of which 900 may.
+ * A full or low speed device below a high speed hub is carried by that
+ * hub's transaction translator (taken to be a single one), anything
+ * else by the controller.  Its split transactions take high speed time
+ * as well, on the hubs above the translator and on the controller; a
+ * microframe carries at most the part of a split with the data in it,
+ * and no more than the 188 bytes the translator moves per microframe.
+ * Totals are given for each hub, covering everything below it, for
+ * each translator and for the controller, and a budget near or over
+ * its limit is flagged.  Super speed devices are not counted.
+ */
+#define BW_HSLIMIT	100.0		/* us per microframe */
+#define BW_FSLIMIT	900.0		/* us per frame */
+#define BW_NEAR		0.8
+#define BW_HOSTDELAY	1000		/* ns */
+#define BW_LSSETUP	333		/* ns, hub setup for low speed */
+#define BW_TTBYTES	188		/* per microframe through a TT */
+#define BITTIME(n)	(7 * 8 * (n) / 6)	/* with worst case stuffing */
+
+struct bwdev {
+	int	bw_speed;	/* 0 if no device */
+	int	bw_parent;	/* hub it is on, 0 for a root hub */
+	int	bw_tt;		/* hub translating for it, or 0 */
+	int	bw_dom;		/* 0 high speed, 1 full, -1 not counted */
+	double	bw_now;		/* us per (micro)frame */
+	double	bw_max;
+	double	bw_snow;	/* us per microframe of split transactions */
+	double	bw_smax;
+};
+
+struct bwdev bwdevs[USB_MAX_DEVICES];
+
+const char *bwspeeds[] = { "unknown", "low", "full", "high", "super" };
+
+/* ns of bus time for one transaction of n bytes. */
+long
+bwtime(int speed, int type, int in, int n)
+{
+	switch (speed) {
+	case USB_SPEED_LOW:
+		return (in ? 64060 : 64107) + 2 * BW_LSSETUP + BW_HOSTDELAY +
+		    67667L * (31 + 10 * BITTIME(n)) / 1000;
+	case USB_SPEED_FULL:
+		return (type != UE_ISOCHRONOUS ? 9107 : in ? 7268 : 6265) +
+		    BW_HOSTDELAY + 8354L * (31 + 10 * BITTIME(n)) / 1000;
+	default:
+		return ((type == UE_ISOCHRONOUS ? 38 : 55) * 8 * 2083L +
+		    2083L * (3 + BITTIME(n))) / 1000 + 5;
+	}
+}
+
+/*
+ * us in the worst (micro)frame for an alternate setting, listing it if
+ * print.  With split, the high speed us per microframe of its split
+ * transactions go there.
+ */
+double
+bwalt(int speed, struct udesc_index *ux, int a, int print, double *split)
+{
+	usb_endpoint_descriptor_t *ed;
+	int e, type, size, mult, ival, in;
+	double t, sum = 0;
+
+	if (split)
+		*split = 0;
+	for (e = 0; e < ux->ux_alts[a].ua_nep; e++) {
+		ed = UDESC_EP(ux, a, e);
+		type = UE_GET_XFERTYPE(ed->bmAttributes);
+		if (type != UE_ISOCHRONOUS && type != UE_INTERRUPT)
+			continue;
+		size = UE_GET_SIZE(UGETW(ed->wMaxPacketSize));
+		mult = 1;
+		ival = ed->bInterval < 1 ? 1 : ed->bInterval;
+		if (speed == USB_SPEED_HIGH) {
+			mult += UE_GET_TRANS(UGETW(ed->wMaxPacketSize));
+			if (mult > 3)
+				mult = 3;
+		}
+		if (speed == USB_SPEED_HIGH || type == UE_ISOCHRONOUS)
+			ival = 1 << (ival > 16 ? 15 : ival - 1);
+		in = UE_GET_DIR(ed->bEndpointAddress) == UE_DIR_IN;
+		t = mult * bwtime(speed, type, in, size) / 1e3;
+		sum += t;
+		if (split)
+			*split += bwtime(USB_SPEED_HIGH, type, in,
+			    size < BW_TTBYTES ? size : BW_TTBYTES) / 1e3;
+		if (print)
+			printf("  endpoint 0x%02x %s %dx%d bytes every %d %s: "
+			    "%.1f us\n", ed->bEndpointAddress, xfernames[type],
+			    mult, size, ival, speed == USB_SPEED_HIGH ?
+			    "uframes" : "frames", t);
+	}
+	return sum;
+}
+
+void
+bwdevice(struct usbbus *ub, int addr, struct usb_device_info *di)
+{
+	struct bwdev *bw = &bwdevs[addr];
+	struct usbdev ud;
+	usb_device_descriptor_t dd;
+	usb_config_descriptor_t *cd = NULL;
+	usb_interface_descriptor_t *id;
+	struct udesc_index ux;
+	double now, most, t, snow, smost, *sp;
+	u_int8_t alt;
+	int i, k, a, a0, amax, len;
+
+	printf("addr %d: %s speed", addr, bwspeeds[bw->bw_speed < 5 ?
+	    bw->bw_speed : 0]);
+	if (bw->bw_parent)
+		printf(", on hub %d", bw->bw_parent);
+	if (bw->bw_tt)
+		printf(", translated by hub %d", bw->bw_tt);
+	printf("%s%s\n", di->udi_product[0] ? ", " : "", di->udi_product);
+	if (bw->bw_dom < 0) {
+		printf("  not counted\n");
+		return;
+	}
+	if (di->udi_config == 0) {
+		printf("  not configured\n");
+		return;
+	}
+	setupdev(&ud, ub, addr, stdout);
+	setupkey(&ud, di);
+	startdev(&ud);
+	if (getdevicedesc(&ud, &dd) == 0)
+		for (i = 0; i < dd.bNumConfigurations; i++)
+			if ((cd = getconfigdesc(&ud, i, &len)) != NULL &&
+			    cd->bConfigurationValue == di->udi_config)
+				break;
+	if (cd == NULL || cd->bConfigurationValue != di->udi_config) {
+		printf("  configuration %d: %s\n", di->udi_config,
+		    ud.error ? strerror(ud.error) : "not found");
+		afree(&ud.arena);
+		return;
+	}
+	udesc_parse(&ux, cd, len, &ud.arena);
+	sp = bw->bw_tt ? &t : NULL;
+	snow = smost = 0;
+	for (k = 0; k < ux.ux_nifcs; k++) {
+		a0 = ux.ux_ifcs[k];
+		id = UDESC_IFC(&ux, a0);
+		a = a0;
+		if (ux.ux_alts[a0].ua_next != UDESC_NONE &&
+		    getinterface(&ud, id->bInterfaceNumber, &alt) == 0 &&
+		    (a = udesc_findalt(&ux, id->bInterfaceNumber, alt)) < 0)
+			a = a0;
+		now = bwalt(bw->bw_speed, &ux, a, 1, sp);
+		snow = sp ? t : 0;
+		most = now;
+		smost = snow;
+		amax = a;
+		for (i = a0; i != UDESC_NONE; i = ux.ux_alts[i].ua_next)
+			if ((t = bwalt(bw->bw_speed, &ux, i, 0, NULL)) > most) {
+				most = t;
+				amax = i;
+				if (sp)
+					bwalt(bw->bw_speed, &ux, i, 0, &smost);
+			}
+		if (amax != a)
+			printf("  interface %d: alt %d now, %.1f us at alt %d\n",
+			    id->bInterfaceNumber, UDESC_IFC(&ux, a)->
+			    bAlternateSetting, most,
+			    UDESC_IFC(&ux, amax)->bAlternateSetting);
+		bw->bw_now += now;
+		bw->bw_max += most;
+		bw->bw_snow += snow;
+		bw->bw_smax += smost;
+	}
+	if (bw->bw_tt && bw->bw_snow > 0)
+		printf("  split transactions: %.1f us per microframe high "
+		    "speed now, %.1f at most\n", bw->bw_snow, bw->bw_smax);
+	if (ud.error)
+		printf("  partial: %s: %s\n", ud.what, strerror(ud.error));
+	afree(&ud.arena);
+}
+
+/* One budget against its limit. */
+void
+bwbudget(const char *what, double now, double most, int dom)
+{
+	double limit = dom ? BW_FSLIMIT : BW_HSLIMIT;
+
+	printf("%s: %.1f of %.0f us per %s now (%.0f%%), %.1f at most "
+	    "(%.0f%%)", what, now, limit, dom ? "frame" : "microframe",
+	    100 * now / limit, most, 100 * most / limit);
+	if (now > limit)
+		printf(", OVER THE LIMIT");
+	else if (now >= BW_NEAR * limit)
+		printf(", near the limit");
+	else if (most > limit)
+		printf(", can go over the limit");
+	else if (most >= BW_NEAR * limit)
+		printf(", can get near the limit");
+	printf("\n");
+}
+
+void
+bandwidth(struct usbbus *ub, const char *name)
+{
+	struct usb_device_info di;
+	struct bwdev *bw;
+	double hnow[2], hmax[2], cnow[2] = { 0, 0 }, cmax[2] = { 0, 0 };
+	double tnow, tmax;
+	char what[64];
+	int addr, d, p, i;
+
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		di.udi_addr = addr;
+		if (usbbus_devinfo(ub, &di) < 0)
+			continue;
+		bwdevs[addr].bw_speed = di.udi_speed ? di.udi_speed :
+		    USB_SPEED_FULL;
+		if (di.udi_class != UICLASS_HUB)
+			continue;
+		for (i = 0; i < di.udi_nports && i < 16; i++)
+			if (ISADDR(di.udi_ports[i]))
+				bwdevs[di.udi_ports[i]].bw_parent = addr;
+	}
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		bw = &bwdevs[addr];
+		if (bw->bw_speed == 0)
+			continue;
+		bw->bw_dom = bw->bw_speed == USB_SPEED_SUPER ? -1 :
+		    bw->bw_speed == USB_SPEED_HIGH ? 0 : 1;
+		for (p = bw->bw_parent; bw->bw_dom == 1 && p;
+		    p = bwdevs[p].bw_parent)
+			if (bwdevs[p].bw_speed == USB_SPEED_HIGH &&
+			    bwdevs[p].bw_parent) {
+				bw->bw_tt = p;
+				break;
+			}
+		di.udi_addr = addr;
+		if (usbbus_devinfo(ub, &di) == 0)
+			bwdevice(ub, addr, &di);
+	}
+	printf("\n");
+
+	for (addr = 1; addr < USB_MAX_DEVICES; addr++) {
+		di.udi_addr = addr;
+		if (bwdevs[addr].bw_speed == 0 ||
+		    usbbus_devinfo(ub, &di) < 0 || di.udi_class != UICLASS_HUB)
+			continue;
+		hnow[0] = hnow[1] = hmax[0] = hmax[1] = 0;
+		tnow = tmax = 0;
+		for (d = 1; d < USB_MAX_DEVICES; d++) {
+			bw = &bwdevs[d];
+			if (bw->bw_speed == 0 || bw->bw_dom < 0)
+				continue;
+			for (p = d; p && p != addr; p = bwdevs[p].bw_parent)
+				;
+			if (p == addr) {
+				hnow[bw->bw_dom] += bw->bw_now;
+				hmax[bw->bw_dom] += bw->bw_max;
+			}
+			/* Splits load the translator's hub and those above. */
+			for (p = bw->bw_tt; p && p != addr;
+			    p = bwdevs[p].bw_parent)
+				;
+			if (bw->bw_tt && p == addr) {
+				hnow[0] += bw->bw_snow;
+				hmax[0] += bw->bw_smax;
+			}
+			if (bw->bw_tt == addr) {
+				tnow += bw->bw_now;
+				tmax += bw->bw_max;
+			}
+		}
+		printf("hub %d and below: %.1f us per microframe high speed, "
+		    "%.1f per frame full speed now; %.1f and %.1f at most\n",
+		    addr, hnow[0], hnow[1], hmax[0], hmax[1]);
+		if (bwdevs[addr].bw_speed == USB_SPEED_HIGH &&
+		    bwdevs[addr].bw_parent) {
+			snprintf(what, sizeof what,
+			    "hub %d transaction translator", addr);
+			bwbudget(what, tnow, tmax, 1);
+		}
+	}
+	for (d = 1; d < USB_MAX_DEVICES; d++) {
+		bw = &bwdevs[d];
+		if (bw->bw_speed && bw->bw_dom >= 0 && bw->bw_tt == 0) {
+			cnow[bw->bw_dom] += bw->bw_now;
+			cmax[bw->bw_dom] += bw->bw_max;
+		}
+		cnow[0] += bw->bw_snow;
+		cmax[0] += bw->bw_smax;
+	}
+	snprintf(what, sizeof what, "%s high speed", name);
+	bwbudget(what, cnow[0], cmax[0], 0);
+	snprintf(what, sizeof what, "%s full speed", name);
+	bwbudget(what, cnow[1], cmax[1], 1);
+}
+
+/*
+ * Snapshots, -S file.  A device whose identity is what the snapshot
+ * has for its address gets all its answers from the mapped file,
+ * through the prefetch cache, and is not read at all.  The others are
+ * read with pfrecord on, and everything goes into a new snapshot at
+ * the end.  With -D, what changed is listed instead of the dump.
+ */
+struct snap *snap;
+char *snapfile;
+int snapdiff;
+
+void
+snapident(struct usbdev *ud, struct usb_device_info *di)
+{
+	struct snapid *id = &ud->sid;
+	int i;
+
+	memset(id, 0, sizeof *id);
+	id->si_vendor = di->udi_vendorNo;
+	id->si_product = di->udi_productNo;
+	id->si_release = di->udi_releaseNo;
+	id->si_class = di->udi_class;
+	id->si_config = di->udi_config;
+	id->si_serial = ud->skey.sk_serial;
+	id->si_nports = di->udi_nports < 16 ? di->udi_nports : 16;
+	for (i = 0; i < id->si_nports; i++)
+		id->si_ports[i] = di->udi_ports[i];
+}
+
+/* Serve ud from the snapshot if it has not changed, else say how. */
+void
+snapcheck(struct usbdev *ud, struct usb_device_info *di)
+{
+	const struct snapdev *sd = snap_dev(snap, ud->addr);
+	const struct snapid *o, *n = &ud->sid;
+	const struct snaprec *sr;
+	struct usb_ctl_request *req;
+	struct pfent *pf;
+
+	snapident(ud, di);
+	if (sd && memcmp(&sd->sd_id, n, sizeof *n) == 0) {
+		for (sr = NULL; (sr = snap_next(snap, sd, sr)) != NULL; ) {
+			if ((pf = calloc(1, sizeof *pf)) == NULL)
+				err(1, "calloc");
+			req = &pf->pf_q.uq_req;
+			req->ucr_addr = ud->addr;
+			req->ucr_request.bmRequestType = sr->sr_type;
+			req->ucr_request.bRequest = sr->sr_request;
+			USETW(req->ucr_request.wValue, sr->sr_value);
+			USETW(req->ucr_request.wIndex, sr->sr_index);
+			USETW(req->ucr_request.wLength, sr->sr_length);
+			req->ucr_data = (void *)SNAPDATA(sr);
+			req->ucr_actlen = sr->sr_actlen;
+			pf->pf_next = pfcache[ud->addr];
+			pfcache[ud->addr] = pf;
+		}
+		ud->cached = 1;
+		return;
+	}
+	if (!snapdiff)
+		return;
+	printf("addr %d: %s %04x:%04x %s", ud->addr, sd ? "changed" : "new",
+	    n->si_vendor, n->si_product, di->udi_product);
+	if (sd == NULL) {
+		printf("\n");
+		return;
+	}
+	o = &sd->sd_id;
+	if (o->si_vendor != n->si_vendor || o->si_product != n->si_product)
+		printf(", was %04x:%04x", o->si_vendor, o->si_product);
+	if (o->si_release != n->si_release)
+		printf(", release %x.%02x -> %x.%02x", o->si_release >> 8,
+		    o->si_release & 0xff, n->si_release >> 8,
+		    n->si_release & 0xff);
+	if (o->si_serial != n->si_serial)
+		printf(", serial");
+	if (o->si_class != n->si_class)
+		printf(", class %d -> %d", o->si_class, n->si_class);
+	if (o->si_config != n->si_config)
+		printf(", config %d -> %d", o->si_config, n->si_config);
+	if (o->si_nports != n->si_nports ||
+	    memcmp(o->si_ports, n->si_ports, sizeof o->si_ports) != 0)
+		printf(", ports");
+	printf("\n");
+}
+
+void
+snapgone(int addr)
+{
+	const struct snapdev *sd;
+
+	if (snapdiff && (sd = snap_dev(snap, addr)) != NULL)
+		printf("addr %d: gone %04x:%04x\n", addr,
+		    sd->sd_id.si_vendor, sd->sd_id.si_product);
+}
+
+/*
+ * Write the new snapshot: the devices just seen, and with -a the
+ * other addresses as they were.  Answers are written oldest first so
+ * that they come back in the same order.
+ */
+void
+snapsave(struct usbdev *devs, int ndevs, int only)
+{
+	const struct snapdev *sd;
+	const struct snaprec *sr;
+	struct usb_ctl_request *req;
+	struct snapw *sw;
+	struct pfent *pf, **v = NULL;
+	usb_device_request_t dr;
+	int addr, i, n, k;
+
+	sw = snapw_begin();
+	for (addr = i = 0; addr < USB_MAX_DEVICES; addr++) {
+		if (i < ndevs && devs[i].addr == addr) {
+			snapw_dev(sw, addr, &devs[i++].sid);
+			for (n = 0, pf = pfcache[addr]; pf; pf = pf->pf_next)
+				n++;
+			if ((v = realloc(v, (n + 1) * sizeof *v)) == NULL)
+				err(1, "realloc");
+			for (k = n, pf = pfcache[addr]; pf; pf = pf->pf_next)
+				v[--k] = pf;
+			for (k = 0; k < n; k++) {
+				req = &v[k]->pf_q.uq_req;
+				if (!v[k]->pf_q.uq_error)
+					snapw_rec(sw, &req->ucr_request,
+					    req->ucr_data, req->ucr_actlen);
+			}
+		} else if (only != -1 && addr != only &&
+		    (sd = snap_dev(snap, addr)) != NULL) {
+			snapw_dev(sw, addr, &sd->sd_id);
+			for (sr = NULL; (sr = snap_next(snap, sd, sr)) != NULL; ) {
+				dr.bmRequestType = sr->sr_type;
+				dr.bRequest = sr->sr_request;
+				USETW(dr.wValue, sr->sr_value);
+				USETW(dr.wIndex, sr->sr_index);
+				USETW(dr.wLength, sr->sr_length);
+				snapw_rec(sw, &dr, SNAPDATA(sr), sr->sr_actlen);
+			}
+		}
+	}
+	free(v);
+	if (snapw_write(sw, snapfile) < 0)
+		warn("%s", snapfile);
+}
+
+/*
+ * Batch decoding, -B path.  path is a blob file, an archive of -o bin
+ * records, or a directory searched recursively for either.  A blob
+ * file is what a sim: bus reads for one address (named by it), or a
+ * bare configuration descriptor, which gets a made up device
+ * descriptor.  Each record of an archive becomes a blob of its own.
+ *
+ * Blobs are decoded by the -j workers, by default one per CPU, each on
+ * a private simulated bus that is only open, and the file only mapped,
+ * while a worker has it; the results come out in order and the totals
+ * go to stderr.
+ */
+struct blob {
+	char		*bl_name;
+	const u_char	*bl_rec;	/* record in an archive, or NULL */
+	size_t		bl_reclen;
+	void		*bl_map;	/* blob file, while open */
+	size_t		bl_maplen;
+	struct obuf	bl_ob;		/* blob made up by blobopen */
+};
+
+struct blob *blobs;
+int nblobs, maxblobs;
+struct usbdev *blobdevs;
+
+struct {
+	u_long	bs_bad;			/* could not be decoded at all */
+	u_long	bs_partial;
+	u_long	bs_unknown;		/* descriptors */
+	u_long	bs_devclass[256];
+	u_long	bs_ifclass[256];	/* of alternate setting 0 */
+} bstat;
+
+void
+blobadd(const char *name, const u_char *rec, size_t reclen)
+{
+	struct blob *bl;
+
+	if (nblobs == maxblobs) {
+		maxblobs = maxblobs ? maxblobs * 2 : 256;
+		if ((blobs = realloc(blobs, maxblobs * sizeof *blobs)) == NULL)
+			err(1, "realloc");
+	}
+	bl = &blobs[nblobs++];
+	memset(bl, 0, sizeof *bl);
+	if ((bl->bl_name = strdup(name)) == NULL)
+		err(1, "strdup");
+	bl->bl_rec = rec;
+	bl->bl_reclen = reclen;
+}
+
+/* Add a blob file, or every record of an archive. */
+void
+blobfile(const char *path)
+{
+	struct stat st;
+	u_char b[5], *map;
+	char name[1100];
+	size_t off, len;
+	int fd, k;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		warn("%s", path);
+		bstat.bs_bad++;
+		return;
+	}
+	if (fstat(fd, &st) < 0 || read(fd, b, sizeof b) != sizeof b)
+		goto bad;
+	if ((b[0] == USB_DEVICE_DESCRIPTOR_SIZE && b[1] == UDESC_DEVICE) ||
+	    (b[0] == USB_CONFIG_DESCRIPTOR_SIZE && b[1] == UDESC_CONFIG)) {
+		close(fd);
+		blobadd(path, NULL, 0);
+		return;
+	}
+	if (b[4] != OB_ADDR)
+		goto bad;
+	/* An archive stays mapped; its records point into it. */
+	map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		warn("%s", path);
+		bstat.bs_bad++;
+		return;
+	}
+	for (off = 0, k = 0; off + 4 <= (size_t)st.st_size; k++) {
+		len = UGETDW(map + off);
+		if (len > st.st_size - off - 4) {
+			warnx("%s: record %d truncated", path, k);
+			bstat.bs_bad++;
+			break;
+		}
+		snprintf(name, sizeof name, "%s#%d", path, k);
+		blobadd(name, map + off + 4, len);
+		off += 4 + len;
+	}
+	return;
+ bad:
+	warnx("%s: not a descriptor blob", path);
+	bstat.bs_bad++;
+	close(fd);
+}
+
+void
+blobdir(const char *path)
+{
+	struct dirent **ents;
+	struct stat st;
+	char name[1100];
+	int i, n;
+
+	if ((n = scandir(path, &ents, NULL, alphasort)) < 0) {
+		warn("%s", path);
+		return;
+	}
+	for (i = 0; i < n; i++) {
+		if (ents[i]->d_name[0] != '.') {
+			snprintf(name, sizeof name, "%s/%s", path,
+			    ents[i]->d_name);
+			if (stat(name, &st) < 0)
+				warn("%s", name);
+			else if (S_ISDIR(st.st_mode))
+				blobdir(name);
+			else if (S_ISREG(st.st_mode))
+				blobfile(name);
+		}
+		free(ents[i]);
+	}
+	free(ents);
+}
+
+/*
+ * Make a sim blob out of an archive record: the device descriptor,
+ * the configurations up to the first one missing, the strings with an
+ * empty one in each gap, and the hub descriptor.
+ */
+int
+blobrecord(struct blob *bl, int *addrp)
+{
+	static const u_char langs[] = { 4, UDESC_STRING, 0x09, 0x04 };
+	static const u_char empty[] = { 2, UDESC_STRING };
+	const u_char *p = bl->bl_rec, *e = p + bl->bl_reclen, *d;
+	const u_char *dd = NULL, *hub = NULL, *cfg[256], *str[256];
+	size_t cfglen[256], n;
+	struct obuf *ob = &bl->bl_ob;
+	int i, nc, ns;
+
+	memset(cfg, 0, sizeof cfg);
+	memset(str, 0, sizeof str);
+	for (; e - p >= 5; p = d + n) {
+		d = p + 5;
+		if ((n = UGETDW(p + 1)) > (size_t)(e - d))
+			break;
+		switch (p[0]) {
+		case OB_ADDR:
+			if (n >= 1 && d[0] > 0 && d[0] < USB_MAX_DEVICES)
+				*addrp = d[0];
+			break;
+		case OB_DEVICE:
+			if (n >= USB_DEVICE_DESCRIPTOR_SIZE)
+				dd = d;
+			break;
+		case OB_CONFIG:
+			if (n > USB_CONFIG_DESCRIPTOR_SIZE) {
+				cfg[d[0]] = d + 1;
+				cfglen[d[0]] = n - 1;
+			}
+			break;
+		case OB_STRING:
+			if (n >= 3 && d[1] >= 2 && d[1] < n)
+				str[d[0]] = d + 1;
+			break;
+		case OB_HUB:
+			if (n >= 2 && d[0] >= 2 && d[0] <= n)
+				hub = d;
+			break;
+		}
+	}
+	if (dd == NULL) {
+		warnx("%s: no device descriptor", bl->bl_name);
+		return -1;
+	}
+	for (nc = 0; nc < dd[17] && cfg[nc]; nc++)
+		;
+	for (ns = 255; ns > 0 && str[ns] == NULL; ns--)
+		;
+	ob_put(ob, dd, USB_DEVICE_DESCRIPTOR_SIZE);
+	ob->ob_buf[17] = nc;
+	for (i = 0; i < nc; i++) {
+		n = ob->ob_len;
+		ob_put(ob, cfg[i], cfglen[i]);
+		USETW(ob->ob_buf + n + 2, cfglen[i]);
+	}
+	for (i = 0; i <= ns && (ns > 0 || str[0]); i++) {
+		d = str[i] ? str[i] : i == 0 ? langs : empty;
+		ob_put(ob, d, d[0]);
+	}
+	if (hub)
+		ob_put(ob, hub, hub[0]);
+	return 0;
+}
+
+/* Before hook for dumpall: map the blob and put it on a bus. */
+int
+blobopen(struct usbdev *ud)
+{
+	struct blob *bl = &blobs[ud - blobdevs];
+	struct usb_device_info di;
+	struct usbbus *ub;
+	struct stat st;
+	const u_char *b;
+	const char *p;
+	size_t len, n;
+	int addr, fd;
+
+	p = strrchr(bl->bl_name, '/');
+	addr = atoi(p ? p + 1 : bl->bl_name);
+	if (addr <= 0 || addr >= USB_MAX_DEVICES)
+		addr = 1;
+	if (bl->bl_rec) {
+		if (blobrecord(bl, &addr) < 0)
+			goto bad;
+		b = bl->bl_ob.ob_buf;
+		len = bl->bl_ob.ob_len;
+	} else {
+		if ((fd = open(bl->bl_name, O_RDONLY)) < 0 ||
+		    fstat(fd, &st) < 0 || st.st_size == 0 ||
+		    (bl->bl_map = mmap(0, st.st_size, PROT_READ, MAP_SHARED,
+		    fd, 0)) == MAP_FAILED) {
+			warn("%s", bl->bl_name);
+			bl->bl_map = NULL;
+			if (fd >= 0)
+				close(fd);
+			goto bad;
+		}
+		close(fd);
+		b = bl->bl_map;
+		len = bl->bl_maplen = st.st_size;
+		if (len >= USB_CONFIG_DESCRIPTOR_SIZE && b[1] == UDESC_CONFIG) {
+			usb_device_descriptor_t dd;
+
+			memset(&dd, 0, sizeof dd);
+			dd.bLength = USB_DEVICE_DESCRIPTOR_SIZE;
+			dd.bDescriptorType = UDESC_DEVICE;
+			USETW(dd.bcdUSB, 0x0200);
+			dd.bMaxPacketSize = 64;
+			dd.bNumConfigurations = 1;
+			ob_put(&bl->bl_ob, &dd, sizeof dd);
+			n = UGETW(b + 2);
+			if (n > len)
+				n = len;
+			ob_put(&bl->bl_ob, b, n);
+			USETW(bl->bl_ob.ob_buf + sizeof dd + 2, n);
+			b = bl->bl_ob.ob_buf;
+			len = bl->bl_ob.ob_len;
+		}
+	}
+	if ((ub = usbbus_blob(bl->bl_name, b, len, addr)) == NULL)
+		goto bad;
+	setupdev(ud, ub, addr, NULL);
+	ud->name = bl->bl_name;
+	di.udi_addr = addr;
+	if (usbbus_devinfo(ub, &di) == 0)
+		setupkey(ud, &di);
+	return 0;
+ bad:
+	__atomic_add_fetch(&bstat.bs_bad, 1, __ATOMIC_RELAXED);
+	if (bl->bl_map)
+		munmap(bl->bl_map, bl->bl_maplen);
+	ob_free(&bl->bl_ob);
+	return -1;
+}
+
+/* After hook: count what was in the blob and let it go. */
+void
+blobdone(struct usbdev *ud)
+{
+	struct blob *bl = &blobs[ud - blobdevs];
+	usb_device_descriptor_t dd;
+	usb_config_descriptor_t *cd;
+	usb_interface_descriptor_t *id;
+	struct udesc_index ux;
+	int i, k, len;
+
+	if (ud->error)
+		__atomic_add_fetch(&bstat.bs_partial, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&bstat.bs_unknown, ud->unknown, __ATOMIC_RELAXED);
+	if (getdevicedesc(ud, &dd) == 0) {
+		__atomic_add_fetch(&bstat.bs_devclass[dd.bDeviceClass], 1,
+		    __ATOMIC_RELAXED);
+		for (i = 0; i < dd.bNumConfigurations; i++) {
+			if ((cd = getconfigdesc(ud, i, &len)) == NULL)
+				continue;
+			udesc_parse(&ux, cd, len, &ud->arena);
+			for (k = 0; k < ux.ux_nalts; k++) {
+				id = UDESC_IFC(&ux, k);
+				if (id->bAlternateSetting == 0)
+					__atomic_add_fetch(&bstat.bs_ifclass[
+					    id->bInterfaceClass], 1,
+					    __ATOMIC_RELAXED);
+			}
+		}
+	}
+	afree(&ud->arena);
+	usbbus_close(ud->ub);
+	ud->ub = NULL;
+	if (bl->bl_map)
+		munmap(bl->bl_map, bl->bl_maplen);
+	bl->bl_map = NULL;
+	ob_free(&bl->bl_ob);
+}
+
+void
+batch(const char *path, int njobs)
+{
+	struct stat st;
+	double t;
+	int i;
+
+	if (stat(path, &st) < 0)
+		err(1, "%s", path);
+	if (S_ISDIR(st.st_mode))
+		blobdir(path);
+	else
+		blobfile(path);
+	if (nblobs == 0)
+		errx(1, "%s: no blobs", path);
+	retries = 0;
+	if ((blobdevs = calloc(nblobs, sizeof *blobdevs)) == NULL)
+		err(1, "calloc");
+
+	t = monotime();
+	dumpall(blobdevs, nblobs, njobs, blobopen, blobdone);
+	t = monotime() - t;
+
+	fprintf(stderr, "%10d blobs, %d jobs, %.3f s, %.1f blobs/s\n",
+	    nblobs, njobs, t, t > 0 ? nblobs / t : 0);
+	fprintf(stderr, "%10lu bad\n", bstat.bs_bad);
+	fprintf(stderr, "%10lu partial\n", bstat.bs_partial);
+	fprintf(stderr, "%10lu unknown descriptors\n", bstat.bs_unknown);
+	for (i = 0; i < 256; i++)
+		if (bstat.bs_devclass[i])
+			fprintf(stderr, "%10lu device class %d\n",
+			    bstat.bs_devclass[i], i);
+	for (i = 0; i < 256; i++)
+		if (bstat.bs_ifclass[i])
+			fprintf(stderr, "%10lu interface class %d\n",
+			    bstat.bs_ifclass[i], i);
+}
+
+/*
+ * Daemon, -L socket.  Every device is read once and rendered in each
+ * output format, with pfrecord on so that only the first rendering
+ * and new string lookups go to the bus.  Bus events, and a look at the
+ * device list every interval ms, say when a device has come, gone or
+ * changed and has to be read again; there is no USB_DISCOVER.
+ *
+ * A client (-c socket) writes one line, "format addr string", with -1
+ * for all devices or no string, and gets back what usbctl -n would
+ * have printed.  Clients are read as their lines come in and written
+ * as they take their answers, so one that is slow to do either holds
+ * up nobody else; it is dropped if it gets nowhere for DIDLE.  The
+ * answer is a copy, as the device may be read again meanwhile.
+ */
+#define DINTERVAL	1000		/* ms */
+#define DCLIENTS	64		/* being read at once */
+#define DIDLE		1.0		/* s */
+#define NOFMT		3
+
+struct dmclient {
+	int		dc_fd;		/* -1 if the slot is free */
+	double		dc_end;		/* monotime to give up */
+	int		dc_len;
+	char		dc_line[64];
+	char		*dc_out;	/* the answer, once the line is in */
+	size_t		dc_outlen;
+	size_t		dc_outoff;	/* how much of it is written */
+};
+
+struct dmdev {
+	int		dm_present;
+	struct usb_device_info dm_di;
+	char		*dm_out[NOFMT];	/* by OFMT_* */
+	size_t		dm_len[NOFMT];
+};
+
+struct dmdev dmdevs[USB_MAX_DEVICES];
+
+void
+dmforget(int addr)
+{
+	struct dmdev *dm = &dmdevs[addr];
+	int f;
+
+	for (f = 0; f < NOFMT; f++) {
+		free(dm->dm_out[f]);
+		dm->dm_out[f] = NULL;
+		dm->dm_len[f] = 0;
+	}
+	pf_forget(addr);
+	dm->dm_present = 0;
+}
+
+void
+dmrender(struct usbbus *ub, int addr)
+{
+	struct dmdev *dm = &dmdevs[addr];
+	struct usbdev ud;
+	int f, save = ofmt;
+
+	for (f = 0; f < NOFMT; f++) {
+		setupdev(&ud, ub, addr, NULL);
+		setupkey(&ud, &dm->dm_di);
+		ud.out = open_memstream(&dm->dm_out[f], &dm->dm_len[f]);
+		if (ud.out == NULL)
+			err(1, "open_memstream");
+		ofmt = f;
+		if (ofmt == OFMT_TEXT)
+			dumpdev(&ud);
+		else
+			outdev(&ud);
+		fclose(ud.out);
+	}
+	ofmt = save;
+}
+
+/* Read again whatever is new or different since the last look. */
+void
+dmsync(struct usbbus *ub, int verbose)
+{
+	struct dmdev *dm;
+	struct usb_device_info di;
+	int addr;
+
+	for (addr = 0; addr < USB_MAX_DEVICES; addr++) {
+		dm = &dmdevs[addr];
+		memset(&di, 0, sizeof di);
+		di.udi_addr = addr;
+		if (usbbus_devinfo(ub, &di) < 0) {
+			if (dm->dm_present && verbose)
+				fprintf(stderr, "addr %d: gone\n", addr);
+			if (dm->dm_present)
+				dmforget(addr);
+			continue;
+		}
+		if (dm->dm_present && memcmp(&di, &dm->dm_di, sizeof di) == 0)
+			continue;
+		if (verbose)
+			fprintf(stderr, "addr %d: %s\n", addr,
+			    dm->dm_present ? "changed" : "new");
+		dmforget(addr);
+		dm->dm_di = di;
+		dm->dm_present = 1;
+		dmrender(ub, addr);
+	}
+}
+
+/* The answer to a client's line, or NULL if there is none. */
+char *
+dmreply(struct usbbus *ub, const char *line, size_t *len)
+{
+	struct usbdev ud;
+	char s[MAXSTR], *reply = NULL;
+	FILE *f;
+	int fmt, addr, si, a;
+
+	if (sscanf(line, "%d %d %d", &fmt, &addr, &si) != 3 ||
+	    fmt < 0 || fmt >= NOFMT || addr >= USB_MAX_DEVICES || si > 255)
+		return NULL;
+	if (si >= 0 && (addr < 0 || !dmdevs[addr].dm_present))
+		return NULL;
+	if ((f = open_memstream(&reply, len)) == NULL)
+		return NULL;
+	if (si >= 0) {
+		setupdev(&ud, ub, addr, NULL);
+		setupkey(&ud, &dmdevs[addr].dm_di);
+		getstring(&ud, si, s);
+		fprintf(f, "string %d = '%s'\n", si, s);
+	} else
+		for (a = 0; a < USB_MAX_DEVICES; a++)
+			if (dmdevs[a].dm_present && (addr < 0 || a == addr))
+				fwrite(dmdevs[a].dm_out[fmt], 1,
+				    dmdevs[a].dm_len[fmt], f);
+	if (fclose(f) != 0) {
+		free(reply);
+		return NULL;
+	}
+	return reply;
+}
+
+/* Write what the client takes of its answer; 1 while there is more. */
+int
+dmsend(struct dmclient *d, double t)
+{
+	ssize_t n;
+
+	if (d->dc_outoff < d->dc_outlen) {
+		n = write(d->dc_fd, d->dc_out + d->dc_outoff,
+		    d->dc_outlen - d->dc_outoff);
+		if (n > 0) {
+			d->dc_outoff += n;
+			d->dc_end = t + DIDLE;
+		} else if (n < 0 && errno != EAGAIN)
+			return 0;
+	}
+	return d->dc_outoff < d->dc_outlen && t < d->dc_end;
+}
+
+/*
+ * Read what has come of a client's line, and once it is all there
+ * start on the answer.  Returns 1 while the client is still wanted.
+ */
+int
+dmrecv(struct usbbus *ub, struct dmclient *d, int ready, double t)
+{
+	ssize_t r = 1;
+
+	if (ready) {
+		r = read(d->dc_fd, d->dc_line + d->dc_len,
+		    sizeof d->dc_line - 1 - d->dc_len);
+		if (r > 0)
+			d->dc_len += r;
+		else if (r < 0 && errno == EAGAIN)
+			r = 1;
+	}
+	d->dc_line[d->dc_len] = 0;
+	if (strchr(d->dc_line, '\n') == NULL &&
+	    d->dc_len < (int)sizeof d->dc_line - 1)
+		return r > 0 && t < d->dc_end;
+	if ((d->dc_out = dmreply(ub, d->dc_line, &d->dc_outlen)) == NULL)
+		return 0;
+	d->dc_outoff = 0;
+	d->dc_end = t + DIDLE;
+	return dmsend(d, t);
+}
+
+void
+serve(struct usbbus *ub, const char *path, int interval, int verbose)
+{
+	struct sockaddr_un sun;
+	struct pollfd pfd[2 + DCLIENTS];
+	struct dmclient dc[DCLIENTS], *d;
+	struct usb_event ue;
+	struct stat st;
+	double t, next, end;
+	int s, c, n, i, nc = 0;
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sun.sun_path)
+		errx(1, "%s: name too long", path);
+	strcpy(sun.sun_path, path);
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	/* A socket left by an earlier run goes, but not one in use. */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+		if ((c = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+			err(1, "socket");
+		if (connect(c, (struct sockaddr *)&sun, sizeof sun) == 0)
+			errx(1, "%s: already being served", path);
+		if (errno == ECONNREFUSED)
+			unlink(path);
+		close(c);
+	}
+	if (bind(s, (struct sockaddr *)&sun, sizeof sun) < 0 ||
+	    listen(s, 16) < 0)
+		err(1, "%s", path);
+	signal(SIGPIPE, SIG_IGN);
+	pfrecord = 1;
+	for (i = 0; i < DCLIENTS; i++) {
+		dc[i].dc_fd = -1;
+		dc[i].dc_out = NULL;
+	}
+	/* The first call opens the event source; then the first look. */
+	while (usbbus_event(ub, &ue, 0) > 0)
+		;
+	dmsync(ub, verbose);
+	next = monotime() + interval / 1e3;
+	for (;;) {
+		/* No more clients are taken on while all slots are busy. */
+		pfd[0].fd = nc < DCLIENTS ? s : -1;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = ub->ub_evfd;
+		pfd[1].events = POLLIN;
+		end = next;
+		for (i = 0; i < DCLIENTS; i++) {
+			pfd[2 + i].fd = dc[i].dc_fd;
+			pfd[2 + i].events = dc[i].dc_out ? POLLOUT : POLLIN;
+			if (dc[i].dc_fd >= 0 && dc[i].dc_end < end)
+				end = dc[i].dc_end;
+		}
+		t = monotime();
+		n = poll(pfd, 2 + DCLIENTS, end > t ? (end - t) * 1e3 + 1 : 0);
+		if (n < 0) {
+			if (errno != EINTR)
+				err(1, "poll");
+			continue;
+		}
+		t = monotime();
+		if (t >= next || pfd[1].revents) {
+			while (usbbus_event(ub, &ue, 0) > 0)
+				;
+			dmsync(ub, verbose);
+			next = monotime() + interval / 1e3;
+		}
+		for (i = 0; i < DCLIENTS; i++) {
+			d = &dc[i];
+			if (d->dc_fd < 0)
+				continue;
+			if (d->dc_out == NULL ?
+			    dmrecv(ub, d, pfd[2 + i].revents, t) :
+			    pfd[2 + i].revents ? dmsend(d, t) : t < d->dc_end)
+				continue;
+			close(d->dc_fd);
+			free(d->dc_out);
+			d->dc_out = NULL;
+			d->dc_fd = -1;
+			nc--;
+		}
+		if ((pfd[0].revents & POLLIN) &&
+		    (c = accept(s, NULL, NULL)) >= 0) {
+			for (i = 0; dc[i].dc_fd >= 0; i++)
+				;
+			fcntl(c, F_SETFL, O_NONBLOCK);
+			dc[i].dc_fd = c;
+			dc[i].dc_end = t + DIDLE;
+			dc[i].dc_len = 0;
+			nc++;
+		}
+	}
+}
+
+/* The thin client for -c: one request, the answer to stdout. */
+void
+client(const char *path, int addr, int si)
+{
+	struct sockaddr_un sun;
+	char buf[8192];
+	ssize_t n;
+	int s;
+
+	memset(&sun, 0, sizeof sun);
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof sun.sun_path)
+		errx(1, "%s: name too long", path);
+	strcpy(sun.sun_path, path);
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (connect(s, (struct sockaddr *)&sun, sizeof sun) < 0)
+		err(1, "%s", path);
+	n = snprintf(buf, sizeof buf, "%d %d %d\n", ofmt, addr, si);
+	if (write(s, buf, n) != n)
+		err(1, "%s", path);
+	while ((n = read(s, buf, sizeof buf)) > 0)
+		if (fwrite(buf, 1, n, stdout) != (size_t)n)
+			err(1, "stdout");
+	if (n < 0)
+		err(1, "%s", path);
+	close(s);
+}
+
+/*
+ * Tracing for -t and -T.  The results are written from an atexit
+ * handler so that a run that dies with err() is traced as well.
+ */
+#define TRACESPANS	65536
+
+struct trace *trace;
+char *tracefile;
+int tracesum;
+
+void
+traceexit(void)
+{
+	FILE *f;
+
+	if (tracesum)
+		trace_summary(trace, stderr);
+	if (tracefile) {
+		if ((f = fopen(tracefile, "w")) == NULL) {
+			warn("%s", tracefile);
+			return;
+		}
+		if (trace_chrome(trace, f) < 0 || fclose(f) == EOF)
+			warn("%s", tracefile);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct usbbus *ub;
+	int r, i;
+	char *dev = USBDEV;
+	int ch;
+	extern char *optarg;
+	extern int optind;
+	int disconly = 0, nodisc = 0;
+	struct usb_device_info di;
+	struct usbdev ud;
+	int addr;
+	int doaddr = -1, si = -1;
+	int njobs = 0, depth = 0, verbose = 0;
+	int budget = 0, timeout = 0, interval = 0, bwreport = 0;
+	char *lpath = NULL, *cpath = NULL, *bpath = NULL;
+	FILE *nullout;
+	char *cache = 0;
+	struct usbdev *devs;
+	int ndevs;
+
+	while ((ch = getopt(argc, argv, "a:bB:c:C:f:F:dDj:L:mM:no:P:q:s:S:tT:vW:w:")) != -1) {
+		switch(ch) {
+		case 'a':
+			nodisc = 1;
+			doaddr = atoi(optarg);
+			break;
+		case 'b':
+			bwreport = 1;
+			break;
+		case 'B':
+			bpath = optarg;
+			break;
+		case 'c':
+			cpath = optarg;
+			break;
+		case 'C':
+			cache = optarg;
+			break;
+		case 'f':
+			dev = optarg;
+			break;
+		case 'F':
+			qparseproj(optarg);
+			break;
+		case 'd':
+			disconly = 1;
+			break;
+		case 'D':
+			snapdiff = 1;
+			break;
+		case 'j':
+			njobs = atoi(optarg);
+			if (njobs < 1)
+				usage();
+			break;
+		case 'n':
+			nodisc = 1;
+			break;
+		case 'o':
+			ofmt = outformat(optarg);
+			if (ofmt < 0)
+				usage();
+			break;
+		case 'L':
+			lpath = optarg;
+			break;
+		case 'm':
+			num = 1;
+			break;
+		case 'M':
+			interval = atoi(optarg);
+			if (interval < 1)
+				usage();
+			break;
+		case 'P':
+			depth = atoi(optarg);
+			if (depth < 1)
+				usage();
+			break;
+		case 'q':
+			qparse(optarg);
+			break;
+		case 's':
+			si = atoi(optarg);
+			break;
+		case 'S':
+			snapfile = optarg;
+			break;
+		case 't':
+			tracesum = 1;
+			break;
+		case 'T':
+			tracefile = optarg;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'W':
+			budget = atoi(optarg);
+			if (budget < 1)
+				usage();
+			break;
+		case 'w':
+			timeout = atoi(optarg);
+			if (timeout < 1)
+				usage();
+			break;
+		case '?':
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (snapdiff && snapfile == NULL)
+		usage();
+	if (snapfile && nqterms)
+		usage();
+	if (nqproj && ofmt == OFMT_BIN)
+		usage();
+	if (bwreport && ofmt != OFMT_TEXT)
+		usage();
+
+	if (cpath) {
+		client(cpath, doaddr, doaddr > 0 ? si : -1);
+		exit(0);
+	}
+	if (bpath) {
+		if (njobs == 0)
+			njobs = sysconf(_SC_NPROCESSORS_ONLN);
+		batch(bpath, njobs > 0 ? njobs : 1);
+		exit(0);
+	}
+	if (njobs == 0)
+		njobs = 1;
+
+	ub = usbbus_open(dev);
+	if (ub == NULL)
+		err(1, "%s", dev);
+	ub->ub_timeout = timeout;
+	if (tracesum || tracefile) {
+		ub->ub_trace = trace = trace_open(TRACESPANS);
+		atexit(traceexit);
+	}
+	if (cache)
+		strcache_open(cache);
+
+	if (doaddr > 0 && si >= 0) {
+		char buf[MAXSTR];
+		setupdev(&ud, ub, doaddr, stdout);
+		di.udi_addr = doaddr;
+		if (usbbus_devinfo(ub, &di) == 0)
+			setupkey(&ud, &di);
+		getstring(&ud, si, buf);
+		printf("string %d = '%s'\n", si, buf);
+		strcache_close();
+		exit(0);
+	}
+
+	if (lpath) {
+		serve(ub, lpath, interval ? interval : DINTERVAL, verbose);
+		exit(0);
+	}
+	if (interval > 0) {
+		monitor(ub, interval);
+		exit(0);
+	}
+	if (bwreport) {
+		bandwidth(ub, dev);
 		exit(0);
 	}
 
-	if (!doaddr)
-		prunits(f);
+	if (!doaddr && ofmt == OFMT_TEXT && !nqproj)
+		prunits(ub);
 	if (!nodisc) {
-		r = ioctl(f, USB_DISCOVER);
+		r = usbbus_ioctl(ub, USB_DISCOVER, NULL);
 		if (r < 0)
 			err(1, "USB_DISCOVER");
-		prunits(f);
+		if (ofmt == OFMT_TEXT && !nqproj)
+			prunits(ub);
 		if (disconly)
 			exit(0);
 	}
 
-	for(addr = 0; addr < USB_MAX_DEVICES; addr++) {
+	devs = calloc(USB_MAX_DEVICES, sizeof *devs);
+	if (devs == NULL)
+		err(1, "calloc");
+	if (snapfile) {
+		snap = snap_open(snapfile);
+		pfrecord = 1;
+	}
+	/* Matching -q reads devices too, so it comes out of the budget. */
+	if (budget > 0)
+		budgetend = monotime() + budget / 1e3;
+	for(ndevs = addr = 0; addr < USB_MAX_DEVICES; addr++) {
 		if (doaddr != -1 && addr != doaddr)
 			continue;
 		di.udi_addr = addr;
-		r = ioctl(f, USB_DEVICEINFO, &di);
-		if (r)
+		r = usbbus_devinfo(ub, &di);
+		if (r) {
+			if (snapfile)
+				snapgone(addr);
 			continue;
-
-		globaddr = addr;
-		printf("DEVICE addr %d\n", addr);
-		setupstrings(f, addr);
-		getdevicedesc(f, &dd, addr);
-		printf("DEVICE descriptor:\n");
-		prdevd(&dd);
-		printf("\n");
-		/*getdevicestatus(f, &status, addr);
-		 printf("Device status %04x\n", status);*/
-
-		for(i = 0; i < dd.bNumConfigurations; i++) {
-			int class, subclass;
-			getconfigdesc(f, i, &cd.ucd, sizeof cd, addr);
-			printf("CONFIGURATION descriptor %d:\n", i);
-			prconfd(&cd.ucd);
-			printf("\n");
-			p = (char *)&cd + cd.ucd.bLength;
-			enddata = (char *)&cd + UGETW(cd.ucd.wTotalLength);
-
-			class = dd.bDeviceClass;
-			subclass = dd.bDeviceSubClass;
-
-			iface = -1;
-			while (p < enddata) {
-				p = prdesc(p, &class, &subclass, &iface, i);
-				printf("\n");
-			}
-
 		}
-		getconfiguration(f, &cconf, addr);
-		printf("current configuration %d\n\n", cconf);
-#if 1
-		if (dd.bDeviceClass == UICLASS_HUB) {
-			printf("HUB descriptor:\n");
-			gethubdesc(f, &hd, addr);
-			prhubd(&hd);
-			printf("\n");
-			gethubstatus(f, &hs, addr);
-			printf("Hub status %04x %04x\n\n",
-			       UGETW(hs.wHubStatus), UGETW(hs.wHubChange));
-			for(i = 1; i <= hd.bNbrPorts; i++) {
-				getportstatus(f, i, &ps, addr);
-				printf("Port %d status=%04x change=%04x\n\n", i,
-				       UGETW(ps.wPortStatus), UGETW(ps.wPortChange));
+		setupdev(&devs[ndevs], ub, addr, stdout);
+		setupkey(&devs[ndevs], &di);
+		if (snapfile)
+			snapcheck(&devs[ndevs], &di);
+		if (nqterms) {
+			pfrecord = 1;
+			devs[ndevs].deadline = budgetend;
+			r = qmatch(&devs[ndevs], &di);
+			pfrecord = 0;
+			if (!r)
+				continue;
+		}
+		ndevs++;
+	}
+
+	if (budget > 0) {
+		budgetjobs = njobs < ndevs ? njobs : ndevs;
+		devsleft = ndevs;
+	}
+	if (depth > 0)
+		prefetch(ub, devs, ndevs, depth, verbose);
+	if (snapdiff) {
+		/* Read what changed for the next snapshot, but print nothing. */
+		if ((nullout = fopen("/dev/null", "w")) == NULL)
+			err(1, "/dev/null");
+		ofmt = OFMT_TEXT;
+		for (i = 0; i < ndevs; i++)
+			if (!devs[i].cached) {
+				devs[i].out = nullout;
+				dumpdev(&devs[i]);
 			}
+		fclose(nullout);
+	} else if (njobs > 1 && ndevs > 1)
+		dumpall(devs, ndevs, njobs, NULL, NULL);
+	else {
+		for (i = 0; i < ndevs; i++) {
+			if (nqproj)
+				prfields(&devs[i]);
+			else if (ofmt == OFMT_TEXT)
+				dumpdev(&devs[i]);
+			else
+				outdev(&devs[i]);
 		}
-#endif
-		printf("----------\n");
 	}
+	if (snapfile) {
+		snapsave(devs, ndevs, doaddr);
+		snap_close(snap);
+	}
+	strcache_close();
+	usbbus_close(ub);
 	exit(0);
 }
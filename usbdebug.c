@@ -32,23 +32,26 @@
 #include <err.h>
 #include <dev/usb/usb.h>
 
+#include "usbbus.h"
+
 #define USBDEV "/dev/usb0"
 
 int
 main(int argc, char **argv)
 {
-	int f, r, d;
+	struct usbbus *ub;
+	int r, d;
 	char *dev = USBDEV;
 
-	f = open(dev, O_RDWR);
-	if (f < 0)
+	ub = usbbus_open(dev);
+	if (ub == NULL)
 		err(1, "%s", dev);
 	if (argc != 2) {
 		printf("Usage: %s debuglevel\n", *argv);
 		exit(1);
 	}
 	d = atoi(argv[1]);
-	r = ioctl(f, USB_SETDEBUG, &d);
+	r = usbbus_ioctl(ub, USB_SETDEBUG, &d);
 	if (r < 0)
 		err(1, "USB_SETDEBUG");
 	exit(0);
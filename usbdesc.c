@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include <dev/usb/usb.h>
+
+#include "arena.h"
+#include "usbdesc.h"
+
+/*
+ * Build the index.  The arrays are sized for the worst case allowed
+ * by the blob length (every descriptor at least 2 bytes, interfaces
+ * at least 9, endpoints at least 7) and taken from the arena in one
+ * piece.  Returns 0, or -1 if a descriptor has bLength < 2 or runs
+ * past the end; the index then covers the part before it.
+ */
+int
+udesc_parse(struct udesc_index *ux, const void *buf, int len,
+    struct arena *a)
+{
+	const u_char *p = buf;
+	const usb_interface_descriptor_t *id;
+	struct udesc_alt *ua = 0;
+	u_int16_t *last;
+	int maxd, maxi, maxe, off, n, i;
+
+	if (len > 0xffff)
+		len = 0xffff;
+	maxd = len / 2 + 1;
+	maxi = len / USB_INTERFACE_DESCRIPTOR_SIZE + 1;
+	maxe = len / USB_ENDPOINT_DESCRIPTOR_SIZE + 1;
+	memset(ux, 0, sizeof *ux);
+	ux->ux_buf = p;
+	ux->ux_bad = -1;
+	ux->ux_alts = aalloc(a, maxi * sizeof *ux->ux_alts);
+	ux->ux_desc = aalloc(a, (2 * maxd + 2 * maxi + maxe) *
+	    sizeof *ux->ux_desc);
+	ux->ux_cs = ux->ux_desc + maxd;
+	ux->ux_ifcs = ux->ux_cs + maxd;
+	last = ux->ux_ifcs + maxi;
+	ux->ux_eps = last + maxi;
+
+	for (off = 0; off < len; off += n) {
+		n = p[off];
+		if (n < 2 || off + 2 > len || off + n > len) {
+			ux->ux_bad = off;
+			break;
+		}
+		i = ux->ux_ndesc++;
+		ux->ux_desc[i] = off;
+		switch (p[off + 1]) {
+		case UDESC_CONFIG:
+			if (i != 0)
+				goto other;
+			break;
+		case UDESC_INTERFACE:
+			if (n < USB_INTERFACE_DESCRIPTOR_SIZE)
+				goto other;
+			id = (const void *)(p + off);
+			ua = &ux->ux_alts[ux->ux_nalts];
+			ua->ua_desc = i;
+			ua->ua_ndesc = 1;
+			ua->ua_ep = ux->ux_neps;
+			ua->ua_nep = 0;
+			ua->ua_cs = ux->ux_ncs;
+			ua->ua_ncs = 0;
+			ua->ua_next = UDESC_NONE;
+			for (i = 0; i < ux->ux_nifcs; i++)
+				if (UDESC_IFC(ux, ux->ux_ifcs[i])->
+				    bInterfaceNumber == id->bInterfaceNumber)
+					break;
+			if (i == ux->ux_nifcs)
+				ux->ux_ifcs[ux->ux_nifcs++] = ux->ux_nalts;
+			else
+				ux->ux_alts[last[i]].ua_next = ux->ux_nalts;
+			last[i] = ux->ux_nalts++;
+			break;
+		case UDESC_ENDPOINT:
+			if (n < USB_ENDPOINT_DESCRIPTOR_SIZE)
+				goto other;
+			ux->ux_eps[ux->ux_neps++] = i;
+			if (ua) {
+				ua->ua_ndesc++;
+				ua->ua_nep++;
+			}
+			break;
+		default:
+		other:
+			ux->ux_cs[ux->ux_ncs++] = i;
+			if (ua) {
+				ua->ua_ndesc++;
+				ua->ua_ncs++;
+			}
+			break;
+		}
+		if (ua == 0)
+			ux->ux_npre++;
+	}
+	ux->ux_len = off;
+	return ux->ux_bad < 0 ? 0 : -1;
+}
+
+/*
+ * Find the alt index for interface number ifc, alternate setting
+ * alt, or -1 if the configuration has no such thing.
+ */
+int
+udesc_findalt(const struct udesc_index *ux, int ifc, int alt)
+{
+	usb_interface_descriptor_t *id;
+	int i, a;
+
+	for (i = 0; i < ux->ux_nifcs; i++) {
+		if (UDESC_IFC(ux, ux->ux_ifcs[i])->bInterfaceNumber != ifc)
+			continue;
+		for (a = ux->ux_ifcs[i]; a != UDESC_NONE;
+		    a = ux->ux_alts[a].ua_next) {
+			id = UDESC_IFC(ux, a);
+			if (id->bAlternateSetting == alt)
+				return a;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Flat index over a configuration descriptor blob.  udesc_parse()
+ * walks the blob once, checks every bLength, and records where each
+ * descriptor starts.  Nothing is copied; the index refers into the
+ * caller's buffer, which must stay around as long as the index.
+ *
+ * All descriptors are listed in ux_desc in blob order.  Each interface
+ * descriptor, i.e. each alternate setting, gets a udesc_alt that
+ * names its endpoint and class specific descriptors as ranges of
+ * ux_eps and ux_cs.  Alternate settings of the same interface are
+ * chained through ua_next; ux_ifcs lists the first one of each.
+ */
+#define UDESC_NONE	0xffff
+
+struct udesc_alt {
+	u_int16_t	ua_desc;	/* ux_desc index of the interface */
+	u_int16_t	ua_ndesc;	/* descriptors up to the next one */
+	u_int16_t	ua_ep;		/* first endpoint in ux_eps */
+	u_int16_t	ua_nep;
+	u_int16_t	ua_cs;		/* first class descriptor in ux_cs */
+	u_int16_t	ua_ncs;
+	u_int16_t	ua_next;	/* next alt of this interface */
+};
+
+struct udesc_index {
+	const u_char	*ux_buf;
+	int		ux_len;		/* bytes that parsed cleanly */
+	int		ux_bad;		/* offset of a bad descriptor or -1 */
+	u_int16_t	*ux_desc;	/* offset of every descriptor */
+	int		ux_ndesc;
+	int		ux_npre;	/* descriptors before the first interface */
+	struct udesc_alt *ux_alts;
+	int		ux_nalts;
+	u_int16_t	*ux_ifcs;	/* first alt of each interface */
+	int		ux_nifcs;
+	u_int16_t	*ux_eps;	/* ux_desc index of each endpoint */
+	int		ux_neps;
+	u_int16_t	*ux_cs;		/* ux_desc index of other descriptors */
+	int		ux_ncs;
+};
+
+#define UDESC_AT(ux, i)		((void *)((ux)->ux_buf + (ux)->ux_desc[i]))
+#define UDESC_IFC(ux, a)	\
+	((usb_interface_descriptor_t *)UDESC_AT(ux, (ux)->ux_alts[a].ua_desc))
+#define UDESC_EP(ux, a, e)	\
+	((usb_endpoint_descriptor_t *)UDESC_AT(ux, \
+	    (ux)->ux_eps[(ux)->ux_alts[a].ua_ep + (e)]))
+#define UDESC_CS(ux, a, c)	\
+	((usb_descriptor_t *)UDESC_AT(ux, \
+	    (ux)->ux_cs[(ux)->ux_alts[a].ua_cs + (c)]))
+
+struct arena;
+
+int udesc_parse(struct udesc_index *, const void *, int, struct arena *);
+int udesc_findalt(const struct udesc_index *, int, int);
@@ -31,8 +31,24 @@
 #include <unistd.h>
 #include <string.h>
 #include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <math.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/stat.h>
 #include <dev/usb/usb.h>
 
+#include "arena.h"
+#include "hidrep.h"
+#include "usbbus.h"
+#include "usbdesc.h"
+#include "usbout.h"
+#include "usbxfer.h"
+
 /* Backwards compatibility */
 #ifndef UE_GET_DIR
 #define UE_GET_DIR(a)	((a) & 0x80)
@@ -57,9 +73,31 @@
 #define udi_product product
 #define udi_vendor vendor
 #define udi_addr addr
+#define ufd_config_index config_index
+#define ufd_size size
+#define ufd_data data
 #endif
 
 int verbose;
+int nioctl;
+int ofmt = OFMT_TEXT;
+char *ctlname;
+
+/* All device ioctls go through here so -v can report how many were made. */
+int
+uioctl(int f, u_long cmd, void *arg)
+{
+	nioctl++;
+	return ioctl(f, cmd, arg);
+}
+
+/* Likewise for those on the device itself, which go to its backend. */
+int
+uctl(struct usbbus *ub, u_long cmd, void *arg)
+{
+	nioctl++;
+	return usbbus_ioctl(ub, cmd, arg);
+}
 
 void
 show_device_desc(int indent, usb_device_descriptor_t *d)
@@ -127,16 +165,174 @@ show_endpoint_desc(int indent, usb_endpoint_descriptor_t *d)
 }
 
 void
-set_conf(int f, int conf)
+set_conf(struct usbbus *ub, int conf)
 {
 	if (verbose)
 		printf("setting configuration %d\n", conf);
-	if (ioctl(f, USB_SET_CONFIG, &conf) != 0)
+	if (uctl(ub, USB_SET_CONFIG, &conf) != 0)
 		err(1, "ioctl USB_SET_CONFIG");
 }
 
 void
-dump_idesc(int f, int all, int cindex, int iindex, int aindex)
+show_alt(struct udesc_index *ux, int all, int iindex, int aindex, int a)
+{
+	int e;
+
+	if (all) {
+		printf("  INTERFACE descriptor index %d, alt index %d:\n",
+		       iindex, aindex);
+	} else {
+		printf("  INTERFACE descriptor index %d:\n", iindex);
+	}
+	show_interface_desc(2, UDESC_IFC(ux, a));
+	printf("\n");
+
+	for (e = 0; e < ux->ux_alts[a].ua_nep; e++) {
+		printf("    ENDPOINT descriptor index %d:\n", e);
+		show_endpoint_desc(4, UDESC_EP(ux, a, e));
+		printf("\n");
+	}
+}
+
+/*
+ * Get configuration cindex with all its descriptors in a single
+ * USB_GET_FULL_DESC.  Returns NULL if the kernel does not have it.
+ */
+usb_config_descriptor_t *
+get_fulldesc(struct usbbus *ub, int cindex, struct arena *arena, int *lenp)
+{
+	struct usb_full_desc fd;
+	usb_config_descriptor_t *cd;
+	int len;
+
+	fd.ufd_config_index = cindex;
+	fd.ufd_size = 0xffff;
+	fd.ufd_data = aalloc(arena, fd.ufd_size);
+	if (uctl(ub, USB_GET_FULL_DESC, &fd) != 0)
+		return NULL;
+	cd = (usb_config_descriptor_t *)fd.ufd_data;
+	len = UGETW(cd->wTotalLength);
+	if (len > fd.ufd_size)
+		len = fd.ufd_size;
+	atrim(arena, cd, len);
+	*lenp = len;
+	return cd;
+}
+
+/*
+ * Like get_fulldesc, but when that is not available put the same
+ * blob together from the configuration, interface and endpoint
+ * descriptors the kernel hands out one by one.
+ */
+usb_config_descriptor_t *
+get_cblob(struct usbbus *ub, int cindex, struct arena *arena, int *lenp)
+{
+	struct usb_config_desc cdesc;
+	struct usb_alt_interface ai;
+	struct usb_interface_desc idesc;
+	struct usb_endpoint_desc edesc;
+	usb_config_descriptor_t *cd;
+	u_char *p;
+	int i, a, e;
+
+	cd = get_fulldesc(ub, cindex, arena, lenp);
+	if (cd != NULL)
+		return cd;
+
+	cdesc.ucd_config_index = cindex;
+	if (uctl(ub, USB_GET_CONFIG_DESC, &cdesc) != 0)
+		err(1, "ioctl USB_GET_CONFIG_DESC");
+	p = aalloc(arena, 0xffff);
+	cd = (usb_config_descriptor_t *)p;
+	memcpy(p, &cdesc.ucd_desc, USB_CONFIG_DESCRIPTOR_SIZE);
+	p += USB_CONFIG_DESCRIPTOR_SIZE;
+	for (i = 0; i < cdesc.ucd_desc.bNumInterface; i++) {
+		ai.uai_config_index = cindex;
+		ai.uai_interface_index = i;
+		if (uctl(ub, USB_GET_NO_ALT, &ai) != 0)
+			err(1, "USB_GET_NO_ALT");
+		for (a = 0; a < ai.uai_alt_no; a++) {
+			idesc.uid_config_index = cindex;
+			idesc.uid_interface_index = i;
+			idesc.uid_alt_index = a;
+			if (uctl(ub, USB_GET_INTERFACE_DESC, &idesc) != 0)
+				err(1, "ioctl USB_GET_INTERFACE_DESC");
+			memcpy(p, &idesc.uid_desc, USB_INTERFACE_DESCRIPTOR_SIZE);
+			p += USB_INTERFACE_DESCRIPTOR_SIZE;
+			edesc.ued_config_index = cindex;
+			edesc.ued_interface_index = i;
+			edesc.ued_alt_index = a;
+			for (e = 0; e < idesc.uid_desc.bNumEndpoints; e++) {
+				edesc.ued_endpoint_index = e;
+				if (uctl(ub, USB_GET_ENDPOINT_DESC, &edesc) != 0)
+					err(1, "ioctl USB_GET_ENDPOINT_DESC");
+				memcpy(p, &edesc.ued_desc,
+				       USB_ENDPOINT_DESCRIPTOR_SIZE);
+				p += USB_ENDPOINT_DESCRIPTOR_SIZE;
+			}
+		}
+	}
+	*lenp = p - (u_char *)cd;
+	USETW(cd->wTotalLength, *lenp);
+	atrim(arena, cd, *lenp);
+	return cd;
+}
+
+/*
+ * Dump a configuration from a single USB_GET_FULL_DESC, taking the
+ * interfaces, alternate settings and endpoints from the blob instead
+ * of asking the kernel for each one.  Returns -1 if the kernel or the
+ * blob is not up to it, so the caller can use the old way.
+ */
+int
+dump_cdesc_full(struct usbbus *ub, int all, int cindex)
+{
+	struct usb_alt_interface ai;
+	struct udesc_index ux;
+	struct arena arena;
+	usb_config_descriptor_t *cd;
+	int i, a, n, len, r = -1;
+
+	memset(&arena, 0, sizeof arena);
+	cd = get_fulldesc(ub, cindex, &arena, &len);
+	if (cd == NULL || udesc_parse(&ux, cd, len, &arena) != 0 ||
+	    ux.ux_ndesc == 0 || cd->bDescriptorType != UDESC_CONFIG)
+		goto out;
+
+	if (all)
+		printf("CONFIGURATION descriptor index %d:\n", cindex);
+	else
+		printf("CONFIGURATION descriptor:\n");
+	show_config_desc(0, cd);
+	printf("\n");
+
+	for (i = 0; i < ux.ux_nifcs; i++) {
+		if (all) {
+			for (n = 0, a = ux.ux_ifcs[i]; a != UDESC_NONE;
+			     n++, a = ux.ux_alts[a].ua_next)
+				show_alt(&ux, all, i, n, a);
+		} else {
+			ai.uai_config_index = cindex;
+			ai.uai_interface_index = i;
+			if (uctl(ub, USB_GET_ALTINTERFACE, &ai) != 0)
+				err(1, "USB_GET_ALTINTERFACE");
+			for (n = 0, a = ux.ux_ifcs[i]; a != UDESC_NONE &&
+			     n < ai.uai_alt_no; n++, a = ux.ux_alts[a].ua_next)
+				;
+			if (a == UDESC_NONE)
+				errx(1, "interface %d has no alt %d", i,
+				     ai.uai_alt_no);
+			show_alt(&ux, all, i, n, a);
+		}
+	}
+	r = 0;
+ out:
+	afree(&arena);
+	return r;
+}
+
+void
+dump_idesc(struct usbbus *ub, int all, int cindex, int iindex, int aindex)
 {
 	struct usb_interface_desc idesc;
 	struct usb_endpoint_desc edesc;
@@ -146,7 +342,7 @@ dump_idesc(int f, int all, int cindex, int iindex, int aindex)
 	idesc.uid_interface_index = iindex;
 	idesc.uid_alt_index = aindex;
 	/*printf("*** idesc %d %d %d\n", cindex, iindex, aindex);*/
-	if (ioctl(f, USB_GET_INTERFACE_DESC, &idesc) != 0)
+	if (uctl(ub, USB_GET_INTERFACE_DESC, &idesc) != 0)
 		err(1, "ioctl USB_GET_INTERFACE_DESC");
 	if (all) {
 		printf("  INTERFACE descriptor index %d, alt index %d:\n",
@@ -162,7 +358,7 @@ dump_idesc(int f, int all, int cindex, int iindex, int aindex)
 	edesc.ued_alt_index = aindex;
 	for (e = 0; e < idesc.uid_desc.bNumEndpoints; e++) {
 		edesc.ued_endpoint_index = e;
-		if (ioctl(f, USB_GET_ENDPOINT_DESC, &edesc) != 0)
+		if (uctl(ub, USB_GET_ENDPOINT_DESC, &edesc) != 0)
 			err(1, "ioctl USB_GET_ENDPOINT_DESC");
 		printf("    ENDPOINT descriptor index %d:\n", e);
 		show_endpoint_desc(4, &edesc.ued_desc);
@@ -171,14 +367,18 @@ dump_idesc(int f, int all, int cindex, int iindex, int aindex)
 }
 
 void
-dump_cdesc(int f, int all, int cindex)
+dump_cdesc(struct usbbus *ub, int all, int cindex)
 {
 	struct usb_config_desc cdesc;
 	struct usb_alt_interface ai;
 	int i, a;
 
+	if (dump_cdesc_full(ub, all, cindex) == 0)
+		return;
+	if (verbose)
+		printf("USB_GET_FULL_DESC not usable, asking for each descriptor\n");
 	cdesc.ucd_config_index = cindex;
-	if (ioctl(f, USB_GET_CONFIG_DESC, &cdesc) != 0)
+	if (uctl(ub, USB_GET_CONFIG_DESC, &cdesc) != 0)
 		err(1, "ioctl USB_GET_CONFIG_DESC");
 	if (all)
 		printf("CONFIGURATION descriptor index %d:\n", cindex);
@@ -190,74 +390,1071 @@ dump_cdesc(int f, int all, int cindex)
 	for (i = 0; i < cdesc.ucd_desc.bNumInterface; i++) {
 		if (all) {
 #if 0
-			if (ioctl(f, USB_GET_ALTINTERFACE, &ai) != 0)
+			if (uctl(ub, USB_GET_ALTINTERFACE, &ai) != 0)
 				err(1, "USB_GET_ALTINTERFACE");
 			printf("Current alternative %d\n", ai->alt_no);
 #endif
 			ai.uai_config_index = cindex;
 			ai.uai_interface_index = i;
-			if (ioctl(f, USB_GET_NO_ALT, &ai) != 0)
+			if (uctl(ub, USB_GET_NO_ALT, &ai) != 0)
 				err(1, "USB_GET_NO_ALT");
 			/*printf("*** %d alts\n", ai.alt_no);*/
 			for (a = 0; a < ai.uai_alt_no; a++)
-				dump_idesc(f, all, cindex, i, a);
+				dump_idesc(ub, all, cindex, i, a);
 		} else {
-			dump_idesc(f, all, cindex, i, USB_CURRENT_ALT_INDEX);
+			dump_idesc(ub, all, cindex, i, USB_CURRENT_ALT_INDEX);
 		}
 	}
 }
 
+/*
+ * Structured version of dump_desc: the device descriptor and every
+ * wanted configuration as one JSON line or binary record.
+ */
 void
-dump_desc(int f, int all)
+out_desc(struct usbbus *ub, int all)
+{
+	usb_device_descriptor_t ddesc;
+	usb_config_descriptor_t *cd;
+	struct udesc_index ux;
+	struct arena arena;
+	struct obuf ob;
+	size_t rec = 0;
+	int c, co, k, len, n;
+	u_int8_t b;
+
+	nioctl = 0;
+	memset(&arena, 0, sizeof arena);
+	memset(&ob, 0, sizeof ob);
+	if (uctl(ub, USB_GET_DEVICE_DESC, &ddesc) != 0)
+		err(1, "ioctl USB_GET_DEVICE_DESC");
+	if (uctl(ub, USB_GET_CONFIG, &co) != 0)
+		err(1, "ioctl USB_GET_CONFIG");
+	if (ofmt == OFMT_JSON) {
+		js_open(&ob, NULL, '{');
+		js_desc(&ob, "device", &ddesc, sizeof ddesc);
+		js_uint(&ob, "current_config", co);
+		js_open(&ob, "configs", '[');
+	} else {
+		rec = bin_begin(&ob);
+		bin_item(&ob, OB_DEVICE, -1, &ddesc, sizeof ddesc);
+		b = co;
+		bin_item(&ob, OB_CURCONFIG, -1, &b, 1);
+	}
+	n = all ? ddesc.bNumConfigurations : 1;
+	for (c = 0; c < n; c++) {
+		cd = get_cblob(ub, all ? c : USB_CURRENT_CONFIG_INDEX, &arena,
+		    &len);
+		if (ofmt == OFMT_JSON) {
+			udesc_parse(&ux, cd, len, &arena);
+			js_open(&ob, NULL, '{');
+			if (all)
+				js_uint(&ob, "index", c);
+			js_open(&ob, "descriptors", '[');
+			for (k = 0; k < ux.ux_ndesc; k++)
+				js_desc(&ob, NULL, UDESC_AT(&ux, k),
+				    ux.ux_len - ux.ux_desc[k]);
+			js_close(&ob, ']');
+			if (ux.ux_bad >= 0)
+				js_uint(&ob, "bad_offset", ux.ux_bad);
+			js_close(&ob, '}');
+		} else
+			bin_item(&ob, OB_CONFIG, all ? c : 0xff, cd, len);
+	}
+	if (ofmt == OFMT_JSON) {
+		js_close(&ob, ']');
+		js_close(&ob, '}');
+		js_end(&ob);
+	} else
+		bin_end(&ob, rec);
+	if (ob_write(&ob, stdout) < 0)
+		err(1, "write");
+	fflush(stdout);
+	ob_free(&ob);
+	afree(&arena);
+	if (verbose)
+		fprintf(stderr, "%d ioctls\n", nioctl);
+}
+
+void
+dump_desc(struct usbbus *ub, int all)
 {
 	usb_device_descriptor_t ddesc;
 	int c, co;
 
+	nioctl = 0;
 	if (verbose)
 		printf("Dumping %s descriptors\n", all ? "all" : "current");
-	if (ioctl(f, USB_GET_DEVICE_DESC, &ddesc) != 0)
+	if (uctl(ub, USB_GET_DEVICE_DESC, &ddesc) != 0)
 		err(1, "ioctl USB_GET_DEVICE_DESC");
 	printf("DEVICE descriptor:\n");
 	show_device_desc(0, &ddesc);
 	printf("\n");
 
 	if (all) {
-		if (ioctl(f, USB_GET_CONFIG, &co) != 0)
+		if (uctl(ub, USB_GET_CONFIG, &co) != 0)
 			err(1, "ioctl USB_GET_CONFIG");
 		printf("Current configuration is number %d\n\n", co);
 		for (c = 0; c < ddesc.bNumConfigurations; c++)
-			dump_cdesc(f, all, c);
+			dump_cdesc(ub, all, c);
 	} else
-		dump_cdesc(f, all, USB_CURRENT_CONFIG_INDEX);
+		dump_cdesc(ub, all, USB_CURRENT_CONFIG_INDEX);
+	if (verbose)
+		printf("%d ioctls\n", nioctl);
 }
 
 void
-dump_deviceinfo(int f)
+dump_deviceinfo(struct usbbus *ub)
 {
 	struct usb_device_info di;
 
-	if (ioctl(f, USB_GET_DEVICEINFO, &di) != 0)
+	if (uctl(ub, USB_GET_DEVICEINFO, &di) != 0)
 		err(1, "USB_GET_DEVICEINFO");
 	printf("Product: %s\n", di.udi_product);
 	printf("Vendor:  %s\n", di.udi_vendor);
 	printf("address %d\n", di.udi_addr);
 }
 
+/* Map a whole file read-only. */
+u_char *
+mapfile(const char *name, size_t *lenp)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	fd = open(name, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0)
+		err(1, "%s", name);
+	*lenp = st.st_size;
+	if (st.st_size == 0)
+		errx(1, "%s: empty", name);
+	p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+		err(1, "%s", name);
+	close(fd);
+	return p;
+}
+
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+char *hidkinds[] = { "Input", "Output", "Feature" };
+
+/*
+ * Compile the HID report descriptor in file desc and print where each
+ * field goes.  With a file of recorded input reports, all of the same
+ * (longest) length, also decode them a batch at a time and print one
+ * line of field values per report.
+ */
+#define HIDBATCH 1024
+
+void
+hid_offline(const char *desc, const char *reports)
+{
+	struct hidplan hp;
+	struct hidfield *hf;
+	const u_char *buf, *rep;
+	size_t dlen, blen;
+	int32_t *out;
+	int base[256], ncols[256];
+	int i, c, id, r, n, nrep, rlen, total;
+	double t = 0, t0;
+
+	buf = mapfile(desc, &dlen);
+	if (hid_compile(&hp, buf, dlen) < 0)
+		errx(1, "%s: bad report descriptor", desc);
+	munmap((void *)buf, dlen);
+	for (i = 0; i < hp.hp_nfields; i++) {
+		hf = &hp.hp_fields[i];
+		printf("id %d %s pos %u size %u usage 0x%08x logical %d..%d\n",
+		       hf->hf_id, hidkinds[hf->hf_kind], hf->hf_pos,
+		       hf->hf_size, hf->hf_usage, hf->hf_lmin, hf->hf_lmax);
+	}
+	if (reports == NULL)
+		goto out;
+
+	for (rlen = total = id = 0; id < 256; id++) {
+		ncols[id] = hid_nfields(&hp, HID_INPUT, id);
+		base[id] = total;
+		total += ncols[id];
+		if (hp.hp_bits[HID_INPUT][id] != 0 &&
+		    hid_reportlen(&hp, HID_INPUT, id) > rlen)
+			rlen = hid_reportlen(&hp, HID_INPUT, id);
+	}
+	if (rlen == 0)
+		errx(1, "%s: no input reports", desc);
+	buf = mapfile(reports, &blen);
+	nrep = blen / rlen;
+	out = malloc((size_t)total * HIDBATCH * sizeof *out);
+	if (out == NULL)
+		err(1, "malloc");
+	for (r = 0; r < nrep; r += n) {
+		n = nrep - r < HIDBATCH ? nrep - r : HIDBATCH;
+		t0 = now();
+		for (id = 0; id < 256; id++)
+			if (ncols[id])
+				hid_decode(&hp, HID_INPUT, id,
+				    buf + (size_t)r * rlen,
+				    rlen, n, out + (size_t)base[id] * n);
+		t += now() - t0;
+		for (i = 0; i < n; i++) {
+			rep = buf + (size_t)(r + i) * rlen;
+			id = hp.hp_hasid ? rep[0] : 0;
+			printf("%d:", id);
+			for (c = 0; c < ncols[id]; c++)
+				printf(" %d", out[(size_t)(base[id] + c) * n + i]);
+			printf("\n");
+		}
+	}
+	if (verbose)
+		fprintf(stderr, "%d reports decoded in %.6f s, %.0f reports/s\n",
+			nrep, t, t > 0 ? nrep / t : 0);
+	free(out);
+	munmap((void *)buf, blen);
+ out:
+	hid_freeplan(&hp);
+}
+
+/*
+ * Find the descriptor of endpoint addr in the current configuration.
+ */
+void
+find_endpoint(struct usbbus *ub, int addr, usb_endpoint_descriptor_t *edp)
+{
+	struct udesc_index ux;
+	struct arena arena;
+	usb_config_descriptor_t *cd;
+	usb_endpoint_descriptor_t *ed;
+	int e, len;
+
+	memset(&arena, 0, sizeof arena);
+	cd = get_cblob(ub, USB_CURRENT_CONFIG_INDEX, &arena, &len);
+	udesc_parse(&ux, cd, len, &arena);
+	for (e = 0; e < ux.ux_neps; e++) {
+		ed = UDESC_AT(&ux, ux.ux_eps[e]);
+		if (ed->bEndpointAddress == addr) {
+			*edp = *ed;
+			afree(&arena);
+			return;
+		}
+	}
+	errx(1, "no endpoint 0x%02x in the current configuration", addr);
+}
+
+/*
+ * Bulk throughput benchmark.  Workers share the endpoint node and
+ * each keeps a transfer of the given size outstanding until the
+ * deadline; every transfer's latency is recorded.
+ */
+#define XFERTIMEOUT	1000		/* ms */
+
+struct bench {
+	int		b_fd;
+	int		b_in;
+	size_t		b_size;
+	double		b_end;
+	pthread_mutex_t	b_lock;
+	u_int64_t	b_bytes;
+	u_long		b_xfers, b_short, b_errs;
+	struct samples	b_lat;
+};
+
+void *
+bench_worker(void *arg)
+{
+	struct bench *b = arg;
+	struct samples lat;
+	u_int64_t bytes = 0;
+	u_long n = 0, nshort = 0, nerr = 0;
+	u_char *buf;
+	double t0, t1;
+	ssize_t r;
+
+	memset(&lat, 0, sizeof lat);
+	buf = malloc(b->b_size);
+	if (buf == NULL)
+		err(1, "malloc");
+	memset(buf, 0x5a, b->b_size);
+	for (t1 = now(); t1 < b->b_end; ) {
+		t0 = t1;
+		if (b->b_in)
+			r = read(b->b_fd, buf, b->b_size);
+		else
+			r = write(b->b_fd, buf, b->b_size);
+		t1 = now();
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			nerr++;
+			if (errno == ETIMEDOUT)
+				continue;
+			warn("%s", b->b_in ? "read" : "write");
+			break;
+		}
+		smp_add(&lat, t1 - t0);
+		bytes += r;
+		n++;
+		if ((size_t)r < b->b_size)
+			nshort++;
+	}
+	free(buf);
+	pthread_mutex_lock(&b->b_lock);
+	b->b_bytes += bytes;
+	b->b_xfers += n;
+	b->b_short += nshort;
+	b->b_errs += nerr;
+	smp_merge(&b->b_lat, &lat);
+	pthread_mutex_unlock(&b->b_lock);
+	return NULL;
+}
+
+void
+bulk_bench(struct usbbus *ub, int addr, size_t size, double secs, int njobs)
+{
+	usb_endpoint_descriptor_t ed;
+	struct bench b;
+	pthread_t *tids;
+	double t0, t;
+	int i, e, mps, to = XFERTIMEOUT, one = 1;
+
+	find_endpoint(ub, addr, &ed);
+	if (UE_GET_XFERTYPE(ed.bmAttributes) != UE_BULK)
+		errx(1, "endpoint 0x%02x is not a bulk endpoint", addr);
+	mps = UGETW(ed.wMaxPacketSize) & 0x7ff;
+	if (mps && size % mps)
+		size += mps - size % mps;
+
+	memset(&b, 0, sizeof b);
+	pthread_mutex_init(&b.b_lock, NULL);
+	b.b_in = UE_GET_DIR(addr) == UE_DIR_IN;
+	b.b_size = size;
+	b.b_fd = ep_open(ctlname, addr, b.b_in ? O_RDONLY : O_WRONLY);
+	if (b.b_fd < 0)
+		err(1, "endpoint 0x%02x", addr);
+	if (b.b_in && uioctl(b.b_fd, USB_SET_SHORT_XFER, &one) != 0)
+		err(1, "USB_SET_SHORT_XFER");
+	if (uioctl(b.b_fd, USB_SET_TIMEOUT, &to) != 0)
+		err(1, "USB_SET_TIMEOUT");
+
+	printf("endpoint 0x%02x bulk %s wMaxPacketSize %d, %zu byte transfers, "
+	       "%d worker%s, %.1f s\n", addr, b.b_in ? "in" : "out", mps,
+	       size, njobs, njobs == 1 ? "" : "s", secs);
+	tids = calloc(njobs, sizeof *tids);
+	if (tids == NULL)
+		err(1, "calloc");
+	t0 = now();
+	b.b_end = t0 + secs;
+	for (i = 0; i < njobs; i++)
+		if ((e = pthread_create(&tids[i], NULL, bench_worker, &b))) {
+			errno = e;
+			err(1, "pthread_create");
+		}
+	for (i = 0; i < njobs; i++)
+		pthread_join(tids[i], NULL);
+	t = now() - t0;
+	close(b.b_fd);
+
+	printf("%lu transfers (%lu short, %lu errors), %llu bytes in %.2f s: "
+	       "%.2f MB/s\n", b.b_xfers, b.b_short, b.b_errs,
+	       (unsigned long long)b.b_bytes, t, b.b_bytes / t / 1e6);
+	if (b.b_xfers)
+		printf("latency p50 %.3f ms p99 %.3f ms p999 %.3f ms "
+		       "max %.3f ms\n", smp_pct(&b.b_lat, 50) * 1e3,
+		       smp_pct(&b.b_lat, 99) * 1e3,
+		       smp_pct(&b.b_lat, 99.9) * 1e3,
+		       smp_pct(&b.b_lat, 100) * 1e3);
+	smp_free(&b.b_lat);
+	free(tids);
+	pthread_mutex_destroy(&b.b_lock);
+}
+
+/*
+ * Print a histogram of v (seconds) in power of two microsecond buckets.
+ */
+#define NLOGBUCKETS	24
+
+void
+log_hist(const char *title, struct samples *v)
+{
+	u_long hist[NLOGBUCKETS + 1], most = 0;
+	size_t i;
+	int k, w;
+
+	memset(hist, 0, sizeof hist);
+	for (i = 0; i < v->s_n; i++) {
+		for (k = 0; k < NLOGBUCKETS && v->s_v[i] * 1e6 >= (1 << k); k++)
+			;
+		hist[k]++;
+	}
+	for (k = 0; k <= NLOGBUCKETS; k++)
+		if (hist[k] > most)
+			most = hist[k];
+	printf("%s:\n", title);
+	for (k = 0; k <= NLOGBUCKETS; k++) {
+		if (hist[k] == 0)
+			continue;
+		if (k == 0)
+			printf("  %10s %9s us", "", "< 1");
+		else
+			printf("  %10lu - %-9lu us", 1UL << (k - 1),
+			       (1UL << k) - 1);
+		w = (hist[k] * 50 + most - 1) / most;
+		printf(" %9lu %.*s\n", hist[k], w,
+		       "**************************************************");
+	}
+}
+
+/*
+ * Read an interrupt IN endpoint for secs seconds, time stamp every
+ * completion, and compare the inter-arrival times with the polling
+ * interval that bInterval asks for at the device's speed.  With
+ * tsfile, also write every time stamp and transfer length there.
+ */
+void
+intr_analyze(struct usbbus *ub, int addr, double secs, const char *tsfile)
+{
+	usb_endpoint_descriptor_t ed;
+	struct usb_device_info di;
+	struct samples ts, tlen, dts, jit;
+	u_char buf[1024];
+	double t0, t, last, expect, sum = 0, sum2 = 0, mean;
+	u_long n = 0, nlate = 0;
+	int fd, mps, hs = 0, to = XFERTIMEOUT, one = 1;
+	size_t i;
+	ssize_t r;
+	FILE *tf;
+
+	if (UE_GET_DIR(addr) != UE_DIR_IN)
+		errx(1, "endpoint 0x%02x is not an in endpoint", addr);
+	find_endpoint(ub, addr, &ed);
+	if (UE_GET_XFERTYPE(ed.bmAttributes) != UE_INTERRUPT)
+		errx(1, "endpoint 0x%02x is not an interrupt endpoint", addr);
+	if (uctl(ub, USB_GET_DEVICEINFO, &di) != 0)
+		err(1, "USB_GET_DEVICEINFO");
+#ifdef USB_SPEED_HIGH
+	hs = di.udi_speed >= USB_SPEED_HIGH;
+#endif
+	/* Full/low speed: bInterval frames; high speed: 2^(b-1) uframes. */
+	if (hs)
+		expect = (1 << ((ed.bInterval < 1 ? 1 : ed.bInterval > 16 ?
+		    16 : ed.bInterval) - 1)) * 125e-6;
+	else
+		expect = (ed.bInterval ? ed.bInterval : 1) * 1e-3;
+	mps = UGETW(ed.wMaxPacketSize) & 0x7ff;
+	if (mps == 0 || mps > sizeof buf)
+		mps = sizeof buf;
+
+	fd = ep_open(ctlname, addr, O_RDONLY);
+	if (fd < 0)
+		err(1, "endpoint 0x%02x", addr);
+	if (uioctl(fd, USB_SET_SHORT_XFER, &one) != 0)
+		err(1, "USB_SET_SHORT_XFER");
+	if (uioctl(fd, USB_SET_TIMEOUT, &to) != 0)
+		err(1, "USB_SET_TIMEOUT");
+	printf("endpoint 0x%02x interrupt in wMaxPacketSize %d bInterval %d, "
+	       "%s speed, expected interval %.3f ms\n", addr, mps,
+	       ed.bInterval, hs ? "high" : "full/low", expect * 1e3);
+
+	memset(&ts, 0, sizeof ts);
+	memset(&tlen, 0, sizeof tlen);
+	memset(&dts, 0, sizeof dts);
+	memset(&jit, 0, sizeof jit);
+	t0 = last = now();
+	while ((t = now()) < t0 + secs) {
+		r = read(fd, buf, mps);
+		t = now();
+		if (r < 0) {
+			if (errno == EINTR || errno == ETIMEDOUT)
+				continue;
+			err(1, "read");
+		}
+		if (tsfile) {
+			smp_add(&ts, t - t0);
+			smp_add(&tlen, r);
+		}
+		if (n++ > 0) {
+			smp_add(&dts, t - last);
+			smp_add(&jit, fabs(t - last - expect));
+			if (t - last > 1.5 * expect)
+				nlate++;
+		}
+		last = t;
+	}
+	close(fd);
+
+	printf("%lu transfers in %.2f s\n", n, now() - t0);
+	if (dts.s_n) {
+		for (i = 0; i < dts.s_n; i++) {
+			sum += dts.s_v[i];
+			sum2 += dts.s_v[i] * dts.s_v[i];
+		}
+		mean = sum / dts.s_n;
+		printf("interval mean %.3f ms stddev %.3f ms min %.3f ms "
+		       "max %.3f ms\n", mean * 1e3,
+		       sqrt(fmax(sum2 / dts.s_n - mean * mean, 0)) * 1e3,
+		       smp_pct(&dts, 0) * 1e3, smp_pct(&dts, 100) * 1e3);
+		printf("interval p50 %.3f ms p99 %.3f ms p999 %.3f ms, "
+		       "%lu late (> 1.5x expected)\n", smp_pct(&dts, 50) * 1e3,
+		       smp_pct(&dts, 99) * 1e3, smp_pct(&dts, 99.9) * 1e3,
+		       nlate);
+		log_hist("inter-arrival", &dts);
+		log_hist("jitter |interval - expected|", &jit);
+	}
+	if (tsfile) {
+		if ((tf = fopen(tsfile, "w")) == NULL)
+			err(1, "%s", tsfile);
+		for (i = 0; i < ts.s_n; i++)
+			fprintf(tf, "%.9f %d\n", ts.s_v[i], (int)tlen.s_v[i]);
+		if (fclose(tf) != 0)
+			err(1, "%s", tsfile);
+	}
+	smp_free(&ts);
+	smp_free(&tlen);
+	smp_free(&dts);
+	smp_free(&jit);
+}
+
+/*
+ * Stream capture.  The endpoint's alternate setting is selected if
+ * need be, and the data read from it goes to a file until the time is
+ * up or we are interrupted.
+ */
+#define UDESCSUB_AS_FORMAT_TYPE	2
+#define UA_FMT_PCM_TYPE_I	1
+#define UA_GET_CUR		0x81
+#define UA_SAMPLING_FREQ_CONTROL 0x01
+
+struct usb_audio_streaming_type1_descriptor {
+	uByte	bLength;
+	uByte	bDescriptorType;
+	uByte	bDescriptorSubtype;
+	uByte	bFormatType;
+	uByte	bNrChannels;
+	uByte	bSubFrameSize;
+	uByte	bBitResolution;
+	uByte	bSamFreqType;
+	uByte	tSamFreq[3];
+};
+#define GETSAMP(p) ((p)[0] | ((p)[1] << 8) | ((p)[2] << 16))
+
+volatile sig_atomic_t stopcap;
+
+void
+oncapsig(int sig)
+{
+	stopcap = 1;
+}
+
+/*
+ * Find endpoint addr in the alternate settings of the current
+ * configuration, select the one it is in, and return its index in ux.
+ */
+int
+select_epalt(struct usbbus *ub, struct udesc_index *ux, int addr,
+	     usb_endpoint_descriptor_t **edp)
+{
+	struct usb_alt_interface ai;
+	int i, n, a, e;
+
+	for (i = 0; i < ux->ux_nifcs; i++) {
+		for (n = 0, a = ux->ux_ifcs[i]; a != UDESC_NONE;
+		     n++, a = ux->ux_alts[a].ua_next) {
+			for (e = 0; e < ux->ux_alts[a].ua_nep; e++)
+				if (UDESC_EP(ux, a, e)->bEndpointAddress == addr)
+					goto found;
+		}
+	}
+	errx(1, "no endpoint 0x%02x in the current configuration", addr);
+ found:
+	*edp = UDESC_EP(ux, a, e);
+	ai.uai_config_index = USB_CURRENT_CONFIG_INDEX;
+	ai.uai_interface_index = i;
+	if (uctl(ub, USB_GET_ALTINTERFACE, &ai) != 0)
+		err(1, "USB_GET_ALTINTERFACE");
+	if (ai.uai_alt_no != n) {
+		if (verbose)
+			printf("selecting interface %d alt %d\n", i, n);
+		ai.uai_alt_no = n;
+		if (uctl(ub, USB_SET_ALTINTERFACE, &ai) != 0)
+			err(1, "USB_SET_ALTINTERFACE");
+	}
+	return a;
+}
+
+/*
+ * Bytes per second of an audio stream, from the type I format
+ * descriptor of alt a and the endpoint's current sampling frequency.
+ * 0 if the stream is not one we know.
+ */
+double
+stream_rate(struct usbbus *ub, struct udesc_index *ux, int a, int addr)
+{
+	struct usb_audio_streaming_type1_descriptor *d;
+	struct usb_ctl_request req;
+	u_char cur[3];
+	int c, freq;
+
+	for (c = 0; c < ux->ux_alts[a].ua_ncs; c++) {
+		d = (void *)UDESC_CS(ux, a, c);
+		if (d->bDescriptorType == UDESC_CS_INTERFACE &&
+		    d->bDescriptorSubtype == UDESCSUB_AS_FORMAT_TYPE &&
+		    d->bFormatType == UA_FMT_PCM_TYPE_I &&
+		    d->bLength >= sizeof *d)
+			break;
+	}
+	if (c == ux->ux_alts[a].ua_ncs)
+		return 0;
+
+	memset(&req, 0, sizeof req);
+	req.ucr_request.bmRequestType = UT_READ | UT_CLASS | UT_ENDPOINT;
+	req.ucr_request.bRequest = UA_GET_CUR;
+	USETW2(req.ucr_request.wValue, UA_SAMPLING_FREQ_CONTROL, 0);
+	USETW(req.ucr_request.wIndex, addr);
+	USETW(req.ucr_request.wLength, sizeof cur);
+	req.ucr_data = cur;
+	if (uctl(ub, USB_DO_REQUEST, &req) == 0)
+		freq = GETSAMP(cur);
+	else if (d->bSamFreqType == 0 && d->bLength >= sizeof *d + 3)
+		freq = GETSAMP(d->tSamFreq + 3);	/* continuous: upper */
+	else
+		freq = GETSAMP(d->tSamFreq);
+	if (verbose)
+		printf("%d channels, %d byte subframes, %d Hz\n",
+		       d->bNrChannels, d->bSubFrameSize, freq);
+	return (double)d->bNrChannels * d->bSubFrameSize * freq;
+}
+
+/*
+ * Single producer, single consumer ring of fixed size slots between
+ * the thread reading the endpoint and the one writing the file.  Each
+ * index is only stored by its own side; the other side reads it with
+ * acquire semantics, so no locks are needed.  Slots are filled in
+ * order and are full except for the very last one, so consecutive
+ * slots up to the end of the ring go out in one write.
+ */
+#define RINGSLOTS	64
+#define SLOTMIN		(64 * 1024)
+
+struct ring {
+	u_char		*r_buf;
+	size_t		r_slot;
+	size_t		r_len[RINGSLOTS];
+	u_long		r_head;		/* stored by the reader only */
+	u_long		r_tail;		/* stored by the writer only */
+	int		r_done;
+	int		r_err;
+	int		r_fd;
+};
+
+int
+writeall(int fd, const u_char *p, size_t n)
+{
+	ssize_t r;
+
+	while (n > 0) {
+		r = write(fd, p, n);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += r;
+		n -= r;
+	}
+	return 0;
+}
+
+void *
+ring_writer(void *arg)
+{
+	struct ring *r = arg;
+	struct timespec ts = { 0, 1000000 };
+	u_long h, t, n, i;
+	size_t len;
+
+	for (t = r->r_tail;;) {
+		h = __atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE);
+		if (h == t) {
+			if (__atomic_load_n(&r->r_done, __ATOMIC_ACQUIRE) &&
+			    __atomic_load_n(&r->r_head, __ATOMIC_ACQUIRE) == t)
+				break;
+			nanosleep(&ts, NULL);
+			continue;
+		}
+		n = h - t;
+		if (t % RINGSLOTS + n > RINGSLOTS)
+			n = RINGSLOTS - t % RINGSLOTS;
+		for (len = i = 0; i < n; i++)
+			len += r->r_len[(t + i) % RINGSLOTS];
+		if (writeall(r->r_fd, r->r_buf + (t % RINGSLOTS) * r->r_slot,
+		    len) < 0) {
+			__atomic_store_n(&r->r_err, errno, __ATOMIC_RELEASE);
+			break;
+		}
+		t += n;
+		__atomic_store_n(&r->r_tail, t, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+void
+iso_capture(struct usbbus *ub, int fd, usb_endpoint_descriptor_t *ed, double rate,
+	    int out, double secs)
+{
+	struct ring r;
+	pthread_t tid;
+	u_char *scratch, *p = NULL;
+	u_int64_t bytes = 0, dropbytes = 0;
+	u_long frames = 0, nshort = 0, drops = 0, tail, peak = 0;
+	size_t fsz, want, off = 0, k;
+	double t0, t;
+	ssize_t n;
+	int e, hs = 0, mps;
+	struct usb_device_info di;
+
+	if (uctl(ub, USB_GET_DEVICEINFO, &di) != 0)
+		err(1, "USB_GET_DEVICEINFO");
+#ifdef USB_SPEED_HIGH
+	hs = di.udi_speed >= USB_SPEED_HIGH;
+#endif
+	/* Read a millisecond's worth at most: one frame or eight uframes. */
+	mps = UGETW(ed->wMaxPacketSize);
+	fsz = (mps & 0x7ff) * (1 + ((mps >> 11) & 3)) * (hs ? 8 : 1);
+	if (fsz == 0)
+		errx(1, "endpoint 0x%02x has no bandwidth", ed->bEndpointAddress);
+	/* Slots a whole number of frames and, if cheap, of pages. */
+	memset(&r, 0, sizeof r);
+	for (k = 4096; fsz % k; k /= 2)
+		;
+	k = 4096 / k;
+	if (k * fsz > 16 * SLOTMIN)
+		k = 1;
+	r.r_slot = k * fsz;
+	while (r.r_slot < SLOTMIN)
+		r.r_slot += k * fsz;
+	r.r_fd = out;
+	if ((e = posix_memalign((void **)&r.r_buf, 4096,
+	    RINGSLOTS * r.r_slot)) != 0 ||
+	    (scratch = malloc(fsz)) == NULL) {
+		errno = e ? e : ENOMEM;
+		err(1, "ring");
+	}
+	printf("endpoint 0x%02x isochronous in, %zu byte frames, ring %d x %zu\n",
+	       ed->bEndpointAddress, fsz, RINGSLOTS, r.r_slot);
+	if (rate > 0)
+		printf("format says %.0f bytes/s\n", rate);
+	if ((e = pthread_create(&tid, NULL, ring_writer, &r))) {
+		errno = e;
+		err(1, "pthread_create");
+	}
+
+	t0 = now();
+	while (!stopcap && (secs == 0 || now() < t0 + secs) &&
+	    !__atomic_load_n(&r.r_err, __ATOMIC_ACQUIRE)) {
+		if (p == NULL) {
+			tail = __atomic_load_n(&r.r_tail, __ATOMIC_ACQUIRE);
+			if (r.r_head - tail > peak)
+				peak = r.r_head - tail;
+			if (r.r_head - tail < RINGSLOTS)
+				p = r.r_buf + (r.r_head % RINGSLOTS) * r.r_slot;
+		}
+		want = p ? (r.r_slot - off < fsz ? r.r_slot - off : fsz) : fsz;
+		n = read(fd, p ? p + off : scratch, want);
+		if (n < 0) {
+			if (errno == EINTR || errno == ETIMEDOUT)
+				continue;
+			err(1, "read");
+		}
+		frames++;
+		if ((size_t)n < want)
+			nshort++;
+		if (p == NULL) {
+			/* The writer is behind: this frame is lost. */
+			drops++;
+			dropbytes += n;
+			continue;
+		}
+		bytes += n;
+		off += n;
+		if (off == r.r_slot) {
+			r.r_len[r.r_head % RINGSLOTS] = off;
+			__atomic_store_n(&r.r_head, r.r_head + 1,
+			    __ATOMIC_RELEASE);
+			p = NULL;
+			off = 0;
+		}
+	}
+	if (off > 0) {
+		r.r_len[r.r_head % RINGSLOTS] = off;
+		__atomic_store_n(&r.r_head, r.r_head + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&r.r_done, 1, __ATOMIC_RELEASE);
+	pthread_join(tid, NULL);
+	t = now() - t0;
+	if (r.r_err) {
+		errno = r.r_err;
+		warn("write");
+	}
+
+	printf("%llu bytes in %.2f s: %.3f MB/s", (unsigned long long)bytes,
+	       t, bytes / t / 1e6);
+	if (rate > 0)
+		printf(", %.1f%% of the format's rate",
+		       (bytes + dropbytes) / t / rate * 100);
+	printf("\n%lu frames, %lu short, %lu dropped (%llu bytes) with the "
+	       "ring full, ring peak %lu/%d\n", frames, nshort, drops,
+	       (unsigned long long)dropbytes, peak, RINGSLOTS);
+	free(r.r_buf);
+	free(scratch);
+}
+
+/*
+ * Bulk capture.  Data is read straight into a shared mapping of the
+ * output file, so nothing is copied on the way to the page cache.
+ * Two windows are mapped at a time: when the current one fills up the
+ * next is already there, and the full one is unmapped and left to the
+ * kernel to write back.  A read is never cut short to fit a window or
+ * a file, as a bulk endpoint would overflow: if a whole transfer does
+ * not fit in what is left of the window, the windows are moved up to
+ * where the data ends, and a file is ended only after the transfer
+ * that fills it.  With rotation, files are named outname.000,
+ * outname.001 and so on.
+ */
+#define CAPWIN		(8 * 1024 * 1024)
+
+struct capfile {
+	const char	*cf_name;
+	int		cf_rotate;
+	int		cf_seq;
+	int		cf_fd;
+	off_t		cf_len;		/* bytes captured to this file */
+	off_t		cf_woff;	/* file offset of cf_win[0] */
+	u_char		*cf_win[2];
+};
+
+u_char *
+cap_map(struct capfile *cf, off_t off)
+{
+	void *p;
+
+	if (ftruncate(cf->cf_fd, off + CAPWIN) != 0)
+		err(1, "ftruncate");
+	p = mmap(0, CAPWIN, PROT_READ | PROT_WRITE, MAP_SHARED, cf->cf_fd,
+	    off);
+	if (p == MAP_FAILED)
+		err(1, "mmap");
+	return p;
+}
+
+void
+cap_open(struct capfile *cf)
+{
+	char name[1024];
+
+	if (cf->cf_rotate)
+		snprintf(name, sizeof name, "%s.%03d", cf->cf_name, cf->cf_seq);
+	else
+		snprintf(name, sizeof name, "%s", cf->cf_name);
+	cf->cf_fd = open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (cf->cf_fd < 0)
+		err(1, "%s", name);
+	cf->cf_len = cf->cf_woff = 0;
+	cf->cf_win[0] = cap_map(cf, 0);
+	cf->cf_win[1] = cap_map(cf, CAPWIN);
+}
+
+void
+cap_close(struct capfile *cf)
+{
+	munmap(cf->cf_win[0], CAPWIN);
+	munmap(cf->cf_win[1], CAPWIN);
+	if (ftruncate(cf->cf_fd, cf->cf_len) != 0 || close(cf->cf_fd) != 0)
+		err(1, "%s", cf->cf_name);
+	cf->cf_seq++;
+}
+
+double
+cputime(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+void
+bulk_capture(int fd, int addr, int mps, size_t size, const char *outname,
+	     double secs, off_t rotsize, double rotsecs, int standin)
+{
+	struct capfile cf;
+	u_int64_t bytes = 0;
+	u_long xfers = 0, nshort = 0;
+	off_t room, pgmask = getpagesize() - 1;
+	double t0, t, tf, c0, c;
+	ssize_t n;
+
+	if (mps && size % mps)
+		size += mps - size % mps;
+	if (size > CAPWIN / 2)
+		size = CAPWIN / 2;
+	/* So that files come out the same size when no transfer is short. */
+	if (rotsize % size)
+		rotsize += size - rotsize % size;
+	memset(&cf, 0, sizeof cf);
+	cf.cf_name = outname;
+	cf.cf_rotate = rotsize > 0 || rotsecs > 0;
+	printf("endpoint 0x%02x bulk in%s, %zu byte transfers\n", addr,
+	       standin ? " (file)" : "", size);
+
+	c0 = cputime();
+	t0 = tf = now();
+	cap_open(&cf);
+	while (!stopcap && (secs == 0 || (t = now()) < t0 + secs)) {
+		if ((rotsize && cf.cf_len >= rotsize) ||
+		    (rotsecs && now() >= tf + rotsecs)) {
+			cap_close(&cf);
+			cap_open(&cf);
+			tf = now();
+		}
+		room = CAPWIN - (cf.cf_len - cf.cf_woff);
+		if (room == 0) {
+			munmap(cf.cf_win[0], CAPWIN);
+			cf.cf_win[0] = cf.cf_win[1];
+			cf.cf_woff += CAPWIN;
+			cf.cf_win[1] = cap_map(&cf, cf.cf_woff + CAPWIN);
+		} else if (room < (off_t)size) {
+			munmap(cf.cf_win[0], CAPWIN);
+			munmap(cf.cf_win[1], CAPWIN);
+			cf.cf_woff = cf.cf_len & ~pgmask;
+			cf.cf_win[0] = cap_map(&cf, cf.cf_woff);
+			cf.cf_win[1] = cap_map(&cf, cf.cf_woff + CAPWIN);
+		}
+		n = read(fd, cf.cf_win[0] + (cf.cf_len - cf.cf_woff), size);
+		if (n < 0) {
+			if (errno == EINTR || errno == ETIMEDOUT)
+				continue;
+			err(1, "read");
+		}
+		if (n == 0 && standin)
+			break;
+		xfers++;
+		if ((size_t)n < size)
+			nshort++;
+		cf.cf_len += n;
+		bytes += n;
+	}
+	cap_close(&cf);
+	t = now() - t0;
+	c = cputime() - c0;
+
+	printf("%llu bytes in %.2f s to %d file%s: %.2f MB/s\n",
+	       (unsigned long long)bytes, t, cf.cf_seq,
+	       cf.cf_seq == 1 ? "" : "s", bytes / t / 1e6);
+	printf("%lu transfers, %lu short, %.2f s cpu", xfers, nshort, c);
+	if (bytes)
+		printf(", %.3f s cpu per GB", c / (bytes / 1e9));
+	printf("\n");
+}
+
+/*
+ * Capture what comes in on endpoint addr to file outname.  If the
+ * device is a plain file rather than a ugen node, the endpoint node
+ * is taken to be a file standing in for a bulk endpoint.
+ */
+void
+capture(struct usbbus *ub, int addr, const char *outname, double secs, size_t size,
+	off_t rotsize, double rotsecs)
+{
+	usb_endpoint_descriptor_t *ed = NULL;
+	usb_config_descriptor_t *cd;
+	struct udesc_index ux;
+	struct arena arena;
+	struct sigaction sa;
+	double rate = 0;
+	int a, fd, out, len, co, type, mps = 0, standin;
+	int to = XFERTIMEOUT, one = 1;
+
+	if (UE_GET_DIR(addr) != UE_DIR_IN)
+		errx(1, "endpoint 0x%02x is not an in endpoint", addr);
+	memset(&arena, 0, sizeof arena);
+	standin = uctl(ub, USB_GET_CONFIG, &co) != 0 && errno == ENOTTY;
+	if (standin)
+		type = UE_BULK;
+	else {
+		cd = get_cblob(ub, USB_CURRENT_CONFIG_INDEX, &arena, &len);
+		udesc_parse(&ux, cd, len, &arena);
+		a = select_epalt(ub, &ux, addr, &ed);
+		type = UE_GET_XFERTYPE(ed->bmAttributes);
+		mps = UGETW(ed->wMaxPacketSize) & 0x7ff;
+		if (type == UE_ISOCHRONOUS)
+			rate = stream_rate(ub, &ux, a, addr);
+		else if (type != UE_BULK)
+			errx(1, "endpoint 0x%02x cannot be captured", addr);
+	}
+
+	fd = ep_open(ctlname, addr, O_RDONLY);
+	if (fd < 0)
+		err(1, "endpoint 0x%02x", addr);
+	if (uioctl(fd, USB_SET_SHORT_XFER, &one) != 0 && errno != ENOTTY)
+		err(1, "USB_SET_SHORT_XFER");
+	if (uioctl(fd, USB_SET_TIMEOUT, &to) != 0 && errno != ENOTTY)
+		err(1, "USB_SET_TIMEOUT");
+
+	/* No SA_RESTART, so a blocked read sees the interrupt. */
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = oncapsig;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	if (type == UE_BULK)
+		bulk_capture(fd, addr, mps, size, outname, secs, rotsize,
+		    rotsecs, standin);
+	else {
+		out = open(outname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (out < 0)
+			err(1, "%s", outname);
+		iso_capture(ub, fd, ed, rate, out, secs);
+		if (close(out) != 0)
+			err(1, "%s", outname);
+	}
+	close(fd);
+	afree(&arena);
+}
+
 void
 usage(void)
 {
 	extern char *__progname;
 
-	fprintf(stderr, "Usage: %s [-c configno] [-d] [-D] [-i] -f device [-v]\n", __progname);
+	fprintf(stderr, "Usage: %s [-c configno] [-d] [-D] [-i] -f device [-o text|json|bin] [-v]\n", __progname);
+	fprintf(stderr, "       %s -f device -B endpoint [-j jobs] [-s size] [-t secs]\n", __progname);
+	fprintf(stderr, "       %s -f device -I endpoint [-t secs] [-T tsfile]\n", __progname);
+	fprintf(stderr, "       %s -f device -S endpoint -O file [-r secs] [-s size]\n"
+	    "       [-t secs] [-z size]\n", __progname);
+	fprintf(stderr, "       %s -H reportdesc [-R reports] [-v]\n", __progname);
 	exit(1);
 }
 
 int
 main(int argc, char **argv)
 {
-	char *dev = 0;
+	char *dev = 0, *hdesc = 0, *hreports = 0;
 	char devbuf[1024];
-	int f, ch, i;
+	struct usbbus *ub = NULL;
+	int ch, i, bep = -1, iep = -1, njobs = 1;
+	int sep = -1;
+	char *tsfile = 0, *capfile = 0;
+	size_t bsize = 65536;
+	off_t rotsize = 0;
+	double rotsecs = 0;
+	double bsecs = 0;
 
 	/* Find device first */
 	for (i = 1; i < argc-1; i++) {
@@ -265,47 +1462,119 @@ main(int argc, char **argv)
 			dev = argv[i+1];
 			break;
 		}
+		if (strcmp(argv[i], "-H") == 0)
+			hdesc = argv[i+1];
 	}
-	if (!dev)
+	if (!dev && !hdesc)
 		usage();
+	if (!dev)
+		goto nodev;
 
-	f = open(dev, O_RDWR);
-	if (f < 0) {
+	ub = usbbus_open(dev);
+	ctlname = dev;
+	if (ub == NULL && strncmp(dev, "sim:", 4) != 0) {
+		ctlname = devbuf;
 		if (dev[0] != '/') {
 			sprintf(devbuf, "/dev/%s", dev);
-			f = open(devbuf, O_RDWR);
+			ub = usbbus_open(devbuf);
 		} else
 			strcpy(devbuf, dev);
-		if (f < 0) {
+		if (ub == NULL) {
 			if (!strchr(devbuf, '.')) {
 				strcat(devbuf, ".00");
-				f = open(devbuf, O_RDWR);
+				ub = usbbus_open(devbuf);
 			}
 		}
 	}
-	if (f < 0)
+	if (ub == NULL)
 		err(1, "%s", dev);
 
-	while ((ch = getopt(argc, argv, "c:dDf:iv")) != -1) {
+ nodev:
+	while ((ch = getopt(argc, argv, "B:c:dDf:H:iI:j:o:O:r:R:s:S:t:T:vz:")) != -1) {
+		if (ub == NULL && strchr("cdDi", ch))
+			usage();
 		switch(ch) {
+		case 'B':
+			bep = strtol(optarg, NULL, 0);
+			if (bep <= 0 || bep > 0xff || (bep & 0x70))
+				usage();
+			break;
 		case 'c':
-			set_conf(f, atoi(optarg));
+			set_conf(ub, atoi(optarg));
 			break;
 		case 'd':
-			dump_desc(f, 0);
+			if (ofmt == OFMT_TEXT)
+				dump_desc(ub, 0);
+			else
+				out_desc(ub, 0);
 			break;
 		case 'D':
-			dump_desc(f, 1);
+			if (ofmt == OFMT_TEXT)
+				dump_desc(ub, 1);
+			else
+				out_desc(ub, 1);
 			break;
 		case 'f':
 			break;
+		case 'H':
+			hdesc = optarg;
+			break;
 		case 'i':
-			dump_deviceinfo(f);
+			dump_deviceinfo(ub);
 			printf("\n");
 			break;
+		case 'I':
+			iep = strtol(optarg, NULL, 0);
+			if (iep <= 0 || iep > 0xff || (iep & 0x70))
+				usage();
+			break;
+		case 'j':
+			njobs = atoi(optarg);
+			if (njobs < 1)
+				usage();
+			break;
+		case 'o':
+			ofmt = outformat(optarg);
+			if (ofmt < 0)
+				usage();
+			break;
+		case 'O':
+			capfile = optarg;
+			break;
+		case 'r':
+			rotsecs = atof(optarg);
+			if (rotsecs <= 0)
+				usage();
+			break;
+		case 'R':
+			hreports = optarg;
+			break;
+		case 's':
+			bsize = strtoul(optarg, NULL, 0);
+			if (bsize == 0)
+				usage();
+			break;
+		case 'S':
+			sep = strtol(optarg, NULL, 0);
+			if (sep <= 0 || sep > 0xff || (sep & 0x70))
+				usage();
+			break;
+		case 't':
+			bsecs = atof(optarg);
+			if (bsecs <= 0)
+				usage();
+			break;
+		case 'T':
+			tsfile = optarg;
+			break;
 		case 'v':
 			verbose = 1;
 			break;
+		case 'z':
+			rotsize = strtoll(optarg, NULL, 0);
+			if (rotsize <= 0)
+				usage();
+			break;
 		case '?':
 		default:
 			usage();
@@ -314,5 +1583,18 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
+	if ((hreports && !hdesc) || ((bep >= 0 || iep >= 0) && ub == NULL) ||
+	    (tsfile && iep < 0) || (sep >= 0 && (ub == NULL || !capfile)) ||
+	    (capfile && sep < 0))
+		usage();
+	if (bep >= 0)
+		bulk_bench(ub, bep, bsize, bsecs ? bsecs : 10, njobs);
+	if (iep >= 0)
+		intr_analyze(ub, iep, bsecs ? bsecs : 10, tsfile);
+	if (sep >= 0)
+		capture(ub, sep, capfile, bsecs, bsize, rotsize, rotsecs);
+	if (hdesc)
+		hid_offline(hdesc, hreports);
+
 	exit(0);
 }
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <err.h>
+#include <dev/usb/usb.h>
+
+#include "usbout.h"
+
+static const char hexdigits[] = "0123456789abcdef";
+
+int
+outformat(const char *s)
+{
+	if (strcmp(s, "text") == 0)
+		return OFMT_TEXT;
+	if (strcmp(s, "json") == 0)
+		return OFMT_JSON;
+	if (strcmp(s, "bin") == 0)
+		return OFMT_BIN;
+	return -1;
+}
+
+void
+ob_reset(struct obuf *ob)
+{
+	ob->ob_len = 0;
+	ob->ob_depth = 0;
+	ob->ob_more = 0;
+}
+
+void
+ob_free(struct obuf *ob)
+{
+	free(ob->ob_buf);
+	memset(ob, 0, sizeof *ob);
+}
+
+static void
+ob_grow(struct obuf *ob, size_t n)
+{
+	size_t sz;
+
+	if (ob->ob_size - ob->ob_len >= n)
+		return;
+	for (sz = ob->ob_size ? ob->ob_size : 4096; sz - ob->ob_len < n; )
+		sz *= 2;
+	ob->ob_buf = realloc(ob->ob_buf, sz);
+	if (ob->ob_buf == NULL)
+		err(1, "realloc");
+	ob->ob_size = sz;
+}
+
+void
+ob_put(struct obuf *ob, const void *p, size_t n)
+{
+	ob_grow(ob, n);
+	memcpy(ob->ob_buf + ob->ob_len, p, n);
+	ob->ob_len += n;
+}
+
+void
+ob_putc(struct obuf *ob, int c)
+{
+	ob_grow(ob, 1);
+	ob->ob_buf[ob->ob_len++] = c;
+}
+
+void
+ob_uint(struct obuf *ob, u_long v)
+{
+	char b[24], *p = b + sizeof b;
+
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	ob_put(ob, p, b + sizeof b - p);
+}
+
+int
+ob_write(struct obuf *ob, FILE *fp)
+{
+	if (fwrite(ob->ob_buf, 1, ob->ob_len, fp) != ob->ob_len)
+		return -1;
+	return 0;
+}
+
+/* Comma and key handling shared by all JSON values. */
+static void
+js_key(struct obuf *ob, const char *k)
+{
+	u_int32_t bit = 1U << ob->ob_depth;
+
+	if (ob->ob_more & bit)
+		ob_putc(ob, ',');
+	ob->ob_more |= bit;
+	if (k) {
+		ob_putc(ob, '"');
+		ob_put(ob, k, strlen(k));
+		ob_put(ob, "\":", 2);
+	}
+}
+
+void
+js_open(struct obuf *ob, const char *k, int c)
+{
+	js_key(ob, k);
+	ob_putc(ob, c);
+	if (ob->ob_depth < OB_MAXDEPTH - 1)
+		ob->ob_depth++;
+	ob->ob_more &= ~(1U << ob->ob_depth);
+}
+
+void
+js_close(struct obuf *ob, int c)
+{
+	if (ob->ob_depth > 0)
+		ob->ob_depth--;
+	ob_putc(ob, c);
+}
+
+void
+js_end(struct obuf *ob)
+{
+	ob_putc(ob, '\n');
+	ob->ob_depth = 0;
+	ob->ob_more = 0;
+}
+
+void
+js_uint(struct obuf *ob, const char *k, u_long v)
+{
+	js_key(ob, k);
+	ob_uint(ob, v);
+}
+
+static void
+js_char(struct obuf *ob, u_int c)
+{
+	char b[6];
+
+	if (c == '"' || c == '\\') {
+		ob_putc(ob, '\\');
+		ob_putc(ob, c);
+	} else if (c >= 0x20 && c < 0x7f)
+		ob_putc(ob, c);
+	else {
+		b[0] = '\\';
+		b[1] = 'u';
+		b[2] = hexdigits[(c >> 12) & 0xf];
+		b[3] = hexdigits[(c >> 8) & 0xf];
+		b[4] = hexdigits[(c >> 4) & 0xf];
+		b[5] = hexdigits[c & 0xf];
+		ob_put(ob, b, 6);
+	}
+}
+
+void
+js_str(struct obuf *ob, const char *k, const char *s)
+{
+	js_key(ob, k);
+	ob_putc(ob, '"');
+	while (*s)
+		js_char(ob, (u_char)*s++);
+	ob_putc(ob, '"');
+}
+
+void
+js_utf16(struct obuf *ob, const char *k, const usb_string_descriptor_t *us)
+{
+	int i, n;
+
+	js_key(ob, k);
+	ob_putc(ob, '"');
+	n = us->bLength / 2 - 1;
+	if (n > (int)(sizeof us->bString / sizeof us->bString[0]))
+		n = sizeof us->bString / sizeof us->bString[0];
+	for (i = 0; i < n; i++)
+		js_char(ob, UGETW(us->bString[i]));
+	ob_putc(ob, '"');
+}
+
+void
+js_hex(struct obuf *ob, const char *k, const void *p, size_t n)
+{
+	const u_char *s = p;
+
+	js_key(ob, k);
+	ob_grow(ob, 2 * n + 2);
+	ob->ob_buf[ob->ob_len++] = '"';
+	while (n--) {
+		ob->ob_buf[ob->ob_len++] = hexdigits[*s >> 4];
+		ob->ob_buf[ob->ob_len++] = hexdigits[*s++ & 0xf];
+	}
+	ob->ob_buf[ob->ob_len++] = '"';
+}
+
+/*
+ * A standard descriptor as an object with one member per field.
+ * Anything else, including class specific descriptors, is given as
+ * its type, subtype and raw bytes.  Only the first len bytes at p
+ * are read, whatever bLength says.
+ */
+void
+js_desc(struct obuf *ob, const char *k, const void *p, size_t len)
+{
+	const usb_descriptor_t *d = p;
+	size_t n;
+
+	js_open(ob, k, '{');
+	if (len < 2) {
+		js_hex(ob, "raw", p, len);
+		js_close(ob, '}');
+		return;
+	}
+	n = d->bLength < len ? d->bLength : len;
+	js_uint(ob, "bLength", d->bLength);
+	js_uint(ob, "bDescriptorType", d->bDescriptorType);
+	switch (d->bDescriptorType) {
+	case UDESC_DEVICE:
+	{
+		const usb_device_descriptor_t *dd = p;
+
+		if (n < USB_DEVICE_DESCRIPTOR_SIZE)
+			goto raw;
+		js_uint(ob, "bcdUSB", UGETW(dd->bcdUSB));
+		js_uint(ob, "bDeviceClass", dd->bDeviceClass);
+		js_uint(ob, "bDeviceSubClass", dd->bDeviceSubClass);
+		js_uint(ob, "bDeviceProtocol", dd->bDeviceProtocol);
+		js_uint(ob, "bMaxPacketSize", dd->bMaxPacketSize);
+		js_uint(ob, "idVendor", UGETW(dd->idVendor));
+		js_uint(ob, "idProduct", UGETW(dd->idProduct));
+		js_uint(ob, "bcdDevice", UGETW(dd->bcdDevice));
+		js_uint(ob, "iManufacturer", dd->iManufacturer);
+		js_uint(ob, "iProduct", dd->iProduct);
+		js_uint(ob, "iSerialNumber", dd->iSerialNumber);
+		js_uint(ob, "bNumConfigurations", dd->bNumConfigurations);
+		break;
+	}
+	case UDESC_CONFIG:
+	{
+		const usb_config_descriptor_t *cd = p;
+
+		if (n < USB_CONFIG_DESCRIPTOR_SIZE)
+			goto raw;
+		js_uint(ob, "wTotalLength", UGETW(cd->wTotalLength));
+		js_uint(ob, "bNumInterface", cd->bNumInterface);
+		js_uint(ob, "bConfigurationValue", cd->bConfigurationValue);
+		js_uint(ob, "iConfiguration", cd->iConfiguration);
+		js_uint(ob, "bmAttributes", cd->bmAttributes);
+		js_uint(ob, "bMaxPower", cd->bMaxPower);
+		break;
+	}
+	case UDESC_INTERFACE:
+	{
+		const usb_interface_descriptor_t *id = p;
+
+		if (n < USB_INTERFACE_DESCRIPTOR_SIZE)
+			goto raw;
+		js_uint(ob, "bInterfaceNumber", id->bInterfaceNumber);
+		js_uint(ob, "bAlternateSetting", id->bAlternateSetting);
+		js_uint(ob, "bNumEndpoints", id->bNumEndpoints);
+		js_uint(ob, "bInterfaceClass", id->bInterfaceClass);
+		js_uint(ob, "bInterfaceSubClass", id->bInterfaceSubClass);
+		js_uint(ob, "bInterfaceProtocol", id->bInterfaceProtocol);
+		js_uint(ob, "iInterface", id->iInterface);
+		break;
+	}
+	case UDESC_ENDPOINT:
+	{
+		const usb_endpoint_descriptor_t *ed = p;
+
+		if (n < USB_ENDPOINT_DESCRIPTOR_SIZE)
+			goto raw;
+		js_uint(ob, "bEndpointAddress", ed->bEndpointAddress);
+		js_uint(ob, "bmAttributes", ed->bmAttributes);
+		js_uint(ob, "wMaxPacketSize", UGETW(ed->wMaxPacketSize));
+		js_uint(ob, "bInterval", ed->bInterval);
+		break;
+	}
+	default:
+	raw:
+		if (n >= 3)
+			js_uint(ob, "bDescriptorSubtype", d->bDescriptorSubtype);
+		js_hex(ob, "raw", p, n);
+		break;
+	}
+	js_close(ob, '}');
+}
+
+/* Start a binary record; returns where its length goes. */
+size_t
+bin_begin(struct obuf *ob)
+{
+	size_t o = ob->ob_len;
+
+	ob_put(ob, "\0\0\0\0", 4);
+	return o;
+}
+
+void
+bin_end(struct obuf *ob, size_t o)
+{
+	size_t n = ob->ob_len - o - 4;
+
+	USETDW(ob->ob_buf + o, n);
+}
+
+/* One item; pre is a leading index byte, or -1 for none. */
+void
+bin_item(struct obuf *ob, int tag, int pre, const void *p, size_t n)
+{
+	u_char h[6];
+	size_t hl = 5;
+
+	h[0] = tag;
+	USETDW(h + 1, n + (pre >= 0));
+	if (pre >= 0)
+		h[hl++] = pre;
+	ob_put(ob, h, hl);
+	ob_put(ob, p, n);
+}
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Buffered writers for machine readable output.  A whole device is
+ * built up in an obuf, straight from the descriptor structures, and
+ * then handed to the output with a single write.
+ *
+ * OFMT_JSON writes one JSON object per line.
+ *
+ * OFMT_BIN writes a record per device: a 32 bit little endian length
+ * of the rest of the record, then items of one tag byte, a 32 bit
+ * little endian length and that many bytes of data.  Descriptors are
+ * stored exactly as they came from the device.
+ */
+#define OFMT_TEXT	0
+#define OFMT_JSON	1
+#define OFMT_BIN	2
+
+#define OB_ADDR		1	/* u8 device address */
+#define OB_DEVICE	2	/* device descriptor */
+#define OB_CONFIG	3	/* u8 config index, full configuration */
+#define OB_STRING	4	/* u8 string index, string descriptor */
+#define OB_CURCONFIG	5	/* u8 current configuration value */
+#define OB_HUB		6	/* hub descriptor */
+#define OB_HUBSTATUS	7	/* usb_hub_status_t */
+#define OB_PORTSTATUS	8	/* u8 port number, usb_port_status_t */
+#define OB_PARTIAL	9	/* u8 errno, what could not be read (text) */
+#define OB_BLOB		10	/* name of the blob decoded with -B (text) */
+
+#define OB_MAXDEPTH	32
+
+struct obuf {
+	u_char		*ob_buf;
+	size_t		ob_len;
+	size_t		ob_size;
+	int		ob_depth;
+	u_int32_t	ob_more;	/* bit per level: comma needed */
+};
+
+int outformat(const char *);
+void ob_reset(struct obuf *);
+void ob_free(struct obuf *);
+void ob_put(struct obuf *, const void *, size_t);
+void ob_putc(struct obuf *, int);
+void ob_uint(struct obuf *, u_long);
+int ob_write(struct obuf *, FILE *);
+
+void js_open(struct obuf *, const char *, int);
+void js_close(struct obuf *, int);
+void js_uint(struct obuf *, const char *, u_long);
+void js_str(struct obuf *, const char *, const char *);
+void js_utf16(struct obuf *, const char *, const usb_string_descriptor_t *);
+void js_hex(struct obuf *, const char *, const void *, size_t);
+void js_desc(struct obuf *, const char *, const void *, size_t);
+void js_end(struct obuf *);
+
+size_t bin_begin(struct obuf *);
+void bin_end(struct obuf *, size_t);
+void bin_item(struct obuf *, int, int, const void *, size_t);
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <dev/usb/usb.h>
+
+#include "usbbus.h"
+#include "usbq.h"
+
+struct usbq {
+	struct usbbus	*q_ub;
+	int		q_async;	/* the backend does submit/reap */
+	pthread_mutex_t	q_lock;
+	pthread_cond_t	q_work;		/* something to do, or stop */
+	pthread_cond_t	q_done;		/* something completed */
+	struct usbq_req	*q_head, **q_tail;	/* waiting for a thread */
+	struct usbq_req	*q_dhead, **q_dtail;	/* completed, not reaped */
+	pthread_t	*q_thr;
+	int		q_nthr;
+	int		q_stop;
+	struct usbq_stats q_st;
+};
+
+/* Milliseconds left until end, at least 0. */
+static int
+q_left(const struct timespec *end)
+{
+	struct timespec now;
+	long ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (end->tv_sec - now.tv_sec) * 1000 +
+	    (end->tv_nsec - now.tv_nsec) / 1000000;
+	return ms < 0 ? 0 : ms;
+}
+
+static void
+q_depth(struct usbq *q)
+{
+	if (q->q_st.qs_queued + q->q_st.qs_inflight > q->q_st.qs_maxdepth)
+		q->q_st.qs_maxdepth = q->q_st.qs_queued + q->q_st.qs_inflight;
+}
+
+/* Account for a completed request and put it on the done list. */
+static void
+q_complete(struct usbq *q, struct usbq_req *r)
+{
+	struct timespec now;
+	double t;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	t = (now.tv_sec - r->uq_start.tv_sec) +
+	    (now.tv_nsec - r->uq_start.tv_nsec) / 1e9;
+	q->q_st.qs_completed++;
+	q->q_st.qs_latsum += t;
+	if (t > q->q_st.qs_latmax)
+		q->q_st.qs_latmax = t;
+	r->uq_next = NULL;
+	*q->q_dtail = r;
+	q->q_dtail = &r->uq_next;
+	pthread_cond_signal(&q->q_done);
+}
+
+static void *
+q_worker(void *arg)
+{
+	struct usbq *q = arg;
+	struct usbq_req *r;
+	int rc;
+
+	pthread_mutex_lock(&q->q_lock);
+	for (;;) {
+		while (!q->q_stop && q->q_head == NULL)
+			pthread_cond_wait(&q->q_work, &q->q_lock);
+		if ((r = q->q_head) == NULL)
+			break;
+		if ((q->q_head = r->uq_next) == NULL)
+			q->q_tail = &q->q_head;
+		q->q_st.qs_queued--;
+		q->q_st.qs_inflight++;
+		pthread_mutex_unlock(&q->q_lock);
+		rc = usbbus_request(q->q_ub, &r->uq_req);
+		r->uq_error = rc < 0 ? errno : 0;
+		pthread_mutex_lock(&q->q_lock);
+		q->q_st.qs_inflight--;
+		q_complete(q, r);
+	}
+	pthread_mutex_unlock(&q->q_lock);
+	return NULL;
+}
+
+/*
+ * Open a queue on ub that keeps up to depth requests in flight when
+ * it has to use threads.
+ */
+struct usbq *
+usbq_open(struct usbbus *ub, int depth)
+{
+	pthread_condattr_t ca;
+	struct usbq *q;
+	int i;
+
+	if ((q = calloc(1, sizeof *q)) == NULL)
+		err(1, "calloc");
+	q->q_ub = ub;
+	q->q_async = ub->ub_ops->uo_submit != NULL;
+	q->q_tail = &q->q_head;
+	q->q_dtail = &q->q_dhead;
+	pthread_mutex_init(&q->q_lock, NULL);
+	pthread_cond_init(&q->q_work, NULL);
+	/* usbq_reap's time limit is on the monotonic clock. */
+	pthread_condattr_init(&ca);
+	pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+	pthread_cond_init(&q->q_done, &ca);
+	pthread_condattr_destroy(&ca);
+	if (q->q_async)
+		return q;
+	if (depth < 1)
+		depth = 1;
+	if ((q->q_thr = calloc(depth, sizeof *q->q_thr)) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < depth; i++)
+		if (pthread_create(&q->q_thr[i], NULL, q_worker, q) != 0)
+			errx(1, "pthread_create");
+	q->q_nthr = depth;
+	return q;
+}
+
+void
+usbq_submit(struct usbq *q, struct usbq_req *r)
+{
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &r->uq_start);
+	r->uq_error = 0;
+	r->uq_next = NULL;
+	pthread_mutex_lock(&q->q_lock);
+	q->q_st.qs_submitted++;
+	if (!q->q_async) {
+		*q->q_tail = r;
+		q->q_tail = &r->uq_next;
+		q->q_st.qs_queued++;
+		q_depth(q);
+		pthread_cond_signal(&q->q_work);
+		pthread_mutex_unlock(&q->q_lock);
+		return;
+	}
+	q->q_st.qs_inflight++;
+	q_depth(q);
+	pthread_mutex_unlock(&q->q_lock);
+	/* Backends finish what they can answer at once right here. */
+	rc = q->q_ub->ub_ops->uo_submit(q->q_ub, &r->uq_req, r);
+	if (rc == 0)
+		return;
+	r->uq_error = rc < 0 ? errno : 0;
+	pthread_mutex_lock(&q->q_lock);
+	q->q_st.qs_inflight--;
+	q_complete(q, r);
+	pthread_mutex_unlock(&q->q_lock);
+}
+
+/*
+ * Get a completed request, waiting up to timeout ms for one.  Returns
+ * NULL if nothing is outstanding, or with errno ETIMEDOUT if the time
+ * ran out.
+ */
+struct usbq_req *
+usbq_reap(struct usbq *q, int timeout)
+{
+	struct usbq_req *r;
+	struct timespec end;
+	int error, ms = -1, tried = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (timeout > 0) {
+		end.tv_sec += timeout / 1000;
+		end.tv_nsec += timeout % 1000 * 1000000;
+		if (end.tv_nsec >= 1000000000) {
+			end.tv_sec++;
+			end.tv_nsec -= 1000000000;
+		}
+	}
+	pthread_mutex_lock(&q->q_lock);
+	for (;;) {
+		if ((r = q->q_dhead) != NULL) {
+			if ((q->q_dhead = r->uq_next) == NULL)
+				q->q_dtail = &q->q_dhead;
+			break;
+		}
+		if (q->q_st.qs_queued + q->q_st.qs_inflight == 0)
+			break;
+		if (timeout >= 0 && (ms = q_left(&end)) == 0 && tried) {
+			errno = ETIMEDOUT;
+			break;
+		}
+		tried = 1;
+		if (!q->q_async) {
+			if (timeout < 0)
+				pthread_cond_wait(&q->q_done, &q->q_lock);
+			else
+				pthread_cond_timedwait(&q->q_done, &q->q_lock,
+				    &end);
+			continue;
+		}
+		pthread_mutex_unlock(&q->q_lock);
+		r = q->q_ub->ub_ops->uo_reap(q->q_ub, ms, &error);
+		pthread_mutex_lock(&q->q_lock);
+		if (r == NULL) {
+			if (errno == ETIMEDOUT)
+				continue;
+			break;
+		}
+		r->uq_error = error;
+		q->q_st.qs_inflight--;
+		q_complete(q, r);
+	}
+	pthread_mutex_unlock(&q->q_lock);
+	return r;
+}
+
+/*
+ * Fail the requests that are still queued, and have the backend cut
+ * short those on the bus if it can.
+ */
+void
+usbq_cancel(struct usbq *q)
+{
+	struct usbq_req *r;
+
+	pthread_mutex_lock(&q->q_lock);
+	while ((r = q->q_head) != NULL) {
+		q->q_head = r->uq_next;
+		q->q_st.qs_queued--;
+		r->uq_error = ECANCELED;
+		q_complete(q, r);
+	}
+	q->q_tail = &q->q_head;
+	pthread_mutex_unlock(&q->q_lock);
+	if (q->q_ub->ub_ops->uo_cancel != NULL)
+		q->q_ub->ub_ops->uo_cancel(q->q_ub);
+}
+
+void
+usbq_stats(struct usbq *q, struct usbq_stats *st)
+{
+	pthread_mutex_lock(&q->q_lock);
+	*st = q->q_st;
+	pthread_mutex_unlock(&q->q_lock);
+}
+
+/*
+ * Close the queue.  Nothing may be left on the bus writing into the
+ * caller's buffers, so outstanding requests are cancelled and reaped
+ * first; their answers are forgotten.
+ */
+void
+usbq_close(struct usbq *q)
+{
+	int i;
+
+	usbq_cancel(q);
+	while (usbq_reap(q, -1) != NULL)
+		;
+	pthread_mutex_lock(&q->q_lock);
+	q->q_stop = 1;
+	pthread_cond_broadcast(&q->q_work);
+	pthread_mutex_unlock(&q->q_lock);
+	for (i = 0; i < q->q_nthr; i++)
+		pthread_join(q->q_thr[i], NULL);
+	free(q->q_thr);
+	pthread_cond_destroy(&q->q_work);
+	pthread_cond_destroy(&q->q_done);
+	pthread_mutex_destroy(&q->q_lock);
+	free(q);
+}
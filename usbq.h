@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Asynchronous control requests.  Requests are submitted to a queue
+ * and reaped in whatever order they complete, so that many can be in
+ * flight on different devices at once.  A backend that can do the
+ * I/O asynchronously itself (usbfs URBs on Linux) is used directly;
+ * any other gets a pool of threads, each doing one request at a time.
+ * Only one thread may reap from a queue.
+ *
+ * usbq_reap waits up to timeout ms, or for ever if it is negative,
+ * and returns NULL with errno ETIMEDOUT if nothing completed in time.
+ * usbq_cancel fails what is queued and asks the backend to cut short
+ * what is on the bus; either way the requests are still reaped, with
+ * uq_error ECANCELED unless they completed first.  usbq_close cancels
+ * and reaps whatever is outstanding before freeing the queue.
+ */
+struct usbq_req {
+	struct usb_ctl_request uq_req;
+	void		*uq_arg;	/* the caller's */
+	int		uq_error;	/* errno, 0 if it worked */
+	struct timespec	uq_start;
+	struct usbq_req	*uq_next;
+};
+
+struct usbq_stats {
+	u_long		qs_submitted;
+	u_long		qs_completed;
+	int		qs_queued;	/* waiting for a thread */
+	int		qs_inflight;	/* on the bus */
+	int		qs_maxdepth;	/* most queued and in flight at once */
+	double		qs_latsum;	/* seconds from submit to completion */
+	double		qs_latmax;
+};
+
+struct usbq;
+
+struct usbq *usbq_open(struct usbbus *, int);
+void usbq_submit(struct usbq *, struct usbq_req *);
+struct usbq_req *usbq_reap(struct usbq *, int);
+void usbq_cancel(struct usbq *);
+void usbq_stats(struct usbq *, struct usbq_stats *);
+void usbq_close(struct usbq *);
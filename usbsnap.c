@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <err.h>
+#include <errno.h>
+#include <time.h>
+#include <dev/usb/usb.h>
+
+#include "usbsnap.h"
+
+/*
+ * The file is a header, a directory of USB_MAX_DEVICES entries by
+ * address, and then each present device's records back to back.
+ */
+#define SN_MAGIC	"USBSNAP1"
+#define SN_VERSION	1
+#define SN_ALIGN(n)	(((n) + 7) & ~7)
+
+struct snhdr {
+	char		sh_magic[8];
+	u_int32_t	sh_version;
+	u_int32_t	sh_ndev;
+	u_int64_t	sh_size;	/* of the whole file */
+	u_int64_t	sh_time;	/* when it was written */
+};
+
+struct snap {
+	u_char		*sn_map;
+	size_t		sn_size;
+	struct snapdev	*sn_dev;
+};
+
+struct snapw {
+	struct snhdr	sw_hdr;
+	struct snapdev	sw_dev[USB_MAX_DEVICES];
+	u_char		*sw_buf;	/* the records */
+	size_t		sw_len, sw_size;
+	struct snapdev	*sw_cur;
+};
+
+#define SN_DATA		(sizeof(struct snhdr) + \
+			 USB_MAX_DEVICES * sizeof(struct snapdev))
+
+/* Map a snapshot; NULL if there is none or it is not one we can read. */
+struct snap *
+snap_open(const char *file)
+{
+	struct snap *sn;
+	struct snhdr *h;
+	struct snapdev *sd;
+	const struct snaprec *sr;
+	struct stat st;
+	size_t off, end;
+	int fd, a;
+
+	if ((fd = open(file, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)SN_DATA ||
+	    (sn = calloc(1, sizeof *sn)) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	sn->sn_size = st.st_size;
+	sn->sn_map = mmap(0, sn->sn_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (sn->sn_map == MAP_FAILED) {
+		warn("%s", file);
+		free(sn);
+		return NULL;
+	}
+	h = (struct snhdr *)sn->sn_map;
+	sn->sn_dev = (struct snapdev *)(h + 1);
+	if (memcmp(h->sh_magic, SN_MAGIC, sizeof h->sh_magic) != 0 ||
+	    h->sh_version != SN_VERSION || h->sh_ndev != USB_MAX_DEVICES ||
+	    h->sh_size != sn->sn_size)
+		goto bad;
+	for (a = 0; a < USB_MAX_DEVICES; a++) {
+		sd = &sn->sn_dev[a];
+		if (!sd->sd_present)
+			continue;
+		if (sd->sd_off < SN_DATA || sd->sd_off % 8 ||
+		    sd->sd_off + sd->sd_len > sn->sn_size)
+			goto bad;
+		end = sd->sd_off + sd->sd_len;
+		for (off = sd->sd_off; off < end;
+		    off += sizeof *sr + SN_ALIGN(sr->sr_actlen)) {
+			sr = (const struct snaprec *)(sn->sn_map + off);
+			if (off + sizeof *sr > end ||
+			    off + sizeof *sr + SN_ALIGN(sr->sr_actlen) > end)
+				goto bad;
+		}
+	}
+	return sn;
+ bad:
+	warnx("%s: not a usable snapshot, ignored", file);
+	snap_close(sn);
+	return NULL;
+}
+
+const struct snapdev *
+snap_dev(struct snap *sn, int addr)
+{
+	if (sn == NULL || addr < 0 || addr >= USB_MAX_DEVICES ||
+	    !sn->sn_dev[addr].sd_present)
+		return NULL;
+	return &sn->sn_dev[addr];
+}
+
+/* The record after sr, or the first one if sr is NULL. */
+const struct snaprec *
+snap_next(struct snap *sn, const struct snapdev *sd, const struct snaprec *sr)
+{
+	const u_char *p, *end = sn->sn_map + sd->sd_off + sd->sd_len;
+
+	if (sr == NULL)
+		p = sn->sn_map + sd->sd_off;
+	else
+		p = SNAPDATA(sr) + SN_ALIGN(sr->sr_actlen);
+	return p < end ? (const struct snaprec *)p : NULL;
+}
+
+void
+snap_close(struct snap *sn)
+{
+	if (sn == NULL)
+		return;
+	munmap(sn->sn_map, sn->sn_size);
+	free(sn);
+}
+
+struct snapw *
+snapw_begin(void)
+{
+	struct snapw *sw;
+
+	if ((sw = calloc(1, sizeof *sw)) == NULL)
+		err(1, "calloc");
+	return sw;
+}
+
+/* Start the records of the device at addr. */
+void
+snapw_dev(struct snapw *sw, int addr, const struct snapid *id)
+{
+	sw->sw_cur = &sw->sw_dev[addr];
+	sw->sw_cur->sd_id = *id;
+	sw->sw_cur->sd_present = 1;
+	sw->sw_cur->sd_off = SN_DATA + sw->sw_len;
+	sw->sw_cur->sd_len = 0;
+}
+
+void
+snapw_rec(struct snapw *sw, const usb_device_request_t *dr, const void *data,
+	  int actlen)
+{
+	struct snaprec *sr;
+	size_t n = sizeof *sr + SN_ALIGN(actlen);
+
+	if (sw->sw_len + n > sw->sw_size) {
+		sw->sw_size = sw->sw_size ? sw->sw_size * 2 : 65536;
+		if (sw->sw_size < sw->sw_len + n)
+			sw->sw_size = sw->sw_len + n;
+		if ((sw->sw_buf = realloc(sw->sw_buf, sw->sw_size)) == NULL)
+			err(1, "realloc");
+	}
+	sr = (struct snaprec *)(sw->sw_buf + sw->sw_len);
+	memset(sr, 0, n);
+	sr->sr_type = dr->bmRequestType;
+	sr->sr_request = dr->bRequest;
+	sr->sr_value = UGETW(dr->wValue);
+	sr->sr_index = UGETW(dr->wIndex);
+	sr->sr_length = UGETW(dr->wLength);
+	sr->sr_actlen = actlen;
+	memcpy(sr + 1, data, actlen);
+	sw->sw_len += n;
+	sw->sw_cur->sd_len += n;
+}
+
+/* Write the snapshot to file, replacing it atomically, and free sw. */
+int
+snapw_write(struct snapw *sw, const char *file)
+{
+	struct snhdr *h = &sw->sw_hdr;
+	char *tmp;
+	int fd, ok, e;
+
+	memcpy(h->sh_magic, SN_MAGIC, sizeof h->sh_magic);
+	h->sh_version = SN_VERSION;
+	h->sh_ndev = USB_MAX_DEVICES;
+	h->sh_size = SN_DATA + sw->sw_len;
+	h->sh_time = time(NULL);
+	if (asprintf(&tmp, "%s.XXXXXX", file) < 0)
+		err(1, "asprintf");
+	ok = 0;
+	if ((fd = mkstemp(tmp)) >= 0) {
+		ok = write(fd, h, sizeof *h) == sizeof *h &&
+		    write(fd, sw->sw_dev, sizeof sw->sw_dev) ==
+		    sizeof sw->sw_dev &&
+		    write(fd, sw->sw_buf, sw->sw_len) == (ssize_t)sw->sw_len;
+		e = errno;
+		if (close(fd) < 0 || !ok || rename(tmp, file) < 0) {
+			e = errno;
+			unlink(tmp);
+			ok = 0;
+		}
+		errno = e;
+	}
+	free(tmp);
+	free(sw->sw_buf);
+	free(sw);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Topology snapshot.  The file holds, for every address, a cheap
+ * identity of the device there and the control requests it answered,
+ * with their data, so that a later run can serve unchanged devices
+ * straight from the mapping.  It is written in host byte order and
+ * read in place; a file of another version is ignored.
+ */
+struct snapid {
+	u_int16_t	si_vendor;
+	u_int16_t	si_product;
+	u_int16_t	si_release;
+	u_int8_t	si_class;
+	u_int8_t	si_config;
+	u_int64_t	si_serial;	/* strhash of the serial number */
+	u_int8_t	si_nports;
+	u_int8_t	si_ports[16];	/* as in udi_ports */
+	u_int8_t	si_pad[7];
+};
+
+struct snapdev {
+	struct snapid	sd_id;
+	u_int32_t	sd_present;
+	u_int32_t	sd_len;		/* bytes of records */
+	u_int64_t	sd_off;		/* first record, from start of file */
+};
+
+/* A request and its answer; sr_actlen bytes follow, padded to 8. */
+struct snaprec {
+	u_int8_t	sr_type;
+	u_int8_t	sr_request;
+	u_int16_t	sr_value;
+	u_int16_t	sr_index;
+	u_int16_t	sr_length;
+	u_int16_t	sr_actlen;
+	u_int16_t	sr_pad[3];
+};
+
+#define SNAPDATA(sr)	((const u_char *)((sr) + 1))
+
+struct snap;
+struct snapw;
+
+struct snap *snap_open(const char *);
+const struct snapdev *snap_dev(struct snap *, int);
+const struct snaprec *snap_next(struct snap *, const struct snapdev *,
+    const struct snaprec *);
+void snap_close(struct snap *);
+
+struct snapw *snapw_begin(void);
+void snapw_dev(struct snapw *, int, const struct snapid *);
+void snapw_rec(struct snapw *, const usb_device_request_t *, const void *, int);
+int snapw_write(struct snapw *, const char *);
@@ -25,41 +25,53 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <err.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <dev/usb/usb.h>
 
+#include "usbbus.h"
+
 #ifndef USB_STACK_VERSION
 #define uds_requests requests
 #endif
 
 #define USBDEV "/dev/usb"
+#define MAXCTLR 10
+
+char *xfernames[] = { "control", "isochronous", "bulk", "interrupt" };
 
 void
 usage(void)
 {
 	extern char *__progname;
 
-	fprintf(stderr, "Usage: %s [-f device]\n", __progname);
+	fprintf(stderr, "Usage: %s [-f device] [-w interval [-c count]]\n",
+		__progname);
 	exit(1);
 }
 
 void
 stats(char *dev, int msg)
 {
-	int f, r;
+	struct usbbus *ub;
+	int r;
 	struct usb_device_stats stats;
 
-	f = open(dev, O_RDWR);
-	if (f < 0) {
+	ub = usbbus_open(dev);
+	if (ub == NULL) {
 		if (msg)
 			err(1, "%s", dev);
 		else
 			return;
 	}
-	r = ioctl(f, USB_DEVICESTATS, &stats);
+	r = usbbus_ioctl(ub, USB_DEVICESTATS, &stats);
 	if (r < 0)
 		err(1, "USB_DEVICESTATS");
 	if (!msg)
@@ -68,6 +80,201 @@ stats(char *dev, int msg)
 	printf("%10lu isochronous\n", stats.uds_requests[UE_ISOCHRONOUS]);
 	printf("%10lu bulk\n",        stats.uds_requests[UE_BULK]);
 	printf("%10lu interrupt\n",   stats.uds_requests[UE_INTERRUPT]);
+	usbbus_close(ub);
+}
+
+/*
+ * Rate summary for one transfer type on one controller.  Besides
+ * min/max/sum the rates go into a log-linear histogram (RSUB buckets
+ * per power of two) so percentiles cost a fixed amount of memory no
+ * matter how long we run; they are good to about 1/RSUB.
+ */
+#define RSUB	16
+#define RPOW	40
+#define RBUCKETS (RSUB * (RPOW + 1))
+
+struct ratestat {
+	double		min, max, sum;
+	u_long		n;
+	u_long		hist[RBUCKETS];
+};
+
+struct ctlr {
+	char		name[1024];
+	struct usbbus	*ub;
+	u_long		last[4];
+	struct ratestat	rs[4];
+};
+
+int
+rbucket(double v)
+{
+	int e, b;
+
+	if (v < 1)
+		return 0;
+	for (e = 0; v >= 2 * RSUB && e < RPOW - 1; e++)
+		v /= 2;
+	b = e * RSUB + (int)v;
+	return b < RBUCKETS ? b : RBUCKETS - 1;
+}
+
+double
+rbucketval(int b)
+{
+	int e;
+
+	if (b < 2 * RSUB)
+		return b;
+	e = b / RSUB - 1;
+	return (double)(b - e * RSUB) * ((u_int64_t)1 << e);
+}
+
+void
+raddsample(struct ratestat *rs, double v)
+{
+	if (rs->n == 0 || v < rs->min)
+		rs->min = v;
+	if (rs->n == 0 || v > rs->max)
+		rs->max = v;
+	rs->sum += v;
+	rs->n++;
+	rs->hist[rbucket(v)]++;
+}
+
+double
+rpercentile(struct ratestat *rs, double p)
+{
+	u_long want, seen;
+	int b;
+
+	want = rs->n * p / 100;
+	for (seen = b = 0; b < RBUCKETS; b++) {
+		seen += rs->hist[b];
+		if (seen > want)
+			return rbucketval(b);
+	}
+	return rs->max;
+}
+
+volatile sig_atomic_t stop;
+
+void
+onsig(int sig)
+{
+	stop = 1;
+}
+
+int
+getstats(struct ctlr *c, struct usb_device_stats *st)
+{
+	if (usbbus_ioctl(c->ub, USB_DEVICESTATS, st) < 0) {
+		warn("%s: USB_DEVICESTATS", c->name);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Sample every controller each interval seconds, count times or until
+ * interrupted, and print the per type deltas and rates.  The
+ * controllers stay open and the wakeups are on an absolute schedule,
+ * so the sampling does not drift however long the loop body takes.
+ */
+void
+watch(char *dev, double interval, long count)
+{
+	struct ctlr ctlrs[MAXCTLR], *c;
+	struct usb_device_stats st;
+	struct timespec next, t;
+	double prev, cur, dt, rate;
+	long n;
+	int i, j, nc = 0;
+
+	for (i = 0; i < MAXCTLR; i++) {
+		c = &ctlrs[nc];
+		memset(c, 0, sizeof *c);
+		if (dev) {
+			if (i > 0)
+				break;
+			snprintf(c->name, sizeof c->name, "%s", dev);
+		} else
+			snprintf(c->name, sizeof c->name, "%s%d", USBDEV, i);
+		c->ub = usbbus_open(c->name);
+		if (c->ub == NULL) {
+			if (dev)
+				err(1, "%s", dev);
+			continue;
+		}
+		if (getstats(c, &st) < 0) {
+			usbbus_close(c->ub);
+			continue;
+		}
+		for (j = 0; j < 4; j++)
+			c->last[j] = st.uds_requests[j];
+		nc++;
+	}
+	if (nc == 0)
+		errx(1, "no controllers");
+
+	signal(SIGINT, onsig);
+	signal(SIGTERM, onsig);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	prev = next.tv_sec + next.tv_nsec / 1e9;
+	printf("%-12s", "controller");
+	for (j = 0; j < 4; j++)
+		printf(" %10s %10s", xfernames[j], "/s");
+	printf("\n");
+	for (n = 0; !stop && (count == 0 || n < count); n++) {
+		next.tv_sec += (time_t)interval;
+		next.tv_nsec += (long)((interval - (time_t)interval) * 1e9);
+		if (next.tv_nsec >= 1000000000) {
+			next.tv_sec++;
+			next.tv_nsec -= 1000000000;
+		}
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+		    &next, NULL) == EINTR)
+			if (stop)
+				break;
+		if (stop)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &t);
+		cur = t.tv_sec + t.tv_nsec / 1e9;
+		dt = cur - prev;
+		prev = cur;
+		for (i = 0; i < nc; i++) {
+			c = &ctlrs[i];
+			if (getstats(c, &st) < 0)
+				continue;
+			printf("%-12s", c->name);
+			for (j = 0; j < 4; j++) {
+				rate = (st.uds_requests[j] - c->last[j]) / dt;
+				printf(" %10lu %10.1f",
+				       st.uds_requests[j] - c->last[j], rate);
+				c->last[j] = st.uds_requests[j];
+				raddsample(&c->rs[j], rate);
+			}
+			printf("\n");
+		}
+		fflush(stdout);
+	}
+
+	printf("\n%-12s %-12s %10s %10s %10s %10s %10s %10s\n", "controller",
+	       "type", "min/s", "avg/s", "max/s", "p50", "p90", "p99");
+	for (i = 0; i < nc; i++) {
+		c = &ctlrs[i];
+		for (j = 0; j < 4; j++) {
+			struct ratestat *rs = &c->rs[j];
+
+			if (rs->n == 0)
+				continue;
+			printf("%-12s %-12s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+			       c->name, xfernames[j], rs->min, rs->sum / rs->n,
+			       rs->max, rpercentile(rs, 50), rpercentile(rs, 90),
+			       rpercentile(rs, 99));
+		}
+		usbbus_close(c->ub);
+	}
 }
 
 int
@@ -75,12 +282,22 @@ main(int argc, char **argv)
 {
 	int ch;
 	char *dev = 0;
+	double interval = 0;
+	long count = 0;
 
-	while ((ch = getopt(argc, argv, "f:")) != -1) {
+	while ((ch = getopt(argc, argv, "c:f:w:")) != -1) {
 		switch(ch) {
+		case 'c':
+			count = atol(optarg);
+			break;
 		case 'f':
 			dev = optarg;
 			break;
+		case 'w':
+			interval = atof(optarg);
+			if (interval <= 0)
+				usage();
+			break;
 		case '?':
 		default:
 			usage();
@@ -89,12 +306,16 @@ main(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (dev)
+	if (count && !interval)
+		usage();
+	if (interval)
+		watch(dev, interval, count);
+	else if (dev)
 		stats(dev, 1);
 	else {
 		int i;
 		char buf[20];
-		for (i = 0; i < 10; i++) {
+		for (i = 0; i < MAXCTLR; i++) {
 			sprintf(buf, "%s%d", USBDEV, i);
 			stats(buf, 0);
 		}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <err.h>
+#include <time.h>
+#include <dev/usb/usb.h>
+#include <dev/usb/usbhid.h>
+
+#include "usbtrace.h"
+
+struct trace {
+	struct trspan	*tr_ring;
+	u_int64_t	tr_size;
+	u_int64_t	tr_next;	/* spans ever added */
+	u_int32_t	tr_nthread;
+	struct timespec	tr_t0;
+};
+
+static __thread u_int32_t tr_thread;
+
+struct trace *
+trace_open(int size)
+{
+	struct trace *tr;
+
+	if ((tr = calloc(1, sizeof *tr)) == NULL ||
+	    (tr->tr_ring = calloc(size, sizeof *tr->tr_ring)) == NULL)
+		err(1, "calloc");
+	/* Touch the ring now so that tracing does not fault it in. */
+	memset(tr->tr_ring, 0, size * sizeof *tr->tr_ring);
+	tr->tr_size = size;
+	clock_gettime(CLOCK_MONOTONIC, &tr->tr_t0);
+	return tr;
+}
+
+u_int64_t
+trace_now(struct trace *tr)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_t)(ts.tv_sec - tr->tr_t0.tv_sec) * 1000000000 +
+	    ts.tv_nsec - tr->tr_t0.tv_nsec;
+}
+
+/* Record a span; ts_start must be set, the rest is filled in here. */
+void
+trace_add(struct trace *tr, struct trspan *sp)
+{
+	u_int64_t n;
+
+	sp->ts_dur = trace_now(tr) - sp->ts_start;
+	if (tr_thread == 0)
+		tr_thread = __atomic_add_fetch(&tr->tr_nthread, 1,
+		    __ATOMIC_RELAXED);
+	sp->ts_thread = tr_thread;
+	n = __atomic_fetch_add(&tr->tr_next, 1, __ATOMIC_RELAXED);
+	tr->tr_ring[n % tr->tr_size] = *sp;
+}
+
+static const char *reqnames[] = {
+	"GET_STATUS", "CLEAR_FEATURE", "2", "SET_FEATURE", "4",
+	"SET_ADDRESS", "GET_DESCRIPTOR", "SET_DESCRIPTOR", "GET_CONFIG",
+	"SET_CONFIG", "GET_INTERFACE", "SET_INTERFACE", "SYNCH_FRAME"
+};
+
+static const char *recipnames[] = { "device", "interface", "endpoint",
+    "other" };
+
+static const struct {
+	u_long		cmd;
+	const char	*name;
+} ioctlnames[] = {
+	{ USB_DISCOVER, "USB_DISCOVER" },
+	{ USB_SETDEBUG, "USB_SETDEBUG" },
+	{ USB_DEVICESTATS, "USB_DEVICESTATS" },
+	{ USB_GET_CONFIG, "USB_GET_CONFIG" },
+	{ USB_SET_CONFIG, "USB_SET_CONFIG" },
+	{ USB_GET_ALTINTERFACE, "USB_GET_ALTINTERFACE" },
+	{ USB_SET_ALTINTERFACE, "USB_SET_ALTINTERFACE" },
+	{ USB_GET_DEVICE_DESC, "USB_GET_DEVICE_DESC" },
+	{ USB_GET_CONFIG_DESC, "USB_GET_CONFIG_DESC" },
+	{ USB_GET_FULL_DESC, "USB_GET_FULL_DESC" },
+	{ USB_DO_REQUEST, "USB_DO_REQUEST" },
+	{ USB_GET_DEVICEINFO, "USB_GET_DEVICEINFO" },
+};
+
+static const char *
+desctype(int t)
+{
+	static char buf[8];
+
+	switch (t) {
+	case UDESC_DEVICE:	return "device";
+	case UDESC_CONFIG:	return "config";
+	case UDESC_STRING:	return "string";
+	case UDESC_HID:		return "hid";
+	case UDESC_REPORT:	return "report";
+	case 0:
+	case UDESC_HUB:		return "hub";
+	}
+	snprintf(buf, sizeof buf, "0x%02x", t);
+	return buf;
+}
+
+/* A name for the kind of operation a span is. */
+static void
+spanname(const struct trspan *sp, char *buf, size_t size)
+{
+	const char *kind;
+	size_t i;
+
+	switch (sp->ts_op) {
+	case TR_DEVINFO:
+		snprintf(buf, size, "USB_DEVICEINFO");
+		return;
+	case TR_IOCTL:
+		for (i = 0; i < sizeof ioctlnames / sizeof ioctlnames[0]; i++)
+			if ((u_int32_t)ioctlnames[i].cmd == sp->ts_cmd) {
+				snprintf(buf, size, "%s", ioctlnames[i].name);
+				return;
+			}
+		snprintf(buf, size, "ioctl 0x%08x", sp->ts_cmd);
+		return;
+	}
+	kind = (sp->ts_type & 0x60) == UT_CLASS ? "class " :
+	    (sp->ts_type & 0x60) == UT_VENDOR ? "vendor " : "";
+	if ((sp->ts_type & 0x60) == UT_VENDOR || sp->ts_request >=
+	    sizeof reqnames / sizeof reqnames[0])
+		snprintf(buf, size, "%s%s %d", kind,
+		    sp->ts_type & UT_READ ? "read" : "write", sp->ts_request);
+	else if (sp->ts_request == UR_GET_DESCRIPTOR)
+		snprintf(buf, size, "%sGET_DESCRIPTOR(%s)", kind,
+		    desctype(sp->ts_value >> 8));
+	else
+		snprintf(buf, size, "%s%s(%s)", kind,
+		    reqnames[sp->ts_request], recipnames[sp->ts_type & 3]);
+}
+
+/* The spans still in the ring, oldest first. */
+static struct trspan *
+spans(struct trace *tr, size_t *np)
+{
+	u_int64_t first, i;
+	struct trspan *v;
+	size_t n;
+
+	first = tr->tr_next > tr->tr_size ? tr->tr_next - tr->tr_size : 0;
+	n = tr->tr_next - first;
+	if ((v = calloc(n + 1, sizeof *v)) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++)
+		v[i] = tr->tr_ring[(first + i) % tr->tr_size];
+	*np = n;
+	return v;
+}
+
+struct sumkey {
+	char		k_name[48];
+	u_int64_t	k_dur;
+	int		k_error;
+};
+
+static int
+sumcmp(const void *a, const void *b)
+{
+	const struct sumkey *x = a, *y = b;
+	int c;
+
+	if ((c = strcmp(x->k_name, y->k_name)) != 0)
+		return c;
+	return x->k_dur < y->k_dur ? -1 : x->k_dur > y->k_dur;
+}
+
+/* One summary table, grouping the keys by name. */
+static void
+sumtable(struct sumkey *k, size_t n, const char *what, FILE *f)
+{
+	size_t i, j, m, errs;
+	double tot;
+
+	qsort(k, n, sizeof *k, sumcmp);
+	fprintf(f, "%-32s %7s %6s %10s %9s %9s %9s %9s\n", what, "count",
+	    "errors", "total ms", "avg us", "p50 us", "p99 us", "max us");
+	for (i = 0; i < n; i = j) {
+		tot = 0;
+		errs = 0;
+		for (j = i; j < n && strcmp(k[j].k_name, k[i].k_name) == 0;
+		    j++) {
+			tot += k[j].k_dur;
+			errs += k[j].k_error != 0;
+		}
+		m = j - i;
+		fprintf(f, "%-32s %7zu %6zu %10.3f %9.1f %9.1f %9.1f %9.1f\n",
+		    k[i].k_name, m, errs, tot / 1e6, tot / m / 1e3,
+		    k[i + (m - 1) / 2].k_dur / 1e3,
+		    k[i + (m - 1) * 99 / 100].k_dur / 1e3,
+		    k[j - 1].k_dur / 1e3);
+	}
+}
+
+/* Latency by request type and by device address. */
+void
+trace_summary(struct trace *tr, FILE *f)
+{
+	struct trspan *v;
+	struct sumkey *k;
+	size_t i, n, m;
+
+	v = spans(tr, &n);
+	if ((k = calloc(n + 1, sizeof *k)) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < n; i++) {
+		spanname(&v[i], k[i].k_name, sizeof k[i].k_name);
+		k[i].k_dur = v[i].ts_dur;
+		k[i].k_error = v[i].ts_error;
+	}
+	sumtable(k, n, "request", f);
+	/* Leave out the probing of empty addresses. */
+	for (i = m = 0; i < n; i++) {
+		if (v[i].ts_op == TR_DEVINFO && v[i].ts_error)
+			continue;
+		if (v[i].ts_op == TR_IOCTL)
+			snprintf(k[m].k_name, sizeof k[m].k_name, "bus");
+		else
+			snprintf(k[m].k_name, sizeof k[m].k_name, "addr %3d",
+			    v[i].ts_addr);
+		k[m].k_dur = v[i].ts_dur;
+		k[m++].k_error = v[i].ts_error;
+	}
+	fprintf(f, "\n");
+	sumtable(k, m, "device", f);
+	if (tr->tr_next > n)
+		fprintf(f, "\n%llu older spans lost, ring holds %llu\n",
+		    (unsigned long long)(tr->tr_next - n),
+		    (unsigned long long)tr->tr_size);
+	free(k);
+	free(v);
+}
+
+/*
+ * Chrome trace events: a complete ("X") event per span, with the
+ * device address as the process.  Bus-wide ioctls go to process 0.
+ */
+int
+trace_chrome(struct trace *tr, FILE *f)
+{
+	struct trspan *v;
+	char name[48], seen[1 + 256];	/* bus, then each ts_addr */
+	size_t i, n;
+	int pid;
+
+	v = spans(tr, &n);
+	memset(seen, 0, sizeof seen);
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (i = 0; i < n; i++) {
+		pid = v[i].ts_op == TR_IOCTL ? 0 : v[i].ts_addr + 1;
+		if (!seen[pid]) {
+			seen[pid] = 1;
+			if (pid)
+				snprintf(name, sizeof name, "addr %d", pid - 1);
+			else
+				snprintf(name, sizeof name, "bus");
+			fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\","
+			    "\"pid\":%d,\"args\":{\"name\":\"%s\"}},\n",
+			    pid, name);
+		}
+		spanname(&v[i], name, sizeof name);
+		fprintf(f, "{\"name\":\"%s\",\"cat\":\"usb\",\"ph\":\"X\","
+		    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+		    "\"args\":{\"addr\":%d,\"bmRequestType\":%d,"
+		    "\"bRequest\":%d,\"wValue\":%d,\"wIndex\":%d,"
+		    "\"wLength\":%d,\"actlen\":%d,\"error\":%d}}%s\n",
+		    name, v[i].ts_start / 1e3, v[i].ts_dur / 1e3, pid,
+		    v[i].ts_thread, v[i].ts_addr, v[i].ts_type,
+		    v[i].ts_request, v[i].ts_value, v[i].ts_index,
+		    v[i].ts_length, v[i].ts_actlen, v[i].ts_error,
+		    i + 1 < n ? "," : "");
+	}
+	fprintf(f, "],\"displayTimeUnit\":\"ns\"}\n");
+	free(v);
+	return ferror(f) ? -1 : 0;
+}
+
+void
+trace_close(struct trace *tr)
+{
+	if (tr == NULL)
+		return;
+	free(tr->tr_ring);
+	free(tr);
+}
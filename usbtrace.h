@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Tracing of bus operations.  When a bus has a trace attached, every
+ * control request, device info query and ioctl is timed and recorded
+ * in a ring of spans allocated up front; when the ring is full the
+ * oldest spans are overwritten.  At the end the spans can be
+ * summarized by request type and by device, or written out in the
+ * Chrome trace event format (chrome://tracing, Perfetto), with a
+ * process per device address and a thread per tool thread.
+ */
+#define TR_REQUEST	0
+#define TR_DEVINFO	1
+#define TR_IOCTL	2
+
+struct trspan {
+	u_int64_t	ts_start;	/* ns since the trace was opened */
+	u_int64_t	ts_dur;		/* ns */
+	u_int32_t	ts_thread;
+	u_int32_t	ts_cmd;		/* ioctl */
+	u_int8_t	ts_op;		/* TR_* */
+	u_int8_t	ts_addr;
+	u_int8_t	ts_type;	/* bmRequestType */
+	u_int8_t	ts_request;	/* bRequest */
+	u_int16_t	ts_value;
+	u_int16_t	ts_index;
+	u_int16_t	ts_length;
+	u_int16_t	ts_actlen;
+	u_int16_t	ts_error;	/* errno, 0 if it worked */
+};
+
+struct trace;
+
+struct trace *trace_open(int);
+u_int64_t trace_now(struct trace *);
+void trace_add(struct trace *, struct trspan *);
+void trace_summary(struct trace *, FILE *);
+int trace_chrome(struct trace *, FILE *);
+void trace_close(struct trace *);
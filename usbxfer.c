@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "usbxfer.h"
+
+/*
+ * Open the node for endpoint addr of the ugen device whose control
+ * node is ctl, e.g. /dev/ugen0.00 and 0x81 give /dev/ugen0.01.
+ */
+int
+ep_open(const char *ctl, int addr, int mode)
+{
+	char name[1024], *p;
+
+	snprintf(name, sizeof name - 4, "%s", ctl);
+	p = strrchr(name, '.');
+	if (p != NULL && p > strrchr(name, '/') && p[1] >= '0' && p[1] <= '9')
+		*p = 0;
+	snprintf(name + strlen(name), 4, ".%02d", addr & 0x0f);
+	return open(name, mode);
+}
+
+void
+smp_add(struct samples *s, double v)
+{
+	if (s->s_n == s->s_size) {
+		s->s_size = s->s_size ? s->s_size * 2 : 1024;
+		s->s_v = realloc(s->s_v, s->s_size * sizeof *s->s_v);
+		if (s->s_v == NULL)
+			err(1, "realloc");
+	}
+	s->s_v[s->s_n++] = v;
+	s->s_sorted = 0;
+}
+
+/* Move all of src into dst. */
+void
+smp_merge(struct samples *dst, struct samples *src)
+{
+	size_t i;
+
+	for (i = 0; i < src->s_n; i++)
+		smp_add(dst, src->s_v[i]);
+	smp_free(src);
+}
+
+static int
+dblcmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* The p'th percentile, p in 0..100; sorts the samples the first time. */
+double
+smp_pct(struct samples *s, double p)
+{
+	size_t i;
+
+	if (s->s_n == 0)
+		return 0;
+	if (!s->s_sorted) {
+		qsort(s->s_v, s->s_n, sizeof *s->s_v, dblcmp);
+		s->s_sorted = 1;
+	}
+	i = s->s_n * p / 100;
+	return s->s_v[i < s->s_n ? i : s->s_n - 1];
+}
+
+void
+smp_free(struct samples *s)
+{
+	free(s->s_v);
+	memset(s, 0, sizeof *s);
+}